@@ -1,5 +1,12 @@
 #include "common_core.hh"
+#include "common_av.hh"
+#include "common_dsa.hh"
 #include "common_math.hh"
+#include "common_thread.hh"
+
+#ifdef FUN_X64
+# include <immintrin.h>
+#endif
 
 extern "C" {
   #include <libavcodec/avcodec.h>
@@ -11,8 +18,13 @@ extern "C" {
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
 
-constexpr u32 CANVAS_W = 800;
-constexpr u32 CANVAS_H = 600;
+constexpr u32 DEFAULT_CANVAS_W = 800;
+constexpr u32 DEFAULT_CANVAS_H = 600;
+constexpr u32 MAX_WINDOW_W = 1280;
+constexpr u32 MAX_WINDOW_H = 800;
+
+constexpr u32 CANVAS_TILE = 64;
+constexpr u32 CANVAS_TILE_AREA = CANVAS_TILE * CANVAS_TILE;
 
 constexpr u32 FPS = 60;
 
@@ -26,37 +38,852 @@ static_assert(sizeof(Pixel_RGB888) == 3);
 constexpr Pixel_RGB888 PIXEL_BLACK = { .r = 0x00, .g = 0x00, .b = 0x00 };
 constexpr Pixel_RGB888 PIXEL_WHITE = { .r = 0xFF, .g = 0xFF, .b = 0xFF };
 
+// One cursor sample of a stroke script
+struct StrokeSample {
+  u32 t_ms;
+  Vec2 pos;
+  f32 radius;
+  bool down;
+  u8 shape;
+};
+
+struct BrushVariant;
+
+// Canvas stored as CANVAS_TILE x CANVAS_TILE tiles, each one contiguous, so
+// strokes touch few cache lines and only changed tiles are uploaded and
+// converted. Tiles on the right and bottom edges are padded.
+struct Canvas {
+  u32 w;
+  u32 h;
+  u32 tiles_x;
+  u32 tiles_y;
+  Pixel_RGB888* tiles;
+  u8* dirty_display;
+  u8* dirty_encode;
+  u32* job_tiles;
+  u32 num_job_tiles;
+  u8* cov;
+};
+
+// Input journal record tags
+enum : u8 {
+  JNL_REC_MOTION = 1, // dt, dx, dy
+  JNL_REC_BUTTON,     // dt, down
+  JNL_REC_RADIUS,     // dt, radius
+  JNL_REC_FRAME,      // dt
+  JNL_REC_SHAPE,      // dt, shape
+};
+
+constexpr u32 JNL_MAGIC = 0x314A4756; // "VGJ1"
+constexpr u32 JNL_MAX_CANVAS = 8192;
+constexpr usize JNL_BUFFER_SIZE = 64 * 1024;
+constexpr usize JNL_MAX_RECORD_SIZE = 1 + 3 * 10;
+constexpr f32 JNL_POS_SCALE = 8.0f; // positions are stored in 1/8 pixels
+
+// Double-buffered journal: the main thread fills one buffer while the
+// writer thread flushes the other to disk.
+struct Journal {
+  FILE* file;
+  SDL_Thread* thread;
+  SDL_Mutex* mtx;
+  SDL_Condition* cond;
+  u8* bufs[2];
+  u8* active;
+  usize active_len;
+  u8* pending;
+  usize pending_len;
+  bool quit;
+  u64 last_t_us;
+  i32 last_x;
+  i32 last_y;
+  f32 last_radius;
+  u8 last_shape;
+  u64 bytes_written;
+  u32 num_records;
+};
+
+constexpr u32 MUX_QUEUE_SIZE = 256;
+constexpr u32 MUX_MAX_KEEP = 64;
+
+// Packets and frames the pools start with; the queue bounds packets in flight
+constexpr u32 REC_POOL_PACKETS = 32;
+constexpr u32 REC_POOL_FRAMES = 3;
+// Frames after which pool allocations count against steady state
+constexpr u32 REC_WARMUP_FRAMES = FPS * 2;
+// Highest rate --cfr accepts
+constexpr int REC_MAX_CFR = 240;
+
+struct Muxer {
+  SDL_Thread* thread;
+  SDL_Mutex* mtx;
+  SDL_Condition* cond;
+  AV_PacketPool* pool;
+  AVPacket* queue[MUX_QUEUE_SIZE];
+  u32 head;
+  u32 count;
+  bool quit;
+  bool save_requested;
+  // Segmenting options
+  f64 seg_time;
+  u64 seg_bytes;
+  u32 seg_keep;
+  // Writer thread state
+  AVCodecParameters* codecpar;
+  AVRational enc_time_base;
+  AVFormatContext* avfc;
+  AVStream* avst;
+  char seg_path[256];
+  u32 seg_index;
+  i64 seg_start_pts;
+  char kept[MUX_MAX_KEEP][256];
+  u32 num_kept;
+  // Drift of written timestamps from capture times. The latest, in
+  // microseconds, is shown while recording; the rest is read after MUX_End.
+  SDL_AtomicInt drift_last_us;
+  f64 drift_sum;
+  f64 drift_max;
+  u32 drift_frames;
+};
+
 static struct {
   SDL_Window* wnd;
   SDL_Renderer* r;
   Vec2 cur_pos;
   f32 cur_radius;
-  Pixel_RGB888* canvas;
+  bool cur_down;
+  u8 cur_shape;
+  Vec2 last_pos;
+  bool last_down;
+  const BrushVariant* brush;
+  Canvas canvas;
   SDL_Texture* canvas_tex;
+  JobPool jobs;
   bool recording;
-  char filename[64];
-  AVFormatContext* avfc;
+  char filename[256];
   AVCodecContext* avcc;
-  AVStream* avst;
   AVFrame* avframe_inp;
   AVFrame* avframe_out;
-  AVPacket* avpkt;
-  SwsContext* sws;
+  AV_FramePool frame_pool;
+  AV_PacketPool pkt_pool;
+  u32 allocs_warm;
+  AV_Converter conv;
   u32 frame_num;
-  u32 next_pts;
+  u32 cfr;
+  u64 rec_t0_ns;
+  i64 last_pts;
+  u32 frames_dropped;
+  u32 frames_duplicated;
+  u32 out_w;
+  u32 out_h;
+  i64 bit_rate;
+  Journal jnl;
+  Muxer mux;
 } g = { };
 
-void REC_Begin() {
-  g.recording = true;
+//
+// Brush
+//
+// Strokes are rasterized as capsules between consecutive cursor samples, so
+// fast movement leaves no gaps. Each canvas row is processed as a span: a
+// coverage pass computes anti-aliased coverage for the span and a blend pass
+// lerps the brush colour into the RGB bytes. Coverage has SSE2 and AVX2
+// variants and blending SSSE3 and AVX2 ones, selected at startup.
+//
+
+enum : u8 {
+  BRUSH_SHAPE_ROUND = 0, // hard edge, 1px anti-aliased fringe
+  BRUSH_SHAPE_SOFT,      // linear falloff towards the edge
+  BRUSH_SHAPE_SQUARE,    // square stamp swept along the stroke
+  BRUSH_SHAPE_COUNT,
+};
+
+const char* BRUSH_SHAPE_NAMES[BRUSH_SHAPE_COUNT] = { "round", "soft", "square" };
+
+// Capsule from a to b, evaluated at pixel centers
+struct BrushSegment {
+  f32 ax, ay;
+  f32 bax, bay;
+  f32 inv_len2;
+  f32 radius;
+  u8 shape;
+};
+
+using BrushCoverageRowFn = void(*)(const BrushSegment* seg, u32 x0, u32 count, f32 py, u8* cov);
+using BrushBlendRowFn = void(*)(u8* dst, const u8* cov, u32 count, Pixel_RGB888 color);
+
+static inline f32 BRUSH_Coverage(const BrushSegment* seg, f32 px, f32 py) {
+  const f32 pax = px - seg->ax;
+  const f32 pay = py - seg->ay;
+  const f32 t = Clamp((pax * seg->bax + pay * seg->bay) * seg->inv_len2, 0.0f, 1.0f);
+  const f32 dx = pax - seg->bax * t;
+  const f32 dy = pay - seg->bay * t;
+  switch (seg->shape) {
+  case BRUSH_SHAPE_SOFT: {
+    return Clamp(1.0f - std::sqrt(dx * dx + dy * dy) / seg->radius, 0.0f, 1.0f);
+  }
+  case BRUSH_SHAPE_SQUARE: {
+    return Clamp(seg->radius + 0.5f - Max(std::fabs(dx), std::fabs(dy)), 0.0f, 1.0f);
+  }
+  default: {
+    return Clamp(seg->radius + 0.5f - std::sqrt(dx * dx + dy * dy), 0.0f, 1.0f);
+  }
+  }
+}
+
+void BRUSH_CoverageRow_Scalar(const BrushSegment* seg, u32 x0, u32 count, f32 py, u8* cov) {
+  for (u32 i = 0; i < count; ++i) {
+    cov[i] = (u8)(BRUSH_Coverage(seg, (f32)(x0 + i) + 0.5f, py) * 255.0f + 0.5f);
+  }
+}
+
+// dst = (dst * (256 - c) + color * c) >> 8, with c = cov remapped to 0..256
+void BRUSH_BlendRow_Scalar(u8* dst, const u8* cov, u32 count, Pixel_RGB888 color) {
+  for (u32 i = 0; i < count; ++i) {
+    const u32 c = cov[i] + (cov[i] >> 7);
+    dst[i * 3 + 0] = (u8)((dst[i * 3 + 0] * (256 - c) + color.r * c) >> 8);
+    dst[i * 3 + 1] = (u8)((dst[i * 3 + 1] * (256 - c) + color.g * c) >> 8);
+    dst[i * 3 + 2] = (u8)((dst[i * 3 + 2] * (256 - c) + color.b * c) >> 8);
+  }
+}
+
+#ifdef FUN_X64
+
+void BRUSH_CoverageRow_SSE2(const BrushSegment* seg, u32 x0, u32 count, f32 py, u8* cov) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+  const __m128 bax = _mm_set1_ps(seg->bax);
+  const __m128 bay = _mm_set1_ps(seg->bay);
+  const __m128 inv_len2 = _mm_set1_ps(seg->inv_len2);
+  const __m128 pay = _mm_set1_ps(py - seg->ay);
+  const __m128 pay_bay = _mm_mul_ps(pay, bay);
+  const __m128 edge = _mm_set1_ps(seg->shape == BRUSH_SHAPE_SOFT ? 1.0f : seg->radius + 0.5f);
+  const __m128 dist_scale = _mm_set1_ps(seg->shape == BRUSH_SHAPE_SOFT ? 1.0f / seg->radius : 1.0f);
+  const __m128 scale = _mm_set1_ps(255.0f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  __m128 pax = _mm_add_ps(_mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f), _mm_set1_ps((f32)x0 - seg->ax));
+  const __m128 step = _mm_set1_ps(4.0f);
+
+  u32 i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 t = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(pax, bax), pay_bay), inv_len2);
+    t = _mm_min_ps(_mm_max_ps(t, zero), one);
+    const __m128 dx = _mm_sub_ps(pax, _mm_mul_ps(bax, t));
+    const __m128 dy = _mm_sub_ps(pay, _mm_mul_ps(bay, t));
+    __m128 dist;
+    if (seg->shape == BRUSH_SHAPE_SQUARE) {
+      dist = _mm_max_ps(_mm_and_ps(dx, abs_mask), _mm_and_ps(dy, abs_mask));
+    } else {
+      dist = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+    }
+    __m128 c = _mm_sub_ps(edge, _mm_mul_ps(dist, dist_scale));
+    c = _mm_min_ps(_mm_max_ps(c, zero), one);
+    const __m128i ci = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, scale), half));
+    const __m128i c16 = _mm_packs_epi32(ci, ci);
+    const __m128i c8 = _mm_packus_epi16(c16, c16);
+    const u32 packed = (u32)_mm_cvtsi128_si32(c8);
+    SDL_memcpy(&cov[i], &packed, 4);
+    pax = _mm_add_ps(pax, step);
+  }
+  BRUSH_CoverageRow_Scalar(seg, x0 + i, count - i, py, cov + i);
+}
+
+FUN_TARGET("avx2,fma")
+void BRUSH_CoverageRow_AVX2(const BrushSegment* seg, u32 x0, u32 count, f32 py, u8* cov) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+  const __m256 bax = _mm256_set1_ps(seg->bax);
+  const __m256 bay = _mm256_set1_ps(seg->bay);
+  const __m256 inv_len2 = _mm256_set1_ps(seg->inv_len2);
+  const __m256 pay = _mm256_set1_ps(py - seg->ay);
+  const __m256 pay_bay = _mm256_mul_ps(pay, bay);
+  const __m256 edge = _mm256_set1_ps(seg->shape == BRUSH_SHAPE_SOFT ? 1.0f : seg->radius + 0.5f);
+  const __m256 dist_scale = _mm256_set1_ps(seg->shape == BRUSH_SHAPE_SOFT ? 1.0f / seg->radius : 1.0f);
+  const __m256 scale = _mm256_set1_ps(255.0f);
+  const __m256 half = _mm256_set1_ps(0.5f);
+  __m256 pax = _mm256_add_ps(_mm256_set_ps(7.5f, 6.5f, 5.5f, 4.5f, 3.5f, 2.5f, 1.5f, 0.5f), _mm256_set1_ps((f32)x0 - seg->ax));
+  const __m256 step = _mm256_set1_ps(8.0f);
+
+  u32 i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 t = _mm256_mul_ps(_mm256_fmadd_ps(pax, bax, pay_bay), inv_len2);
+    t = _mm256_min_ps(_mm256_max_ps(t, zero), one);
+    const __m256 dx = _mm256_fnmadd_ps(bax, t, pax);
+    const __m256 dy = _mm256_fnmadd_ps(bay, t, pay);
+    __m256 dist;
+    if (seg->shape == BRUSH_SHAPE_SQUARE) {
+      dist = _mm256_max_ps(_mm256_and_ps(dx, abs_mask), _mm256_and_ps(dy, abs_mask));
+    } else {
+      dist = _mm256_sqrt_ps(_mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy)));
+    }
+    __m256 c = _mm256_fnmadd_ps(dist, dist_scale, edge);
+    c = _mm256_min_ps(_mm256_max_ps(c, zero), one);
+    const __m256i ci = _mm256_cvttps_epi32(_mm256_fmadd_ps(c, scale, half));
+    const __m128i c16 = _mm_packs_epi32(_mm256_castsi256_si128(ci), _mm256_extracti128_si256(ci, 1));
+    _mm_storel_epi64((__m128i*)&cov[i], _mm_packus_epi16(c16, c16));
+    pax = _mm256_add_ps(pax, step);
+  }
+  BRUSH_CoverageRow_Scalar(seg, x0 + i, count - i, py, cov + i);
+}
+
+// Pixel byte j + k of a 16-byte block reads coverage (j % 3 + k) / 3 past
+// pixel j / 3. Blocks start at multiples of 16 (or 32) bytes, which cycle
+// through 3 phases. Indices are lane-local, so the upper 16 entries serve
+// the second AVX2 lane from the same 16 coverage bytes.
+alignas(32) static const u8 BRUSH_EXPAND_SHUFFLE[3][32] = {
+  { 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5,  5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10 },
+  { 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5, 5,  5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10, 10 },
+  { 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5, 5, 5,  6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10, 10, 11 },
+};
+
+// Colour bytes repeat every 3 bytes, in the same 3 phases
+static inline void BRUSH_ColorPattern(Pixel_RGB888 color, u8 pattern[3][32]) {
+  for (u32 p = 0; p < 3; ++p) {
+    for (u32 k = 0; k < 32; ++k) {
+      const u32 ch = (p + k) % 3;
+      pattern[p][k] = ch == 0 ? color.r : (ch == 1 ? color.g : color.b);
+    }
+  }
+}
+
+static inline void BRUSH_BlendTail(u8* dst, const u8* cov, u32 j, u32 num_bytes, const u8 pattern[3][32]) {
+  // The tail may start mid-pixel
+  for (; j < num_bytes; ++j) {
+    const u32 c = cov[j / 3] + (cov[j / 3] >> 7);
+    dst[j] = (u8)((dst[j] * (256 - c) + pattern[0][j % 3] * c) >> 8);
+  }
+}
+
+FUN_TARGET("ssse3")
+void BRUSH_BlendRow_SSSE3(u8* dst, const u8* cov, u32 count, Pixel_RGB888 color) {
+  alignas(32) u8 pattern[3][32];
+  BRUSH_ColorPattern(color, pattern);
+
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i full = _mm_set1_epi16(256);
+  const u32 num_bytes = count * 3;
+  u32 j = 0;
+  // Each block loads 8 coverage bytes, which must lie within the row
+  for (; j + 16 <= num_bytes && j / 3 + 8 <= count; j += 16) {
+    const u32 phase = j % 3;
+    const __m128i c8 = _mm_loadl_epi64((const __m128i*)&cov[j / 3]);
+    const __m128i w8 = _mm_shuffle_epi8(c8, _mm_load_si128((const __m128i*)BRUSH_EXPAND_SHUFFLE[phase]));
+    __m128i w_lo = _mm_unpacklo_epi8(w8, zero);
+    __m128i w_hi = _mm_unpackhi_epi8(w8, zero);
+    w_lo = _mm_add_epi16(w_lo, _mm_srli_epi16(w_lo, 7));
+    w_hi = _mm_add_epi16(w_hi, _mm_srli_epi16(w_hi, 7));
+    const __m128i col = _mm_load_si128((const __m128i*)pattern[phase]);
+    const __m128i d = _mm_loadu_si128((const __m128i*)&dst[j]);
+    const __m128i d_lo = _mm_unpacklo_epi8(d, zero);
+    const __m128i d_hi = _mm_unpackhi_epi8(d, zero);
+    const __m128i c_lo = _mm_unpacklo_epi8(col, zero);
+    const __m128i c_hi = _mm_unpackhi_epi8(col, zero);
+    const __m128i r_lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(d_lo, _mm_sub_epi16(full, w_lo)), _mm_mullo_epi16(c_lo, w_lo)), 8);
+    const __m128i r_hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(d_hi, _mm_sub_epi16(full, w_hi)), _mm_mullo_epi16(c_hi, w_hi)), 8);
+    _mm_storeu_si128((__m128i*)&dst[j], _mm_packus_epi16(r_lo, r_hi));
+  }
+  BRUSH_BlendTail(dst, cov, j, num_bytes, pattern);
+}
+
+FUN_TARGET("avx2,fma")
+void BRUSH_BlendRow_AVX2(u8* dst, const u8* cov, u32 count, Pixel_RGB888 color) {
+  alignas(32) u8 pattern[3][32];
+  BRUSH_ColorPattern(color, pattern);
+
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i full = _mm256_set1_epi16(256);
+  const u32 num_bytes = count * 3;
+  u32 j = 0;
+  // Each block loads 16 coverage bytes, which must lie within the row
+  for (; j + 32 <= num_bytes && j / 3 + 16 <= count; j += 32) {
+    const u32 phase = j % 3;
+    const __m256i c8 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)&cov[j / 3]));
+    const __m256i w8 = _mm256_shuffle_epi8(c8, _mm256_load_si256((const __m256i*)BRUSH_EXPAND_SHUFFLE[phase]));
+    // Unpacking and packing within lanes keeps the byte order
+    __m256i w_lo = _mm256_unpacklo_epi8(w8, zero);
+    __m256i w_hi = _mm256_unpackhi_epi8(w8, zero);
+    w_lo = _mm256_add_epi16(w_lo, _mm256_srli_epi16(w_lo, 7));
+    w_hi = _mm256_add_epi16(w_hi, _mm256_srli_epi16(w_hi, 7));
+    const __m256i col = _mm256_load_si256((const __m256i*)pattern[phase]);
+    const __m256i d = _mm256_loadu_si256((const __m256i*)&dst[j]);
+    const __m256i d_lo = _mm256_unpacklo_epi8(d, zero);
+    const __m256i d_hi = _mm256_unpackhi_epi8(d, zero);
+    const __m256i c_lo = _mm256_unpacklo_epi8(col, zero);
+    const __m256i c_hi = _mm256_unpackhi_epi8(col, zero);
+    const __m256i r_lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(d_lo, _mm256_sub_epi16(full, w_lo)), _mm256_mullo_epi16(c_lo, w_lo)), 8);
+    const __m256i r_hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(d_hi, _mm256_sub_epi16(full, w_hi)), _mm256_mullo_epi16(c_hi, w_hi)), 8);
+    _mm256_storeu_si256((__m256i*)&dst[j], _mm256_packus_epi16(r_lo, r_hi));
+  }
+  BRUSH_BlendTail(dst, cov, j, num_bytes, pattern);
+}
+
+#endif // FUN_X64
+
+struct BrushVariant {
+  const char* name;
+  BrushCoverageRowFn coverage_row;
+  BrushBlendRowFn blend_row;
+};
+
+const BrushVariant BRUSH_VARIANTS[] = {
+  { "scalar", BRUSH_CoverageRow_Scalar, BRUSH_BlendRow_Scalar },
+#ifdef FUN_X64
+  { "ssse3",  BRUSH_CoverageRow_SSE2,   BRUSH_BlendRow_SSSE3 },
+  { "avx2",   BRUSH_CoverageRow_AVX2,   BRUSH_BlendRow_AVX2 },
+#endif
+};
 
-  SDL_snprintf(g.filename, sizeof(g.filename), "vidgen-%u.mkv", (u32)time(0));
+const BrushVariant* BRUSH_SelectVariant() {
+#ifdef FUN_X64
+  if (CPU_HasAVX2()) {
+    return &BRUSH_VARIANTS[2];
+  }
+  return CPU_HasSSSE3() ? &BRUSH_VARIANTS[1] : &BRUSH_VARIANTS[0];
+#else
+  return &BRUSH_VARIANTS[0];
+#endif
+}
+
+static inline Pixel_RGB888* CANVAS_GetTile(Canvas* canvas, u32 tile) {
+  return &canvas->tiles[(usize)tile * CANVAS_TILE_AREA];
+}
+
+// Rasterize a capsule from a to b into the canvas. Returns the number of
+// pixels visited.
+u64 BRUSH_Stroke(Canvas* canvas, Vec2 a, Vec2 b, f32 radius, u8 shape, Pixel_RGB888 color) {
+  if (radius <= 0.0f) {
+    return 0;
+  }
+
+  BrushSegment seg = { };
+  seg.ax = a.x;
+  seg.ay = a.y;
+  seg.bax = b.x - a.x;
+  seg.bay = b.y - a.y;
+  const f32 len2 = seg.bax * seg.bax + seg.bay * seg.bay;
+  seg.inv_len2 = len2 > 0.0f ? 1.0f / len2 : 0.0f;
+  seg.radius = radius;
+  seg.shape = shape;
+
+  // Extent including the anti-aliasing fringe; square brushes reach further
+  // along diagonals
+  const f32 reach = (shape == BRUSH_SHAPE_SQUARE ? radius * 1.4143f : radius) + 1.0f;
+  const i32 y_min = Max((i32)SDL_floorf(Min(a.y, b.y) - reach), 0);
+  const i32 y_max = Min((i32)SDL_ceilf(Max(a.y, b.y) + reach), (i32)canvas->h - 1);
+
+  u8* cov = canvas->cov;
+  u64 visited = 0;
+  for (i32 y = y_min; y <= y_max; ++y) {
+    // Span covered by the part of the segment within reach of this row
+    const f32 py = (f32)y + 0.5f;
+    f32 t0 = 0.0f;
+    f32 t1 = 1.0f;
+    if (seg.bay != 0.0f) {
+      t0 = (py - reach - seg.ay) / seg.bay;
+      t1 = (py + reach - seg.ay) / seg.bay;
+      if (t0 > t1) {
+        Swap(t0, t1);
+      }
+      t0 = Max(t0, 0.0f);
+      t1 = Min(t1, 1.0f);
+      if (t0 > t1) {
+        continue;
+      }
+    }
+    const f32 xa = seg.ax + seg.bax * t0;
+    const f32 xb = seg.ax + seg.bax * t1;
+    const i32 x_min = Max((i32)SDL_floorf(Min(xa, xb) - reach), 0);
+    const i32 x_max = Min((i32)SDL_ceilf(Max(xa, xb) + reach), (i32)canvas->w - 1);
+    if (x_min > x_max) {
+      continue;
+    }
+
+    const u32 count = (u32)(x_max - x_min + 1);
+    g.brush->coverage_row(&seg, (u32)x_min, count, py, cov);
+
+    // Blend the span tile by tile
+    const u32 ty = (u32)y / CANVAS_TILE;
+    const u32 ly = (u32)y % CANVAS_TILE;
+    for (u32 x = (u32)x_min; x <= (u32)x_max; ) {
+      const u32 tx = x / CANVAS_TILE;
+      const u32 lx = x % CANVAS_TILE;
+      const u32 n = Min(CANVAS_TILE - lx, (u32)x_max - x + 1);
+      const u32 tile = ty * canvas->tiles_x + tx;
+      g.brush->blend_row((u8*)&CANVAS_GetTile(canvas, tile)[ly * CANVAS_TILE + lx], cov + (x - (u32)x_min), n, color);
+      canvas->dirty_display[tile] = 1;
+      canvas->dirty_encode[tile] = 1;
+      x += n;
+    }
+    visited += count;
+  }
+  return visited;
+}
+
+//
+// Canvas
+//
+
+void CANVAS_Init(u32 w, u32 h) {
+  g.cur_radius = 10.0f;
+  g.brush = BRUSH_SelectVariant();
+
+  Canvas* canvas = &g.canvas;
+  canvas->w = w;
+  canvas->h = h;
+  canvas->tiles_x = (w + CANVAS_TILE - 1) / CANVAS_TILE;
+  canvas->tiles_y = (h + CANVAS_TILE - 1) / CANVAS_TILE;
+  const u32 num_tiles = canvas->tiles_x * canvas->tiles_y;
+  canvas->tiles = MemAlloc<Pixel_RGB888>((usize)num_tiles * CANVAS_TILE_AREA);
+  for (usize i = 0; i < (usize)num_tiles * CANVAS_TILE_AREA; ++i) {
+    canvas->tiles[i] = PIXEL_BLACK;
+  }
+  canvas->dirty_display = MemAlloc<u8>(num_tiles);
+  canvas->dirty_encode = MemAlloc<u8>(num_tiles);
+  SDL_memset(canvas->dirty_display, 1, num_tiles);
+  SDL_memset(canvas->dirty_encode, 1, num_tiles);
+  canvas->job_tiles = MemAlloc<u32>(num_tiles);
+  canvas->cov = MemAlloc<u8>(w + 16);
+}
+
+// Tile rect clipped to the canvas
+static inline SDL_Rect CANVAS_TileRect(const Canvas* canvas, u32 tile) {
+  const u32 tx = tile % canvas->tiles_x;
+  const u32 ty = tile / canvas->tiles_x;
+  SDL_Rect rect = { };
+  rect.x = (int)(tx * CANVAS_TILE);
+  rect.y = (int)(ty * CANVAS_TILE);
+  rect.w = (int)Min(CANVAS_TILE, canvas->w - tx * CANVAS_TILE);
+  rect.h = (int)Min(CANVAS_TILE, canvas->h - ty * CANVAS_TILE);
+  return rect;
+}
+
+// Collect tiles flagged in dirty into job_tiles and clear the flags
+static inline u32 CANVAS_TakeDirty(Canvas* canvas, u8* dirty) {
+  const u32 num_tiles = canvas->tiles_x * canvas->tiles_y;
+  canvas->num_job_tiles = 0;
+  for (u32 i = 0; i < num_tiles; ++i) {
+    if (dirty[i]) {
+      canvas->job_tiles[canvas->num_job_tiles++] = i;
+      dirty[i] = 0;
+    }
+  }
+  return canvas->num_job_tiles;
+}
+
+// Upload changed tiles to the display texture
+void CANVAS_Upload(SDL_Texture* texture) {
+  Canvas* canvas = &g.canvas;
+  const u32 count = CANVAS_TakeDirty(canvas, canvas->dirty_display);
+  for (u32 i = 0; i < count; ++i) {
+    const u32 tile = canvas->job_tiles[i];
+    const SDL_Rect rect = CANVAS_TileRect(canvas, tile);
+    SDL_UpdateTexture(texture, &rect, CANVAS_GetTile(canvas, tile), CANVAS_TILE * sizeof(Pixel_RGB888));
+  }
+}
+
+void CANVAS_Update() {
+  if (g.cur_down) {
+    // Connect to the previous sample while the button stays down
+    const Vec2 from = g.last_down ? g.last_pos : g.cur_pos;
+    BRUSH_Stroke(&g.canvas, from, g.cur_pos, g.cur_radius, g.cur_shape, PIXEL_WHITE);
+  }
+  g.last_pos = g.cur_pos;
+  g.last_down = g.cur_down;
+}
+
+// Render random strokes with every available variant
+SDL_AppResult BRUSH_Benchmark() {
+  CANVAS_Init(g.canvas.w, g.canvas.h);
+  const BrushVariant* selected = BRUSH_SelectVariant();
+
+  for (const BrushVariant& variant : BRUSH_VARIANTS) {
+    if ((SDL_strcmp(variant.name, "avx2") == 0 && !CPU_HasAVX2()) ||
+        (SDL_strcmp(variant.name, "ssse3") == 0 && !CPU_HasSSSE3())) {
+      continue;
+    }
+    g.brush = &variant;
+    for (u8 shape = 0; shape < BRUSH_SHAPE_COUNT; ++shape) {
+      Xorshift rng;
+      u64 visited = 0;
+      const u64 t0 = SDL_GetPerformanceCounter();
+      for (u32 i = 0; i < 20000; ++i) {
+        Vec2 a = Vec2(rng.RandomFloat((f32)g.canvas.w), rng.RandomFloat((f32)g.canvas.h));
+        const Vec2 b = a + Vec2(rng.RandomFloat(-64.0f, 64.0f), rng.RandomFloat(-64.0f, 64.0f));
+        visited += BRUSH_Stroke(&g.canvas, a, b, rng.RandomFloat(2.0f, 40.0f), shape, PIXEL_WHITE);
+      }
+      const f64 secs = (f64)(SDL_GetPerformanceCounter() - t0) / (f64)SDL_GetPerformanceFrequency();
+      SDL_Log("brush %-6s %-6s %8.1f Mpx/s", variant.name, BRUSH_SHAPE_NAMES[shape], (f64)visited / secs / 1e6);
+    }
+  }
+
+  SDL_Log("Selected brush variant: %s", selected->name);
+  return SDL_APP_SUCCESS;
+}
+
+//
+// Muxer
+//
+// Encoded packets are handed to a writer thread that owns the output files.
+// In segmented mode it starts a new file at the first keyframe after the
+// segment duration or size limit, so finalizing one segment and opening the
+// next never stalls the paint loop. With a keep limit, only the newest
+// segments are kept on disk as a rolling buffer.
+//
+
+int SDLCALL MUX_WriterThread(void* userdata);
+
+void MUX_Begin(const AVCodecContext* avcc, AV_PacketPool* pool) {
+  Muxer* mux = &g.mux;
+  mux->pool = pool;
+  mux->codecpar = avcodec_parameters_alloc();
+  assert(mux->codecpar);
+  int avret = avcodec_parameters_from_context(mux->codecpar, avcc);
+  assert(avret >= 0);
+  mux->enc_time_base = avcc->time_base;
+  mux->head = 0;
+  mux->count = 0;
+  mux->quit = false;
+  mux->save_requested = false;
+  mux->seg_index = 0;
+  mux->num_kept = 0;
+  mux->avfc = 0;
+  SDL_SetAtomicInt(&mux->drift_last_us, 0);
+  mux->drift_sum = 0.0;
+  mux->drift_max = 0.0;
+  mux->drift_frames = 0;
+
+  mux->mtx = SDL_CreateMutex();
+  mux->cond = SDL_CreateCondition();
+  mux->thread = SDL_CreateThread(MUX_WriterThread, "vidgen_mux", mux);
+  assert(mux->mtx && mux->cond && mux->thread);
+}
+
+// Queue a packet for writing, taking ownership of it until the writer thread
+// returns it to the packet pool. Blocks while the writer thread is
+// MUX_QUEUE_SIZE packets behind.
+void MUX_Push(AVPacket* pkt) {
+  Muxer* mux = &g.mux;
+  SDL_LockMutex(mux->mtx);
+  while (mux->count == MUX_QUEUE_SIZE) {
+    SDL_WaitCondition(mux->cond, mux->mtx);
+  }
+  mux->queue[(mux->head + mux->count) % MUX_QUEUE_SIZE] = pkt;
+  ++mux->count;
+  SDL_BroadcastCondition(mux->cond);
+  SDL_UnlockMutex(mux->mtx);
+}
+
+void MUX_RequestSave() {
+  Muxer* mux = &g.mux;
+  SDL_LockMutex(mux->mtx);
+  mux->save_requested = true;
+  SDL_UnlockMutex(mux->mtx);
+}
+
+void MUX_End() {
+  Muxer* mux = &g.mux;
+  SDL_LockMutex(mux->mtx);
+  mux->quit = true;
+  SDL_BroadcastCondition(mux->cond);
+  SDL_UnlockMutex(mux->mtx);
+  SDL_WaitThread(mux->thread, 0);
+
+  SDL_DestroyCondition(mux->cond);
+  SDL_DestroyMutex(mux->mtx);
+  avcodec_parameters_free(&mux->codecpar);
+}
+
+// Length of a path without its extension, e.g. 4 for "clip.webm". Dots in
+// directory names don't count.
+static int MUX_StemLength(const char* path) {
+  const char* name = path;
+  for (const char* c = path; *c; ++c) {
+    if (*c == '/' || *c == '\\') {
+      name = c + 1;
+    }
+  }
+  const char* dot = SDL_strrchr(name, '.');
+  return (int)(dot ? dot - path : SDL_strlen(path));
+}
+
+// Segments keep the container of the requested path, e.g.
+// clip.webm -> clip-0000.webm, clip-0001.webm, ...
+static void MUX_OpenSegment(Muxer* mux, i64 start_pts) {
+  if (mux->seg_time > 0.0 || mux->seg_bytes > 0 || mux->seg_keep > 0) {
+    const int stem = MUX_StemLength(g.filename);
+    SDL_snprintf(mux->seg_path, sizeof(mux->seg_path), "%.*s-%04u%s",
+      stem, g.filename, mux->seg_index, g.filename + stem);
+  } else {
+    SDL_strlcpy(mux->seg_path, g.filename, sizeof(mux->seg_path));
+  }
+  ++mux->seg_index;
+  mux->seg_start_pts = start_pts;
 
   // Alloc container
-  int avret = avformat_alloc_output_context2(&g.avfc, 0, 0, g.filename);
-  assert(avret >= 0 && g.avfc);
+  int avret = avformat_alloc_output_context2(&mux->avfc, 0, 0, mux->seg_path);
+  assert(avret >= 0 && mux->avfc);
+
+  // Create video stream
+  mux->avst = avformat_new_stream(mux->avfc, 0);
+  assert(mux->avst);
+  mux->avst->time_base = mux->enc_time_base;
+  mux->avst->id = mux->avfc->nb_streams - 1;
+
+  // Copy stream parameters
+  avret = avcodec_parameters_copy(mux->avst->codecpar, mux->codecpar);
+  assert(avret >= 0);
+
+  // Dump debug
+  av_dump_format(mux->avfc, 0, mux->seg_path, 1);
+
+  // Open file
+  avret = avio_open(&mux->avfc->pb, mux->seg_path, AVIO_FLAG_WRITE);
+  assert(avret >= 0);
+  avret = avformat_write_header(mux->avfc, 0);
+  assert(avret >= 0);
+}
+
+static void MUX_CloseSegment(Muxer* mux) {
+  // Write trailer
+  int avret = av_write_trailer(mux->avfc);
+  assert(avret >= 0);
+
+  avio_closep(&mux->avfc->pb);
+  avformat_free_context(mux->avfc);
+  mux->avfc = 0;
+
+  if (mux->seg_keep == 0) {
+    return;
+  }
+
+  // Rolling buffer: forget the oldest segment once over the limit
+  if (mux->num_kept == mux->seg_keep) {
+    if (!SDL_RemovePath(mux->kept[0])) {
+      SDL_Log("Failed to remove old segment %s: %s", mux->kept[0], SDL_GetError());
+    }
+    SDL_memmove(mux->kept[0], mux->kept[1], sizeof(mux->kept[0]) * (mux->num_kept - 1));
+    --mux->num_kept;
+  }
+  SDL_strlcpy(mux->kept[mux->num_kept++], mux->seg_path, sizeof(mux->kept[0]));
+}
+
+// Move the rolling buffer out of the way of deletion, e.g.
+// vidgen-<time>-0042.mkv -> vidgen-<time>-0042-saved.mkv
+static void MUX_SaveKept(Muxer* mux) {
+  for (u32 i = 0; i < mux->num_kept; ++i) {
+    char saved_path[sizeof(mux->kept[0])] = { };
+    const int stem = MUX_StemLength(mux->kept[i]);
+    SDL_snprintf(saved_path, sizeof(saved_path), "%.*s-saved%s", stem, mux->kept[i], mux->kept[i] + stem);
+    if (std::rename(mux->kept[i], saved_path) != 0) {
+      SDL_Log("Failed to save segment %s", mux->kept[i]);
+    }
+  }
+  SDL_Log("Saved the last %u segments", mux->num_kept);
+  mux->num_kept = 0;
+}
+
+static void MUX_WritePacket(Muxer* mux, AVPacket* pkt, bool save) {
+  const bool key = pkt->flags & AV_PKT_FLAG_KEY;
+
+  // Split on keyframes only, so every segment decodes on its own
+  if (mux->avfc && key) {
+    const f64 seg_secs = (f64)(pkt->pts - mux->seg_start_pts) * av_q2d(mux->enc_time_base);
+    const u64 seg_size = (u64)avio_tell(mux->avfc->pb);
+    if (save || (mux->seg_time > 0.0 && seg_secs >= mux->seg_time) || (mux->seg_bytes > 0 && seg_size >= mux->seg_bytes)) {
+      MUX_CloseSegment(mux);
+      if (save) {
+        MUX_SaveKept(mux);
+      }
+    }
+  }
+  if (!mux->avfc) {
+    MUX_OpenSegment(mux, pkt->pts);
+  }
+
+  // The encoder carries each frame's capture time over to its packet, so
+  // this compares what is actually written against the wall clock
+  if (pkt->opaque) {
+    const f64 media_t = (f64)pkt->pts * av_q2d(mux->enc_time_base);
+    const f64 capture_t = (f64)((uintptr_t)pkt->opaque - 1) / (f64)SDL_NS_PER_SECOND;
+    const f64 drift = media_t - capture_t;
+    SDL_SetAtomicInt(&mux->drift_last_us, (int)(drift * 1e6));
+    mux->drift_sum += std::fabs(drift);
+    mux->drift_max = Max(mux->drift_max, std::fabs(drift));
+    ++mux->drift_frames;
+  }
+
+  // Every segment starts at zero
+  pkt->pts -= mux->seg_start_pts;
+  pkt->dts -= mux->seg_start_pts;
+  av_packet_rescale_ts(pkt, mux->enc_time_base, mux->avst->time_base);
+  pkt->stream_index = mux->avst->index;
+
+  // There is a single stream with increasing timestamps, so nothing needs
+  // interleaving and the packet stays ours to recycle
+  int avret = av_write_frame(mux->avfc, pkt);
+  assert(avret >= 0);
+}
+
+int SDLCALL MUX_WriterThread(void* userdata) {
+  Muxer* mux = (Muxer*)userdata;
+  bool pending_save = false;
+  SDL_LockMutex(mux->mtx);
+  while (true) {
+    while (mux->count == 0 && !mux->quit) {
+      SDL_WaitCondition(mux->cond, mux->mtx);
+    }
+    if (mux->count == 0) {
+      break;
+    }
+    AVPacket* pkt = mux->queue[mux->head];
+    mux->head = (mux->head + 1) % MUX_QUEUE_SIZE;
+    --mux->count;
+    pending_save |= mux->save_requested;
+    mux->save_requested = false;
+    SDL_BroadcastCondition(mux->cond);
+    SDL_UnlockMutex(mux->mtx);
+
+    // A save request closes the current segment at the next keyframe
+    const bool save = pending_save && (pkt->flags & AV_PKT_FLAG_KEY) && mux->seg_keep > 0;
+    MUX_WritePacket(mux, pkt, save);
+    pending_save &= !save;
+    AV_PacketPoolPut(mux->pool, pkt);
+
+    SDL_LockMutex(mux->mtx);
+  }
+  SDL_UnlockMutex(mux->mtx);
+
+  if (mux->avfc) {
+    MUX_CloseSegment(mux);
+  }
+  if (pending_save) {
+    MUX_SaveKept(mux);
+  }
+  return 0;
+}
+
+//
+// Recording
+//
+
+void REC_Begin(const char* filename = 0) {
+  g.recording = true;
+
+  if (filename) {
+    SDL_strlcpy(g.filename, filename, sizeof(g.filename));
+  } else {
+    SDL_snprintf(g.filename, sizeof(g.filename), "vidgen-%u.mkv", (u32)time(0));
+  }
+
+  if (g.out_w == 0 || g.out_h == 0) {
+    g.out_w = g.canvas.w;
+    g.out_h = g.canvas.h;
+  }
 
   // Container format
-  const AVOutputFormat* avof = g.avfc->oformat;
+  const AVOutputFormat* avof = av_guess_format(0, g.filename, 0);
+  assert(avof);
 
   // Use h264 for video encoding
   const AVCodec* avc = avcodec_find_encoder(AV_CODEC_ID_H264);
@@ -66,145 +893,839 @@ void REC_Begin() {
   g.avcc = avcodec_alloc_context3(avc);
   assert(g.avcc);
   g.avcc->codec_id = avc->id;
-  g.avcc->bit_rate = 400000;
-  g.avcc->width = CANVAS_W;
-  g.avcc->height = CANVAS_H;
-  g.avcc->time_base = { 1, FPS };
+  g.avcc->bit_rate = g.bit_rate;
+  g.avcc->width = g.out_w;
+  g.avcc->height = g.out_h;
+  // Timestamps come from the wall clock: microseconds for variable frame
+  // rate, or frame numbers when pacing to a constant frame rate
+  g.avcc->time_base = g.cfr ? AVRational { 1, (int)g.cfr } : AVRational { 1, 1000000 };
+  g.avcc->framerate = { (int)(g.cfr ? g.cfr : FPS), 1 };
   g.avcc->gop_size = 12;
   g.avcc->pix_fmt = AV_PIX_FMT_YUV420P;
+  // Let the encoder use every core (libavcodec defaults to one thread)
+  g.avcc->thread_count = 0;
   if (avof->flags & AVFMT_GLOBALHEADER) {
     g.avcc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
   }
+  // Frame capture times travel to the muxer in opaque
+  g.avcc->flags |= AV_CODEC_FLAG_COPY_OPAQUE;
+
+  // Packets and their payloads come from the pool and return to it once
+  // written
+  AV_PacketPoolInit(&g.pkt_pool, MUX_QUEUE_SIZE + REC_POOL_PACKETS, REC_POOL_PACKETS);
+  AV_PacketPoolAttach(&g.pkt_pool, g.avcc);
 
   // Open encoder
-  avret = avcodec_open2(g.avcc, avc, 0);
+  int avret = avcodec_open2(g.avcc, avc, 0);
   assert(avret >= 0);
 
-  // Create video stream
-  g.avst = avformat_new_stream(g.avfc, avc);
-  assert(g.avst);
-  g.avst->time_base = g.avcc->time_base;
-  g.avst->id = g.avfc->nb_streams - 1;
-
-  // Copy stream parameters
-  avret = avcodec_parameters_from_context(g.avst->codecpar, g.avcc);
-  assert(avret >= 0);
+  // Start writer thread, which opens the file
+  MUX_Begin(g.avcc, &g.pkt_pool);
 
   // Input frame
   g.avframe_inp = av_frame_alloc();
   assert(g.avframe_inp);
   g.avframe_inp->format = AV_PIX_FMT_RGB24;
-  g.avframe_inp->width = CANVAS_W;
-  g.avframe_inp->height = CANVAS_H;
+  g.avframe_inp->width = g.canvas.w;
+  g.avframe_inp->height = g.canvas.h;
   avret = av_frame_get_buffer(g.avframe_inp, 0);
   assert(avret >= 0);
 
-  // Output frame
-  g.avframe_out = av_frame_alloc();
-  assert(g.avframe_out);
-  g.avframe_out->format = g.avcc->pix_fmt;
-  g.avframe_out->width = CANVAS_W;
-  g.avframe_out->height = CANVAS_H;
-  avret = av_frame_get_buffer(g.avframe_out, 0);
-  assert(avret >= 0);
+  // Output frames, more than one while the encoder holds on to frames
+  AV_FramePoolInit(&g.frame_pool, g.avcc->pix_fmt, g.out_w, g.out_h, REC_POOL_FRAMES);
+  g.avframe_out = AV_FramePoolGetWritable(&g.frame_pool);
 
-  // Transient packet
-  g.avpkt = av_packet_alloc();
-  assert(g.avpkt);
+  // Set up scaling, only used when the output size differs from the canvas
+  AV_ConverterInit(&g.conv, g.avframe_inp->width, g.avframe_inp->height, (AVPixelFormat)g.avframe_inp->format,
+                   g.avframe_out->width, g.avframe_out->height, (AVPixelFormat)g.avframe_out->format,
+                   AV_CONVERT_SWS, &g.jobs);
 
-  // Set up scaling
-  g.sws = sws_getContext(g.avframe_inp->width, g.avframe_inp->height, (AVPixelFormat)g.avframe_inp->format,
-                         g.avframe_out->width, g.avframe_out->height, (AVPixelFormat)g.avframe_out->format,
-                         SWS_BICUBIC, 0, 0, 0);
-  assert(g.sws);
+  // The new output frame needs every tile
+  SDL_memset(g.canvas.dirty_encode, 1, g.canvas.tiles_x * g.canvas.tiles_y);
 
-  // Dump debug
-  av_dump_format(g.avfc, 0, g.filename, 1);
+  g.frame_num = 0;
+  g.allocs_warm = 0;
+  g.last_pts = -1;
+  g.frames_dropped = 0;
+  g.frames_duplicated = 0;
+  g.rec_t0_ns = SDL_GetTicksNS();
+}
 
-  // Open file
-  avret = avio_open(&g.avfc->pb, g.filename, AVIO_FLAG_WRITE);
-  assert(avret >= 0);
-  avret = avformat_write_header(g.avfc, 0);
-  assert(avret >= 0);
+bool REC_EncodeFrame(const AVFrame* frame);
+
+// Allocations made by the packet and frame pools since recording started
+u32 REC_PoolAllocations() {
+  return (u32)SDL_GetAtomicInt(&g.pkt_pool.packets_allocated) + (u32)SDL_GetAtomicInt(&g.pkt_pool.buffers_allocated) +
+         g.frame_pool.frames_allocated;
 }
 
 void REC_End() {
   g.recording = false;
 
-  // Write trailer
-  int avret = av_write_trailer(g.avfc);
-  assert(avret >= 0);
+  // Drain frames still buffered in the encoder
+  while (!REC_EncodeFrame(0)) { }
+
+  // Flush queued packets and finalize the last segment
+  MUX_End();
 
-  avio_closep(&g.avfc->pb);
+  SDL_Log("Recorded %u frames to %s: %u dropped, %u duplicated, A/V drift avg %.2f ms max %.2f ms",
+    g.frame_num, g.filename, g.frames_dropped, g.frames_duplicated,
+    g.mux.drift_frames ? g.mux.drift_sum / g.mux.drift_frames * 1e3 : 0.0, g.mux.drift_max * 1e3);
 
-  av_packet_free(&g.avpkt);
-  av_frame_free(&g.avframe_out);
+  const u32 packets = (u32)SDL_GetAtomicInt(&g.pkt_pool.packets_allocated);
+  const u32 buffers = (u32)SDL_GetAtomicInt(&g.pkt_pool.buffers_allocated);
+  SDL_Log("Pool allocations: %u packets, %u packet buffers, %u frames; %u after the first %u frames",
+    packets, buffers, g.frame_pool.frames_allocated, g.frame_num > REC_WARMUP_FRAMES ? REC_PoolAllocations() - g.allocs_warm : 0,
+    REC_WARMUP_FRAMES);
+
+  AV_PacketPoolFree(&g.pkt_pool);
+  AV_FramePoolFree(&g.frame_pool);
+  g.avframe_out = 0;
   av_frame_free(&g.avframe_inp);
+  AV_ConverterFree(&g.conv);
   avcodec_free_context(&g.avcc);
-  avformat_free_context(g.avfc);
 }
 
-bool REC_EncodeFrame() {
-  ++g.frame_num;
+// Convert one changed tile straight into the YUV output frame
+void REC_ConvertTileJob(void* userdata, u32 job) {
+  Canvas* canvas = &g.canvas;
+  const u32 tile = canvas->job_tiles[job];
+  const SDL_Rect rect = CANVAS_TileRect(canvas, tile);
+  AVFrame* out = g.avframe_out;
+  AV_ConvertRGB24ToYUV420P((const u8*)CANVAS_GetTile(canvas, tile), CANVAS_TILE * sizeof(Pixel_RGB888), rect.w, rect.h,
+    out->data[0] + rect.y * out->linesize[0] + rect.x, out->linesize[0],
+    out->data[1] + (rect.y / 2) * out->linesize[1] + rect.x / 2, out->linesize[1],
+    out->data[2] + (rect.y / 2) * out->linesize[2] + rect.x / 2, out->linesize[2]);
+}
+
+// Copy one changed tile into the linear RGB frame for scaling
+void REC_CopyTileJob(void* userdata, u32 job) {
+  Canvas* canvas = &g.canvas;
+  const u32 tile = canvas->job_tiles[job];
+  const SDL_Rect rect = CANVAS_TileRect(canvas, tile);
+  const Pixel_RGB888* src = CANVAS_GetTile(canvas, tile);
+  AVFrame* inp = g.avframe_inp;
+  for (int y = 0; y < rect.h; ++y) {
+    SDL_memcpy(inp->data[0] + (rect.y + y) * inp->linesize[0] + rect.x * sizeof(Pixel_RGB888),
+      &src[y * CANVAS_TILE], rect.w * sizeof(Pixel_RGB888));
+  }
+}
+
+void REC_ConvertFrame() {
+  // Only tiles changed since the last converted frame need work; the rest of
+  // the output frame is still valid
+  const u32 count = CANVAS_TakeDirty(&g.canvas, g.canvas.dirty_encode);
+
+  // The encoder may still reference the last frame. Continue in a free pool
+  // frame instead, which needs the unchanged tiles when converting in place.
+  if (!av_frame_is_writable(g.avframe_out)) {
+    AVFrame* next = AV_FramePoolGetWritable(&g.frame_pool);
+    if (g.out_w == g.canvas.w && g.out_h == g.canvas.h) {
+      int avret = av_frame_copy(next, g.avframe_out);
+      assert(avret >= 0);
+    }
+    g.avframe_out = next;
+  }
 
   // Convert to YUV frame
-  int avret = av_frame_make_writable(g.avframe_out);
+  if (g.out_w == g.canvas.w && g.out_h == g.canvas.h) {
+    g.jobs.Run(count, REC_ConvertTileJob, 0);
+  } else {
+    g.jobs.Run(count, REC_CopyTileJob, 0);
+    AV_ConverterRun(&g.conv, g.avframe_inp->data, g.avframe_inp->linesize, g.avframe_out->data, g.avframe_out->linesize);
+  }
+}
+
+static AVFrame* REC_AllocBenchFrame(AVPixelFormat fmt, u32 w, u32 h) {
+  AVFrame* frame = av_frame_alloc();
+  assert(frame);
+  frame->format = fmt;
+  frame->width = w;
+  frame->height = h;
+  int avret = av_frame_get_buffer(frame, 0);
   assert(avret >= 0);
-  sws_scale(g.sws, (const u8* const*)&g.canvas, g.avframe_inp->linesize, 0,
-    g.avframe_out->height, g.avframe_out->data, g.avframe_out->linesize);
-  g.avframe_out->pts = g.next_pts++;
+  return frame;
+}
+
+// Time every colour conversion path in both directions at 1080p and 4K
+SDL_AppResult REC_BenchmarkConvert() {
+  constexpr u32 ITERATIONS = 30;
+  const u32 sizes[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+  for (const auto& size : sizes) {
+    const u32 w = size[0];
+    const u32 h = size[1];
+    AVFrame* rgb = REC_AllocBenchFrame(AV_PIX_FMT_RGB24, w, h);
+    AVFrame* yuv = REC_AllocBenchFrame(AV_PIX_FMT_YUV420P, w, h);
+    Xorshift rng;
+    for (u32 y = 0; y < h; ++y) {
+      for (u32 x = 0; x < w * 3; ++x) {
+        rgb->data[0][y * rgb->linesize[0] + x] = (u8)rng.RandomFloat(255.0f);
+      }
+    }
+
+    for (u32 dir = 0; dir < 2; ++dir) {
+      AVFrame* src = dir == 0 ? rgb : yuv;
+      AVFrame* dst = dir == 0 ? yuv : rgb;
+      const char* dir_name = dir == 0 ? "rgb24->yuv420p" : "yuv420p->rgb24";
+
+      // Single threaded hand-written converters
+      for (u32 simd = 0; simd < 2; ++simd) {
+        const u64 t0 = SDL_GetPerformanceCounter();
+        for (u32 i = 0; i < ITERATIONS; ++i) {
+          if (dir == 0) {
+            (simd ? AV_ConvertRGB24ToYUV420P : AV_ConvertRGB24ToYUV420P_Scalar)(src->data[0], src->linesize[0], w, h,
+              dst->data[0], dst->linesize[0], dst->data[1], dst->linesize[1], dst->data[2], dst->linesize[2]);
+          } else {
+            (simd ? AV_ConvertYUV420PToRGB24 : AV_ConvertYUV420PToRGB24_Scalar)(src->data[0], src->linesize[0],
+              src->data[1], src->linesize[1], src->data[2], src->linesize[2], w, h, dst->data[0], dst->linesize[0]);
+          }
+        }
+        const f64 secs = (f64)(SDL_GetPerformanceCounter() - t0) / (f64)SDL_GetPerformanceFrequency();
+        SDL_Log("convert %ux%u %s %-8s 1 thread  %7.2f ms/frame", w, h, dir_name, simd ? "simd" : "scalar", secs / ITERATIONS * 1e3);
+      }
+
+      // Frame converter in every mode
+      for (u8 mode = 0; mode < AV_CONVERT_COUNT; ++mode) {
+        AV_Converter conv;
+        AV_ConverterInit(&conv, w, h, (AVPixelFormat)src->format, w, h, (AVPixelFormat)dst->format, mode, &g.jobs);
+        const u64 t0 = SDL_GetPerformanceCounter();
+        for (u32 i = 0; i < ITERATIONS; ++i) {
+          AV_ConverterRun(&conv, src->data, src->linesize, dst->data, dst->linesize);
+        }
+        const f64 secs = (f64)(SDL_GetPerformanceCounter() - t0) / (f64)SDL_GetPerformanceFrequency();
+        SDL_Log("convert %ux%u %s %-8s %u slices %7.2f ms/frame", w, h, dir_name, AV_CONVERT_NAMES[mode], conv.num_slices, secs / ITERATIONS * 1e3);
+        AV_ConverterFree(&conv);
+      }
+    }
+
+    av_frame_free(&yuv);
+    av_frame_free(&rgb);
+  }
+
+  SDL_Log("SSSE3 converters: %s, %u threads", CPU_HasSSSE3() ? "yes" : "no", g.jobs.Concurrency());
+  return SDL_APP_SUCCESS;
+}
+
+// Pick the timestamp for a frame captured t_ns after recording started.
+// Returns how many times the frame has to be encoded: 0 drops it, more
+// than 1 duplicates it to fill a gap in constant frame rate mode.
+u32 REC_PaceFrame(u64 t_ns, i64* out_pts) {
+  i64 pts = 0;
+  u32 count = 1;
+  if (g.cfr) {
+    pts = (i64)(t_ns * g.cfr / SDL_NS_PER_SECOND);
+    if (pts <= g.last_pts) {
+      ++g.frames_dropped;
+      return 0;
+    }
+    count = (u32)(pts - g.last_pts);
+    pts = g.last_pts + 1;
+    g.frames_duplicated += count - 1;
+  } else {
+    pts = Max((i64)(t_ns / 1000), g.last_pts + 1);
+  }
+  g.last_pts = pts + count - 1;
+
+  *out_pts = pts;
+  return count;
+}
+
+// Capture time to send with a frame, plus one so that 0 can mark the extra
+// copies that only fill a gap and were not captured at that time
+static inline void* REC_CaptureStamp(u64 t_ns, bool captured) {
+  return captured ? (void*)(uintptr_t)(t_ns + 1) : 0;
+}
+
+bool REC_EncodeFrame(const AVFrame* frame) {
+  if (frame) {
+    ++g.frame_num;
+    if (g.frame_num == REC_WARMUP_FRAMES) {
+      g.allocs_warm = REC_PoolAllocations();
+    }
+  }
 
   // Encode into packets
-  avret = avcodec_send_frame(g.avcc, g.avframe_out);
-  assert(avret >= 0);
+  int avret = avcodec_send_frame(g.avcc, frame);
+  assert(avret >= 0 || avret == AVERROR_EOF);
 
   while (avret >= 0) {
-    avret = avcodec_receive_packet(g.avcc, g.avpkt);
+    AVPacket* pkt = AV_PacketPoolGet(&g.pkt_pool);
+    avret = avcodec_receive_packet(g.avcc, pkt);
     if (avret == AVERROR(EAGAIN) || avret == AVERROR_EOF) {
+      AV_PacketPoolPut(&g.pkt_pool, pkt);
       break;
     } else {
       assert(avret >= 0);
     }
+    MUX_Push(pkt);
+  }
 
-    av_packet_rescale_ts(g.avpkt, g.avcc->time_base, g.avst->time_base);
-    g.avpkt->stream_index = g.avst->index;
+  return avret == AVERROR_EOF ? true : false;
+}
 
-    avret = av_interleaved_write_frame(g.avfc, g.avpkt);
-    assert(avret >= 0);
-    SDL_Log("Encoded frame");
+void REC_Frame(u64 t_ns) {
+  i64 pts = 0;
+  const u32 count = REC_PaceFrame(t_ns, &pts);
+  if (count > 0) {
+    REC_ConvertFrame();
+    for (u32 i = 0; i < count; ++i) {
+      g.avframe_out->pts = pts + i;
+      g.avframe_out->opaque = REC_CaptureStamp(t_ns, i + 1 == count);
+      REC_EncodeFrame(g.avframe_out);
+    }
   }
+}
 
-  return avret == AVERROR_EOF ? true : false;
+//
+// Input journal
+//
+
+int SDLCALL JNL_WriterThread(void* userdata) {
+  Journal* jnl = (Journal*)userdata;
+  SDL_LockMutex(jnl->mtx);
+  while (true) {
+    while (!jnl->pending && !jnl->quit) {
+      SDL_WaitCondition(jnl->cond, jnl->mtx);
+    }
+    if (!jnl->pending) {
+      break;
+    }
+    u8* data = jnl->pending;
+    usize len = jnl->pending_len;
+    SDL_UnlockMutex(jnl->mtx);
+
+    if (std::fwrite(data, 1, len, jnl->file) != len) {
+      SDL_Log("Failed to write input journal");
+    }
+
+    SDL_LockMutex(jnl->mtx);
+    jnl->pending = 0;
+    jnl->pending_len = 0;
+    SDL_BroadcastCondition(jnl->cond);
+  }
+  SDL_UnlockMutex(jnl->mtx);
+  return 0;
 }
 
-void REC_Frame() {
-  // bool enc = true;
-  // while (enc) {
-  //   enc = !REC_EncodeFrame();
-  // }
-  REC_EncodeFrame();
+// Hand the active buffer to the writer thread, waiting if it is still busy
+// with the previous one
+void JNL_Flush() {
+  Journal* jnl = &g.jnl;
+  if (jnl->active_len == 0) {
+    return;
+  }
+  SDL_LockMutex(jnl->mtx);
+  while (jnl->pending) {
+    SDL_WaitCondition(jnl->cond, jnl->mtx);
+  }
+  jnl->pending = jnl->active;
+  jnl->pending_len = jnl->active_len;
+  jnl->active = (jnl->active == jnl->bufs[0]) ? jnl->bufs[1] : jnl->bufs[0];
+  jnl->active_len = 0;
+  SDL_BroadcastCondition(jnl->cond);
+  SDL_UnlockMutex(jnl->mtx);
 }
 
+static inline void JNL_PutVarint(u64 val) {
+  Journal* jnl = &g.jnl;
+  while (val >= 0x80) {
+    jnl->active[jnl->active_len++] = (u8)(val | 0x80);
+    val >>= 7;
+  }
+  jnl->active[jnl->active_len++] = (u8)val;
+}
+
+static inline void JNL_PutSVarint(i64 val) {
+  JNL_PutVarint(((u64)val << 1) ^ (u64)(val >> 63));
+}
+
+// Start a record: tag followed by the time since the previous record in us
+static void JNL_PutRecord(u8 tag, u64 t_ns) {
+  Journal* jnl = &g.jnl;
+  if (jnl->active_len + JNL_MAX_RECORD_SIZE > JNL_BUFFER_SIZE) {
+    JNL_Flush();
+  }
+  const u64 t_us = Max(t_ns / 1000, jnl->last_t_us);
+  jnl->active[jnl->active_len++] = tag;
+  JNL_PutVarint(t_us - jnl->last_t_us);
+  jnl->last_t_us = t_us;
+  ++jnl->num_records;
+}
+
+bool JNL_Begin(const char* path) {
+  Journal* jnl = &g.jnl;
+  *jnl = { };
+
+  jnl->file = std::fopen(path, "wb");
+  if (!jnl->file) {
+    SDL_Log("Failed to open input journal %s", path);
+    return false;
+  }
+
+  const u32 header[] = { JNL_MAGIC, g.canvas.w, g.canvas.h, FPS };
+  std::fwrite(header, sizeof(header), 1, jnl->file);
+
+  jnl->bufs[0] = MemAlloc<u8>(JNL_BUFFER_SIZE);
+  jnl->bufs[1] = MemAlloc<u8>(JNL_BUFFER_SIZE);
+  jnl->active = jnl->bufs[0];
+  jnl->last_t_us = SDL_GetTicksNS() / 1000;
+  jnl->mtx = SDL_CreateMutex();
+  jnl->cond = SDL_CreateCondition();
+  jnl->thread = SDL_CreateThread(JNL_WriterThread, "vidgen_journal", jnl);
+  assert(jnl->mtx && jnl->cond && jnl->thread);
+
+  // Initial cursor state, so replay does not depend on anything before it
+  JNL_PutRecord(JNL_REC_RADIUS, SDL_GetTicksNS());
+  JNL_PutVarint((u64)(g.cur_radius * JNL_POS_SCALE));
+  jnl->last_radius = g.cur_radius;
+  JNL_PutRecord(JNL_REC_SHAPE, SDL_GetTicksNS());
+  JNL_PutVarint(g.cur_shape);
+  jnl->last_shape = g.cur_shape;
+  JNL_PutRecord(JNL_REC_MOTION, SDL_GetTicksNS());
+  jnl->last_x = (i32)(g.cur_pos.x * JNL_POS_SCALE);
+  jnl->last_y = (i32)(g.cur_pos.y * JNL_POS_SCALE);
+  JNL_PutSVarint(jnl->last_x);
+  JNL_PutSVarint(jnl->last_y);
+  JNL_PutRecord(JNL_REC_BUTTON, SDL_GetTicksNS());
+  JNL_PutVarint(g.cur_down);
+  return true;
+}
+
+void JNL_End() {
+  Journal* jnl = &g.jnl;
+  if (!jnl->file) {
+    return;
+  }
+  JNL_Flush();
+
+  SDL_LockMutex(jnl->mtx);
+  jnl->quit = true;
+  SDL_BroadcastCondition(jnl->cond);
+  SDL_UnlockMutex(jnl->mtx);
+  SDL_WaitThread(jnl->thread, 0);
+
+  jnl->bytes_written = (u64)std::ftell(jnl->file);
+  std::fclose(jnl->file);
+  SDL_Log("Input journal: %u records, %llu bytes", jnl->num_records, (unsigned long long)jnl->bytes_written);
+
+  SDL_DestroyCondition(jnl->cond);
+  SDL_DestroyMutex(jnl->mtx);
+  MemFree(jnl->bufs[0]);
+  MemFree(jnl->bufs[1]);
+  jnl->file = 0;
+}
+
+void JNL_Motion(u64 t_ns, Vec2 pos) {
+  Journal* jnl = &g.jnl;
+  if (!jnl->file) {
+    return;
+  }
+  const i32 x = (i32)(pos.x * JNL_POS_SCALE);
+  const i32 y = (i32)(pos.y * JNL_POS_SCALE);
+  JNL_PutRecord(JNL_REC_MOTION, t_ns);
+  JNL_PutSVarint(x - jnl->last_x);
+  JNL_PutSVarint(y - jnl->last_y);
+  jnl->last_x = x;
+  jnl->last_y = y;
+}
+
+void JNL_Button(u64 t_ns, bool down) {
+  if (!g.jnl.file) {
+    return;
+  }
+  JNL_PutRecord(JNL_REC_BUTTON, t_ns);
+  JNL_PutVarint(down);
+}
+
+void JNL_Frame(u64 t_ns) {
+  Journal* jnl = &g.jnl;
+  if (!jnl->file) {
+    return;
+  }
+  if (g.cur_radius != jnl->last_radius) {
+    JNL_PutRecord(JNL_REC_RADIUS, t_ns);
+    JNL_PutVarint((u64)(g.cur_radius * JNL_POS_SCALE));
+    jnl->last_radius = g.cur_radius;
+  }
+  if (g.cur_shape != jnl->last_shape) {
+    JNL_PutRecord(JNL_REC_SHAPE, t_ns);
+    JNL_PutVarint(g.cur_shape);
+    jnl->last_shape = g.cur_shape;
+  }
+  JNL_PutRecord(JNL_REC_FRAME, t_ns);
+}
+
+static inline bool JNL_GetVarint(const u8** cur, const u8* end, u64* out) {
+  u64 val = 0;
+  for (u32 shift = 0; *cur < end && shift < 64; shift += 7) {
+    const u8 byte = *(*cur)++;
+    val |= (u64)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      *out = val;
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline bool JNL_GetSVarint(const u8** cur, const u8* end, i64* out) {
+  u64 val = 0;
+  if (!JNL_GetVarint(cur, end, &val)) {
+    return false;
+  }
+  *out = (i64)(val >> 1) ^ -(i64)(val & 1);
+  return true;
+}
+
+void HL_PushSample(StrokeSample** samples, usize* num_samples, usize* capacity, const StrokeSample& sample);
+
+// Convert a journal into stroke samples. Samples are stamped with the time of
+// the recorded frame they preceded, so replay reproduces the session frame
+// for frame regardless of how long each frame originally took.
+bool JNL_Load(const char* path, StrokeSample** out_samples, usize* out_num_samples) {
+  usize len = 0;
+  u8* data = (u8*)SDL_LoadFile(path, &len);
+  if (!data) {
+    SDL_Log("Failed to load input journal %s: %s", path, SDL_GetError());
+    return false;
+  }
+  u32 header[4] = { };
+  if (len >= sizeof(header)) {
+    SDL_memcpy(header, data, sizeof(header));
+  }
+  if (header[0] != JNL_MAGIC) {
+    SDL_Log("%s is not an input journal", path);
+    SDL_free(data);
+    return false;
+  }
+  if (header[1] < 2 || header[2] < 2 || header[1] > JNL_MAX_CANVAS || header[2] > JNL_MAX_CANVAS) {
+    SDL_Log("Input journal %s has an invalid canvas size %ux%u", path, header[1], header[2]);
+    SDL_free(data);
+    return false;
+  }
+  if (header[3] != FPS) {
+    SDL_Log("Warning: journal was recorded at %u fps", header[3]);
+  }
+
+  // Replay on a canvas of the recorded size, even for 4:2:0 like --canvas;
+  // --size still picks the output
+  g.canvas.w = header[1] & ~1u;
+  g.canvas.h = header[2] & ~1u;
+
+  StrokeSample* samples = 0;
+  usize num_samples = 0;
+  usize capacity = 0;
+  StrokeSample cur = { };
+  u32 frame = 0;
+  i64 x = 0;
+  i64 y = 0;
+  bool ok = true;
+  const u8* p = data + sizeof(header);
+  const u8* end = data + len;
+  while (p < end && ok) {
+    const u8 tag = *p++;
+    u64 dt = 0;
+    ok = JNL_GetVarint(&p, end, &dt);
+    switch (tag) {
+    case JNL_REC_MOTION: {
+      i64 dx = 0;
+      i64 dy = 0;
+      ok = ok && JNL_GetSVarint(&p, end, &dx) && JNL_GetSVarint(&p, end, &dy);
+      x += dx;
+      y += dy;
+      cur.pos = Vec2((f32)x / JNL_POS_SCALE, (f32)y / JNL_POS_SCALE);
+    } break;
+    case JNL_REC_BUTTON: {
+      u64 down = 0;
+      ok = ok && JNL_GetVarint(&p, end, &down);
+      cur.down = down != 0;
+    } break;
+    case JNL_REC_RADIUS: {
+      u64 radius = 0;
+      ok = ok && JNL_GetVarint(&p, end, &radius);
+      cur.radius = (f32)radius / JNL_POS_SCALE;
+    } break;
+    case JNL_REC_SHAPE: {
+      u64 shape = 0;
+      ok = ok && JNL_GetVarint(&p, end, &shape) && shape < BRUSH_SHAPE_COUNT;
+      cur.shape = (u8)shape;
+    } break;
+    case JNL_REC_FRAME: {
+      cur.t_ms = frame++ * 1000 / FPS;
+      HL_PushSample(&samples, &num_samples, &capacity, cur);
+    } break;
+    default: {
+      ok = false;
+    } break;
+    }
+  }
+  if (!ok) {
+    SDL_Log("Input journal %s is truncated or corrupt, replaying %u frames", path, frame);
+  }
+  SDL_free(data);
+
+  *out_samples = samples;
+  *out_num_samples = num_samples;
+  return true;
+}
+
+//
+// Headless replay
+//
+
+// Append a sample, doubling the array when it is full
+void HL_PushSample(StrokeSample** samples, usize* num_samples, usize* capacity, const StrokeSample& sample) {
+  if (*num_samples == *capacity) {
+    *capacity = Max(*capacity * 2, (usize)256);
+    StrokeSample* grown = MemAlloc<StrokeSample>(*capacity);
+    if (*num_samples > 0) {
+      SDL_memcpy(grown, *samples, sizeof(StrokeSample) * *num_samples);
+    }
+    MemFree(*samples);
+    *samples = grown;
+  }
+  (*samples)[(*num_samples)++] = sample;
+}
+
+// Stroke scripts are plain text, one sample per line:
+//   <time ms> <x> <y> <button down 0/1> <radius> [shape]
+// where shape is 0 (round), 1 (soft) or 2 (square). Lines starting with '#'
+// are ignored.
+bool HL_LoadScript(const char* path, StrokeSample** out_samples, usize* out_num_samples) {
+  char* text = (char*)SDL_LoadFile(path, 0);
+  if (!text) {
+    SDL_Log("Failed to load stroke script %s: %s", path, SDL_GetError());
+    return false;
+  }
+
+  StrokeSample* samples = 0;
+  usize num_samples = 0;
+  usize capacity = 0;
+  for (char* line = text; *line; ) {
+    char* next = line;
+    while (*next && *next != '\n') {
+      ++next;
+    }
+    if (*next) {
+      *next++ = '\0';
+    }
+
+    StrokeSample sample = { };
+    int down = 0;
+    u32 shape = 0;
+    if (line[0] != '#' && SDL_sscanf(line, "%u %f %f %d %f %u", &sample.t_ms, &sample.pos.x, &sample.pos.y, &down, &sample.radius, &shape) >= 5) {
+      sample.down = down != 0;
+      sample.shape = (u8)Min(shape, (u32)BRUSH_SHAPE_COUNT - 1);
+      HL_PushSample(&samples, &num_samples, &capacity, sample);
+    }
+    line = next;
+  }
+  SDL_free(text);
+
+  *out_samples = samples;
+  *out_num_samples = num_samples;
+  return true;
+}
+
+// Lissajous scribble that lifts the pen every couple of seconds
+void HL_SynthesizeScript(u32 num_frames, StrokeSample** out_samples, usize* out_num_samples) {
+  StrokeSample* samples = MemAlloc<StrokeSample>(num_frames);
+  for (u32 i = 0; i < num_frames; ++i) {
+    const f32 t = (f32)i / (f32)FPS;
+    samples[i].t_ms = i * 1000 / FPS;
+    samples[i].pos.x = g.canvas.w * (0.5f + 0.45f * SDL_sinf(t * 1.3f));
+    samples[i].pos.y = g.canvas.h * (0.5f + 0.45f * SDL_sinf(t * 1.7f + 0.5f));
+    samples[i].radius = 4.0f + 12.0f * (0.5f + 0.5f * SDL_sinf(t * 0.7f));
+    samples[i].down = (i / (2 * FPS)) % 4 != 3;
+    samples[i].shape = (u8)((i / (8 * FPS)) % BRUSH_SHAPE_COUNT);
+  }
+  *out_samples = samples;
+  *out_num_samples = num_frames;
+}
+
+SDL_AppResult HL_Run(const StrokeSample* samples, usize num_samples, const char* out_path) {
+  if (num_samples == 0) {
+    SDL_Log("Stroke script is empty");
+    return SDL_APP_FAILURE;
+  }
+
+  CANVAS_Init(g.canvas.w, g.canvas.h);
+  REC_Begin(out_path);
+
+  const u32 num_frames = samples[num_samples - 1].t_ms * FPS / 1000 + 1;
+  const f64 freq = (f64)SDL_GetPerformanceFrequency();
+  u64 t_update = 0;
+  u64 t_convert = 0;
+  u64 t_encode = 0;
+
+  usize next_sample = 0;
+  for (u32 frame = 0; frame < num_frames; ++frame) {
+    const u32 frame_ms = frame * 1000 / FPS;
+
+    u64 t0 = SDL_GetPerformanceCounter();
+    for (; next_sample < num_samples && samples[next_sample].t_ms <= frame_ms; ++next_sample) {
+      g.cur_pos = samples[next_sample].pos;
+      g.cur_radius = samples[next_sample].radius;
+      g.cur_down = samples[next_sample].down;
+      g.cur_shape = samples[next_sample].shape;
+    }
+    CANVAS_Update();
+    u64 t1 = SDL_GetPerformanceCounter();
+
+    // Script time stands in for the wall clock
+    i64 pts = 0;
+    const u32 count = REC_PaceFrame((u64)frame_ms * 1000000, &pts);
+    if (count > 0) {
+      REC_ConvertFrame();
+    }
+    u64 t2 = SDL_GetPerformanceCounter();
+    for (u32 i = 0; i < count; ++i) {
+      g.avframe_out->pts = pts + i;
+      g.avframe_out->opaque = REC_CaptureStamp((u64)frame_ms * 1000000, i + 1 == count);
+      REC_EncodeFrame(g.avframe_out);
+    }
+    u64 t3 = SDL_GetPerformanceCounter();
+
+    t_update += t1 - t0;
+    t_convert += t2 - t1;
+    t_encode += t3 - t2;
+  }
+
+  u64 t0 = SDL_GetPerformanceCounter();
+  REC_End();
+  t_encode += SDL_GetPerformanceCounter() - t0;
+
+  const f64 s_update = (f64)t_update / freq;
+  const f64 s_convert = (f64)t_convert / freq;
+  const f64 s_encode = (f64)t_encode / freq;
+  const f64 s_total = s_update + s_convert + s_encode;
+  SDL_Log("Rendered %u frames (%ux%u) to %s in %.3fs", num_frames, g.canvas.w, g.canvas.h, g.filename, s_total);
+  SDL_Log("  update:  %8.3f ms/frame %10.1f fps", s_update * 1e3 / num_frames, num_frames / s_update);
+  SDL_Log("  convert: %8.3f ms/frame %10.1f fps", s_convert * 1e3 / num_frames, num_frames / s_convert);
+  SDL_Log("  encode:  %8.3f ms/frame %10.1f fps", s_encode * 1e3 / num_frames, num_frames / s_encode);
+  SDL_Log("  total:   %8.3f ms/frame %10.1f fps", s_total * 1e3 / num_frames, num_frames / s_total);
+  return SDL_APP_SUCCESS;
+}
+
+//
+// App
+//
+
 SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[]) {
+  g.canvas.w = DEFAULT_CANVAS_W;
+  g.canvas.h = DEFAULT_CANVAS_H;
+  g.bit_rate = 400000;
+
+  const char* script_path = 0;
+  const char* journal_path = 0;
+  const char* out_path = 0;
+  u32 synth_frames = 0;
+  bool headless = false;
+  bool bench_brush = false;
+  bool bench_convert = false;
+  for (int i = 1; i < argc; ++i) {
+    if (SDL_strcmp(argv[i], "--headless") == 0) {
+      headless = true;
+    } else if (SDL_strcmp(argv[i], "--bench-brush") == 0) {
+      bench_brush = true;
+    } else if (SDL_strcmp(argv[i], "--bench-convert") == 0) {
+      bench_convert = true;
+    } else if (SDL_strcmp(argv[i], "--script") == 0 && i + 1 < argc) {
+      script_path = argv[++i];
+    } else if (SDL_strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      journal_path = argv[++i];
+    } else if (SDL_strcmp(argv[i], "--canvas") == 0 && i + 1 < argc) {
+      if (SDL_sscanf(argv[++i], "%ux%u", &g.canvas.w, &g.canvas.h) != 2 || g.canvas.w < 2 || g.canvas.h < 2) {
+        SDL_Log("Invalid canvas size %s", argv[i]);
+        return SDL_APP_FAILURE;
+      }
+    } else if (SDL_strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+      if (SDL_sscanf(argv[++i], "%ux%u", &g.out_w, &g.out_h) != 2 || g.out_w == 0 || g.out_h == 0) {
+        SDL_Log("Invalid output size %s", argv[i]);
+        return SDL_APP_FAILURE;
+      }
+    } else if (SDL_strcmp(argv[i], "--segment-time") == 0 && i + 1 < argc) {
+      g.mux.seg_time = SDL_atof(argv[++i]);
+    } else if (SDL_strcmp(argv[i], "--segment-size") == 0 && i + 1 < argc) {
+      g.mux.seg_bytes = (u64)(SDL_atof(argv[++i]) * 1024.0 * 1024.0);
+    } else if (SDL_strcmp(argv[i], "--segment-keep") == 0 && i + 1 < argc) {
+      g.mux.seg_keep = (u32)Clamp(SDL_atoi(argv[++i]), 0, (int)MUX_MAX_KEEP);
+    } else if (SDL_strcmp(argv[i], "--cfr") == 0 && i + 1 < argc) {
+      const int cfr = SDL_atoi(argv[++i]);
+      if (cfr < 1 || cfr > REC_MAX_CFR) {
+        SDL_Log("Invalid frame rate %s, expected 1-%d", argv[i], REC_MAX_CFR);
+        return SDL_APP_FAILURE;
+      }
+      g.cfr = (u32)cfr;
+    } else if (SDL_strcmp(argv[i], "--bitrate") == 0 && i + 1 < argc) {
+      g.bit_rate = SDL_strtol(argv[++i], 0, 10);
+    } else if (SDL_strcmp(argv[i], "--synth") == 0 && i + 1 < argc) {
+      synth_frames = (u32)SDL_atoi(argv[++i]);
+    } else if (SDL_strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      out_path = argv[++i];
+      // The extension picks the container for the file and its segments
+      if (!av_guess_format(0, out_path, 0)) {
+        SDL_Log("No known container for output path %s", out_path);
+        return SDL_APP_FAILURE;
+      }
+    } else {
+      SDL_Log("Usage: vidgen [--bench-brush] [--bench-convert] [--canvas <w>x<h>] [--size <w>x<h>] [--bitrate <bps>] [--cfr <fps>] [--segment-time <s>] [--segment-size <MB>] [--segment-keep <n>] [--headless (--script <path> | --replay <journal> | --synth <frames>) [--out <path>]]");
+      return SDL_APP_FAILURE;
+    }
+  }
+
+  // 4:2:0 video needs even dimensions
+  g.canvas.w &= ~1u;
+  g.canvas.h &= ~1u;
+  g.out_w &= ~1u;
+  g.out_h &= ~1u;
+
+  g.jobs.Init();
+
+  if (bench_brush) {
+    return BRUSH_Benchmark();
+  }
+  if (bench_convert) {
+    return REC_BenchmarkConvert();
+  }
+
+  // Render a scripted session straight to file without a window
+  if (headless) {
+    StrokeSample* samples = 0;
+    usize num_samples = 0;
+    if (script_path) {
+      if (!HL_LoadScript(script_path, &samples, &num_samples)) {
+        return SDL_APP_FAILURE;
+      }
+    } else if (journal_path) {
+      if (!JNL_Load(journal_path, &samples, &num_samples)) {
+        return SDL_APP_FAILURE;
+      }
+    } else {
+      HL_SynthesizeScript(synth_frames ? synth_frames : 10 * FPS, &samples, &num_samples);
+    }
+    SDL_AppResult result = HL_Run(samples, num_samples, out_path);
+    MemFree(samples);
+    return result;
+  }
+
   if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS)) {
     SDL_Log("Failed to initialize SDL: %s", SDL_GetError());
   }
-  if (!(g.wnd = SDL_CreateWindow(__FILE__, CANVAS_W, CANVAS_H, 0))) {
+  // Fit large canvases on screen; the renderer scales to the window
+  const f32 wnd_scale = Min(1.0f, Min((f32)MAX_WINDOW_W / g.canvas.w, (f32)MAX_WINDOW_H / g.canvas.h));
+  if (!(g.wnd = SDL_CreateWindow(__FILE__, (int)(g.canvas.w * wnd_scale), (int)(g.canvas.h * wnd_scale), SDL_WINDOW_RESIZABLE))) {
     SDL_Log("Failed to create SDL window: %s", SDL_GetError());
   }
   if (!(g.r = SDL_CreateRenderer(g.wnd, 0))) {
     SDL_Log("Failed to create SDL renderer: %s", SDL_GetError());
   }
   SDL_SetRenderVSync(g.r, 1);
+  SDL_SetRenderLogicalPresentation(g.r, g.canvas.w, g.canvas.h, SDL_LOGICAL_PRESENTATION_LETTERBOX);
 
-  g.cur_radius = 10.0f;
-
-  g.canvas = MemAlloc<Pixel_RGB888>(CANVAS_W * CANVAS_H);
-  for (u32 i = 0; i < CANVAS_W * CANVAS_H; ++i) {
-    g.canvas[i] = PIXEL_BLACK;
-  }
+  CANVAS_Init(g.canvas.w, g.canvas.h);
 
-  g.canvas_tex = SDL_CreateTexture(g.r, SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STREAMING, CANVAS_W, CANVAS_H);
+  g.canvas_tex = SDL_CreateTexture(g.r, SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STREAMING, g.canvas.w, g.canvas.h);
   if (!g.canvas_tex) {
     SDL_Log("Failed to create SDL texture: %s", SDL_GetError());
   }
@@ -214,34 +1735,17 @@ SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[]) {
 
 SDL_AppResult SDL_AppIterate(void* appstate) {
   // Update canvas
-  if (SDL_GetRelativeMouseState(0, 0) & SDL_BUTTON_MASK(1)) {
-    Vec2 tl = g.cur_pos - Vec2(g.cur_radius, g.cur_radius);
-    tl.x = Max(tl.x, 0.0f);
-    tl.y = Max(tl.y, 0.0f);
-    Vec2 br = g.cur_pos + Vec2(g.cur_radius, g.cur_radius);
-    br.x = Min(br.x, (f32)(CANVAS_W - 1));
-    br.y = Min(br.y, (f32)(CANVAS_H - 1));
-    for (u32 y = (u32)tl.y; y <= (u32)br.y; ++y) {
-      Pixel_RGB888* row = &g.canvas[y * CANVAS_W];
-      for (u32 x = (u32)tl.x; x <= (u32)br.x; ++x) {
-        row[x] = PIXEL_WHITE;
-      }
-    }
-  }
+  CANVAS_Update();
 
   // Render to file
   if (g.recording) {
-    REC_Frame();
+    const u64 now_ns = SDL_GetTicksNS();
+    JNL_Frame(now_ns);
+    REC_Frame(now_ns - g.rec_t0_ns);
   }
 
   // Draw canvas
-  void* texture = 0;
-  int texture_pitch = 0; // why isnt this an optional parameter?
-  if (!SDL_LockTexture(g.canvas_tex, 0, &texture, &texture_pitch)) {
-    SDL_Log("Failed to lock texture: %s", SDL_GetError());
-  }
-  SDL_memcpy(texture, g.canvas, sizeof(Pixel_RGB888) * CANVAS_W * CANVAS_H);
-  SDL_UnlockTexture(g.canvas_tex);
+  CANVAS_Upload(g.canvas_tex);
   SDL_RenderTexture(g.r, g.canvas_tex, 0, 0);
 
   // Draw cursor
@@ -254,10 +1758,18 @@ SDL_AppResult SDL_AppIterate(void* appstate) {
   };
   SDL_RenderRect(g.r, &cur_rect);
 
+  SDL_RenderDebugTextFormat(g.r, 2, g.canvas.h - 10, "Brush: %s, radius %.0f (%s). B: shape, wheel: radius",
+    BRUSH_SHAPE_NAMES[g.cur_shape], g.cur_radius, g.brush->name);
+
   if (!g.recording) {
     SDL_RenderDebugText(g.r, 2, 2, "Status: Not recording. Press SPACE to start.");
   } else {
     SDL_RenderDebugTextFormat(g.r, 2, 2, "Status: Recording to %s. Press SPACE to stop", g.filename);
+    SDL_RenderDebugTextFormat(g.r, 2, 12, "Frames: %u encoded, %u dropped, %u duplicated. Drift: %+.1f ms. Pool allocations: %u",
+      g.frame_num, g.frames_dropped, g.frames_duplicated, SDL_GetAtomicInt(&g.mux.drift_last_us) / 1e3, REC_PoolAllocations());
+    if (g.mux.seg_keep > 0) {
+      SDL_RenderDebugTextFormat(g.r, 2, 22, "Rolling buffer of %u segments. Press S to save it", g.mux.seg_keep);
+    }
   }
 
   SDL_RenderPresent(g.r);
@@ -265,6 +1777,9 @@ SDL_AppResult SDL_AppIterate(void* appstate) {
 }
 
 SDL_AppResult SDL_AppEvent(void* appstate, SDL_Event* event) {
+  // Window to canvas coordinates
+  SDL_ConvertEventToRenderCoordinates(g.r, event);
+
   switch (event->type) {
   case SDL_EVENT_QUIT: {
     return SDL_APP_SUCCESS;
@@ -272,13 +1787,36 @@ SDL_AppResult SDL_AppEvent(void* appstate, SDL_Event* event) {
   case SDL_EVENT_MOUSE_MOTION: {
     g.cur_pos.x = event->motion.x;
     g.cur_pos.y = event->motion.y;
+    JNL_Motion(event->motion.timestamp, g.cur_pos);
+  } break;
+  case SDL_EVENT_MOUSE_BUTTON_DOWN:
+  case SDL_EVENT_MOUSE_BUTTON_UP: {
+    if (event->button.button == SDL_BUTTON_LEFT) {
+      g.cur_down = event->button.down;
+      JNL_Button(event->button.timestamp, g.cur_down);
+    }
+  } break;
+  case SDL_EVENT_MOUSE_WHEEL: {
+    g.cur_radius = Clamp(g.cur_radius + event->wheel.y, 1.0f, 100.0f);
   } break;
   case SDL_EVENT_KEY_DOWN: {
+    if (event->key.key == SDLK_B) {
+      g.cur_shape = (g.cur_shape + 1) % BRUSH_SHAPE_COUNT;
+    }
+    if (event->key.key == SDLK_S && g.recording && g.mux.seg_keep > 0) {
+      MUX_RequestSave();
+    }
     if (event->key.key == SDLK_SPACE) {
       if (g.recording) {
+        JNL_End();
         REC_End();
       } else {
         REC_Begin();
+
+        // Journal the input next to the video, e.g. vidgen-<time>.vgj
+        char jnl_path[sizeof(g.filename)] = { };
+        SDL_snprintf(jnl_path, sizeof(jnl_path), "%.*s.vgj", MUX_StemLength(g.filename), g.filename);
+        JNL_Begin(jnl_path);
       }
     }
   } break;
@@ -288,5 +1826,6 @@ SDL_AppResult SDL_AppEvent(void* appstate, SDL_Event* event) {
 }
 
 void SDLCALL SDL_AppQuit(void* appstate, SDL_AppResult result) {
+  g.jobs.Shutdown();
   SDL_Quit();
 }
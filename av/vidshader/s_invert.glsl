@@ -4,8 +4,8 @@ in vec2 texcoord;
 
 out vec4 color;
 
-uniform sampler2D tex;
+uniform sampler2D u_sampler;
 
 void main() {
-  color = vec4(vec3(1.0f, 1.0f, 1.0f) - texture(tex, texcoord).rgb, 1.0f);
+  color = vec4(vec3(1.0f, 1.0f, 1.0f) - texture(u_sampler, texcoord).rgb, 1.0f);
 }
\ No newline at end of file
@@ -4,8 +4,16 @@ in vec2 texcoord;
 
 out vec4 color;
 
-uniform sampler2D tex;
+uniform sampler2D u_sampler;
+
+layout (std140) uniform FrameUniforms {
+  vec2 u_video_resolution;
+  vec2 u_mouse;
+  float u_time;
+  float u_frame_time;
+  int u_frame;
+};
 
 void main() {
-  color = vec4(texture(tex, vec2(texcoord.x, texcoord.y + sin(texcoord.x * 10) / 10.0f)).rgb, 1.0f);
+  color = vec4(texture(u_sampler, vec2(texcoord.x, texcoord.y + sin(texcoord.x * 10 + u_time * 2.0f) / 10.0f)).rgb, 1.0f);
 }
\ No newline at end of file
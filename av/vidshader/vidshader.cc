@@ -1,9 +1,13 @@
 #include "common_core.hh"
+#include "common_av.hh"
+#include "common_dsa.hh"
 #include "common_math.hh"
+#include "common_thread.hh"
 
 extern "C" {
   #include <libavcodec/avcodec.h>
   #include <libavformat/avformat.h>
+  #include <libswresample/swresample.h>
   #include <libswscale/swscale.h>
 }
 
@@ -13,108 +17,2992 @@ extern "C" {
 
 #include <glad/glad.h>
 
-struct Vertex {
-  Vec2 position;
-  Vec2 texcoord;
+#include "vidshader_tex.hh"
+
+#ifdef __linux__
+# include <sys/inotify.h>
+# include <unistd.h>
+#endif
+
+const char* DEFAULT_FRAGMENT_SHADER = R"""(#version 330 core
+
+in vec2 texcoord;
+
+out vec4 color;
+
+uniform sampler2D u_sampler;
+
+void main() {
+  color = vec4(texture(u_sampler, texcoord).rgb, 1.0f);
+}
+
+)""";
+
+// One direction of a separable, symmetric kernel. Every tap past the centre
+// sits between two texels so bilinear filtering sums both with one fetch.
+// Kernel passes keep their input's size along the axis they filter, so each
+// fragment is on a texel centre there. Array sizes match PIPE_MAX_TAPS.
+const char* KERNEL_FRAGMENT_SHADER = R"""(#version 330 core
+
+in vec2 texcoord;
+
+out vec4 color;
+
+uniform sampler2D u_sampler;
+uniform vec2 u_step;
+uniform int u_num_taps;
+uniform float u_offsets[33];
+uniform float u_weights[33];
+
+void main() {
+  vec3 sum = texture(u_sampler, texcoord).rgb * u_weights[0];
+  for (int i = 1; i < u_num_taps; ++i) {
+    vec2 offset = u_step * u_offsets[i];
+    sum += (texture(u_sampler, texcoord + offset).rgb + texture(u_sampler, texcoord - offset).rgb) * u_weights[i];
+  }
+  color = vec4(sum, 1.0f);
+}
+
+)""";
+
+constexpr u32 DEC_DEFAULT_AHEAD = 8;
+constexpr u32 DEC_MAX_AHEAD = 64;
+
+struct DecodedFrame {
+  AVFrame* frame;
+  f64 t;
+  u32 loop;
+};
+
+constexpr u32 IDX_MAGIC = 0x3149464B; // "KFI1"
+constexpr u32 IDX_HASH_CHUNK = 1 << 20;
+
+struct KeyframeIndex {
+  const char* video_path;
+  char sidecar_path[1024];
+  int stream;
+  u8 input_mode;
+  u64 key;
+  // Keyframe timestamps in stream time_base, ascending. Written only by the
+  // build thread until ready is set, read-only after.
+  i64* pts;
+  u32 count;
+  u32 capacity;
+  SDL_Thread* thread;
+  SDL_AtomicInt ready;
+  SDL_AtomicInt quit;
+};
+
+constexpr u32 FC_SIZE = 16;
+
+struct CachedFrame {
+  AVFrame* frame;
+  f64 t;
+  u64 last_used;
+};
+
+struct FrameCache {
+  CachedFrame entries[FC_SIZE];
+  u64 clock;
+};
+
+struct Decoder {
+  SDL_Thread* thread;
+  SDL_Mutex* mtx;
+  SDL_Condition* cond;
+  DecodedFrame ring[DEC_MAX_AHEAD];
+  u32 depth;
+  u32 head;
+  u32 count;
+  bool quit;
+  // Stop at the end of the stream instead of looping
+  bool once;
+  bool eof;
+  // Seek requested by the render thread, restarting loop numbering at
+  // seek_loop so frames from before the seek are never mistaken for new ones
+  bool seek_pending;
+  f64 seek_t;
+  u32 seek_loop;
+  // Decoder thread state
+  AVPacket* pkt;
+  AVFrame* decoded;
+  i64 start_pts;
+  u32 loop;
+  // Frames that end before skip_t are decoded but dropped after a seek
+  bool skipping;
+  f64 skip_t;
+  // Stats, guarded by mtx
+  f64 decode_ms_last;
+  f64 decode_ms_avg;
+  u64 frames_decoded;
+  u64 busy_ns;
+};
+
+struct DecodeOptions {
+  int threads;
+  int thread_type;
+  int lowres;
+  AVDiscard skip_loop_filter;
+};
+
+constexpr u32 AUD_PACKET_QUEUE = 256;
+constexpr u32 AUD_RING_FRAMES = 1 << 15;
+constexpr u32 AUD_MARK_COUNT = 256;
+constexpr u32 AUD_SILENCE_FRAMES = 1024;
+constexpr u32 AUD_MAX_CHANNELS = 2;
+constexpr u32 AUD_WAIT_MS = 5;
+
+// Media time and loop of the sample at ring position pos
+struct AudioMark {
+  u32 pos;
+  u32 loop;
+  f64 t;
+};
+
+struct AudioPlayer {
+  int stream_index;
+  AVCodecContext* avcc;
+  SwrContext* swr;
+  SDL_AudioStream* stream;
+  u32 rate;
+  u32 channels;
+  // Seconds between handing samples to SDL and hearing them, past what the
+  // stream still has queued
+  f64 device_latency;
+  // Stream time of the video's first frame, which media time counts from
+  f64 start_offset;
+  SDL_Thread* thread;
+  // Packets from the demuxer, guarded by mtx
+  SDL_Mutex* mtx;
+  SDL_Condition* cond;
+  AVPacket* packets[AUD_PACKET_QUEUE];
+  u32 packet_loops[AUD_PACKET_QUEUE];
+  u32 head;
+  u32 count;
+  bool quit;
+  // Seek, guarded by mtx: packets from before min_loop are dropped, and
+  // samples before start_t
+  bool flush;
+  u32 min_loop;
+  f64 start_t;
+  // Interleaved float samples, written by the audio thread and read by the
+  // device callback. Positions count frames and wrap.
+  f32* ring;
+  SDL_AtomicInt write_pos;
+  SDL_AtomicInt read_pos;
+  SDL_AtomicInt discard_pos;
+  AudioMark marks[AUD_MARK_COUNT];
+  SDL_AtomicInt mark_write;
+  SDL_AtomicInt mark_read;
+  // Device callback state
+  AudioMark mark;
+  bool has_mark;
+  bool starved;
+  f32* silence;
+  // Clock published by the device callback
+  SDL_SpinLock clock_lock;
+  bool clock_valid;
+  f64 clock_t;
+  u32 clock_loop;
+  u64 clock_ns;
+  f64 clock_delay;
+  SDL_AtomicInt underruns;
+  // Audio thread state
+  AVPacket* pkt;
+  AVFrame* frame;
+  f32* convert_buf;
+  int convert_frames;
+  f64 skip_t;
+  // Offset of each presented video frame from the audio clock, in ms
+  f64 offset_ms_avg;
+  f64 offset_ms_max;
+};
+
+const char* const DEC_THREAD_TYPE_NAMES[] = { "auto", "frame", "slice" };
+const int DEC_THREAD_TYPES[] = { FF_THREAD_FRAME | FF_THREAD_SLICE, FF_THREAD_FRAME, FF_THREAD_SLICE };
+
+const char* const DEC_DISCARD_NAMES[] = { "none", "nonref", "bidir", "nonkey", "all" };
+const AVDiscard DEC_DISCARDS[] = { AVDISCARD_DEFAULT, AVDISCARD_NONREF, AVDISCARD_BIDIR, AVDISCARD_NONKEY, AVDISCARD_ALL };
+
+constexpr u32 SHD_BINARY_MAGIC = 0x31424853; // "SHB1"
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+# define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+# define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+# define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+# define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// GL_ARB_get_program_binary and GL_KHR_parallel_shader_compile, which the
+// 3.3 loader does not cover
+typedef void (APIENTRYP PFN_GetProgramBinary)(GLuint program, GLsizei size, GLsizei* length, GLenum* format, void* binary);
+typedef void (APIENTRYP PFN_ProgramBinary)(GLuint program, GLenum format, const void* binary, GLsizei length);
+typedef void (APIENTRYP PFN_ProgramParameteri)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP PFN_MaxShaderCompilerThreads)(GLuint count);
+
+struct ShaderCache {
+  PFN_GetProgramBinary get_program_binary;
+  PFN_ProgramBinary program_binary;
+  PFN_ProgramParameteri program_parameteri;
+  bool parallel;
+  char dir[1024];
+  u64 device_hash;
+  u32 hits;
+  u32 misses;
+};
+
+// A program being built, possibly on the driver's compiler threads
+struct ShaderBuild {
+  GLuint program;
+  GLuint shaders[2];
+  u64 key;
+  bool cached;
+};
+
+constexpr u32 PIPE_MAX_PASSES = 16;
+constexpr u32 PIPE_QUERY_COUNT = 4;
+constexpr u32 PIPE_MAX_KERNEL_RADIUS = 64;
+constexpr u32 PIPE_MAX_TAPS = PIPE_MAX_KERNEL_RADIUS / 2 + 1;
+
+enum : u8 {
+  PIPE_KERNEL_NONE = 0,
+  PIPE_KERNEL_GAUSSIAN,
+  PIPE_KERNEL_BOX,
+  PIPE_KERNEL_COUNT,
+};
+
+const char* const PIPE_KERNEL_NAMES[] = { "none", "gaussian", "box" };
+
+// Internal formats intermediate passes can render to
+const char* const PIPE_FORMAT_NAMES[] = { "rgba8", "rgb10a2", "r11g11b10f", "rgba16f" };
+const GLenum PIPE_FORMATS[] = { GL_RGBA8, GL_RGB10_A2, GL_R11F_G11F_B10F, GL_RGBA16F };
+
+struct PipelineTarget {
+  GLuint fbo;
+  GLuint tex;
+  u32 w;
+  u32 h;
+  u32 format;
+};
+
+struct PipelinePass {
+  char path[256];
+  GLuint program;
+  GLint loc_sampler;
+  GLint loc_original;
+  GLint loc_resolution;
+  GLint loc_output_resolution;
+  // Hot reload: the file is rebuilt after it changes on disk, and the new
+  // program replaces the old one only once it links
+  bool dirty;
+  int watch;
+  SDL_Time mtime;
+  ShaderBuild reload;
+  // Built-in kernel passes run one direction of a separable kernel, with a
+  // radius in video pixels
+  u8 kernel;
+  bool vertical;
+  f32 radius;
+  // Output size relative to the video, and the format of the target it
+  // renders to. The last pass draws to the screen and ignores both.
+  f32 scale;
+  u32 format;
+  u32 w;
+  u32 h;
+  i32 target;
+  // GPU time, read back a few frames late so the queries never stall
+  GLuint query[PIPE_QUERY_COUNT];
+  u32 queries_issued;
+  f64 gpu_ms;
+};
+
+// Per-frame values every pass can read by declaring, in std140 layout:
+//   layout (std140) uniform FrameUniforms {
+//     vec2 u_video_resolution;
+//     vec2 u_mouse;       // in texcoord space, (0, 0) top-left
+//     float u_time;       // media clock in seconds, stops while paused
+//     float u_frame_time; // PTS of the frame on screen in seconds
+//     int u_frame;        // frames rendered so far
+//   };
+struct FrameUniforms {
+  Vec2 video_resolution;
+  Vec2 mouse;
+  f32 time;
+  f32 frame_time;
+  i32 frame;
+  f32 pad;
+};
+static_assert(sizeof(FrameUniforms) == 32, "FrameUniforms must match the std140 block");
+
+constexpr GLuint PIPE_FRAME_UNIFORMS_BINDING = 0;
+
+struct Pipeline {
+  PipelinePass passes[PIPE_MAX_PASSES];
+  u32 num_passes;
+  PipelineTarget targets[PIPE_MAX_PASSES];
+  u32 num_targets;
+  u32 frame;
+  GLuint frame_ubo;
+  // inotify descriptor on Linux, -1 when polling modification times
+  int notify_fd;
+  u64 poll_ns;
+};
+
+constexpr u32 FLT_TILE_ROWS = 32;
+constexpr u32 FLT_MAX_DIFF = 2;
+
+enum : u8 {
+  FLT_KERNEL = 0,
+  FLT_INVERT,
+  FLT_ABBR,
+  FLT_WAVE,
+  FLT_COUNT,
+};
+
+const char* const FLT_NAMES[] = { "kernel", "invert", "abbr", "wave" };
+const char* const FLT_SHADERS[] = { "s_kernel.glsl", "s_invert.glsl", "s_abbr.glsl", "s_wave.glsl" };
+
+enum : u8 {
+  FLT_ISA_SCALAR = 0,
+  FLT_ISA_SSE2,
+  FLT_ISA_AVX2,
+  FLT_ISA_COUNT,
 };
 
-const char* VERTEX_SHADER = R"""(#version 330 core
+const char* const FLT_ISA_NAMES[] = { "scalar", "sse2", "avx2" };
+
+struct CPUFilter {
+  u8 filter;
+  u8 isa;
+  u32 w;
+  u32 h;
+  u32 num_tiles;
+  JobPool* jobs;
+  // Current frame
+  const u8* src;
+  usize src_pitch;
+  u8* dst;
+  usize dst_pitch;
+  // Kernel: one padded row of vertical sums per tile
+  u16* sums;
+  usize sums_stride;
+  // Wave: source row offset and 8-bit blend weight per column
+  i32* wave_offset;
+  i32* wave_frac;
+};
+
+constexpr u32 OFF_READBACK_COUNT = 3;
+constexpr u32 OFF_QUEUE_SIZE = 8;
+constexpr u32 OFF_POOL_FRAMES = OFF_QUEUE_SIZE + 2;
+constexpr i64 OFF_DEFAULT_BIT_RATE = 8000000;
+
+struct OfflineRender {
+  u32 w;
+  u32 h;
+  // Shader output, and a flipped copy with the top row first for readback
+  GLuint render_fbo;
+  GLuint render_tex;
+  GLuint read_fbo;
+  GLuint read_tex;
+  GLuint pbo[OFF_READBACK_COUNT];
+  GLsync fence[OFF_READBACK_COUNT];
+  i64 pts[OFF_READBACK_COUNT];
+  AV_Converter conv;
+  AV_FramePool frame_pool;
+  // Encoder thread
+  SDL_Thread* thread;
+  SDL_Mutex* mtx;
+  SDL_Condition* cond;
+  AVFrame* queue[OFF_QUEUE_SIZE];
+  u32 head;
+  u32 count;
+  bool quit;
+  AVCodecContext* avcc;
+  AVFormatContext* avfc;
+  AVStream* avst;
+  AVPacket* pkt;
+  u64 frames_encoded;
+};
+
+static struct {
+  SDL_Window* wnd;
+  SDL_GLContext gl;
+  GLuint quad_vao;
+  GLuint quad_vbo;
+  GLuint quad_ibo;
+  ShaderCache shader_cache;
+  Pipeline pipe;
+  GLuint program_default;
+  GLuint texture;
+  Vec2 resolution;
+  Vec2 viewport;
+  AV_FileInput input;
+  AVFormatContext* avfc;
+  int avfc_video_stream;
+  const AVCodec* avc;
+  AVCodecContext* avcc;
+  AV_DecodeBufferPool dec_buffers;
+  AV_Converter conv;
+  // Format textures and converters are set up for, at g.resolution, and
+  // where frames that changed mid-stream are scaled back to it
+  AVPixelFormat frame_fmt;
+  SwsContext* conform_sws;
+  AVFrame* conformed;
+  TextureStream stream;
+  JobPool jobs;
+  Decoder dec;
+  AudioPlayer audio;
+  CPUFilter filter;
+  KeyframeIndex index;
+  FrameCache cache;
+  OfflineRender off;
+  // Presentation
+  AVFrame* current;
+  f64 current_t;
+  f64 frame_dur;
+  f64 media_t;
+  u32 clock_loop;
+  u64 last_iter_ns;
+  u32 underruns;
+  bool starved;
+  // Frames shown, frames that were due but overtaken before they could be
+  // shown, and refreshes that kept showing the previous frame
+  u64 presented;
+  u64 dropped;
+  u64 repeated;
+  u64 title_ns;
+  bool paused;
+  bool show_original;
+  // Navigation
+  f64 duration;
+  bool seek_show;
+  bool resume_seek;
+  bool scrubbing;
+  Vec2 mouse;
+} g = { };
+
+//
+// Shader programs
+//
+// Linked programs are saved as driver binaries under the user's pref path,
+// keyed by a hash of their sources and the GL driver, and loaded from there
+// on later runs instead of compiling. Where the driver compiles on its own
+// threads, programs are started together and their status queried only once
+// the driver reports them complete, so building never blocks a frame.
+//
+
+static u64 SHD_Hash(u64 hash, const char* str) {
+  // FNV-1a
+  for (; *str; ++str) {
+    hash = (hash ^ (u8)*str) * 0x100000001B3ull;
+  }
+  return hash;
+}
+
+void SHD_Init(ShaderCache* cache) {
+  *cache = { };
+  if (SDL_GL_ExtensionSupported("GL_KHR_parallel_shader_compile") || SDL_GL_ExtensionSupported("GL_ARB_parallel_shader_compile")) {
+    PFN_MaxShaderCompilerThreads max_threads = (PFN_MaxShaderCompilerThreads)SDL_GL_GetProcAddress("glMaxShaderCompilerThreadsKHR");
+    if (!max_threads) {
+      max_threads = (PFN_MaxShaderCompilerThreads)SDL_GL_GetProcAddress("glMaxShaderCompilerThreadsARB");
+    }
+    if (max_threads) {
+      max_threads(0xFFFFFFFF);
+      cache->parallel = true;
+    }
+  }
+
+  GLint num_formats = 0;
+  if (SDL_GL_ExtensionSupported("GL_ARB_get_program_binary")) {
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+  }
+  char* pref_path = num_formats > 0 ? SDL_GetPrefPath("fun", "vidshader") : 0;
+  if (pref_path) {
+    cache->get_program_binary = (PFN_GetProgramBinary)SDL_GL_GetProcAddress("glGetProgramBinary");
+    cache->program_binary = (PFN_ProgramBinary)SDL_GL_GetProcAddress("glProgramBinary");
+    cache->program_parameteri = (PFN_ProgramParameteri)SDL_GL_GetProcAddress("glProgramParameteri");
+    SDL_strlcpy(cache->dir, pref_path, sizeof(cache->dir));
+    SDL_free(pref_path);
+  }
+  if (!cache->get_program_binary || !cache->program_binary || !cache->program_parameteri) {
+    cache->dir[0] = 0;
+  }
+
+  // Binaries only load on the driver that produced them
+  u64 hash = 0xCBF29CE484222325ull;
+  hash = SHD_Hash(hash, (const char*)glGetString(GL_VENDOR));
+  hash = SHD_Hash(hash, (const char*)glGetString(GL_RENDERER));
+  hash = SHD_Hash(hash, (const char*)glGetString(GL_VERSION));
+  cache->device_hash = hash;
+  SDL_Log("Shader programs: %s compile, binary cache %s", cache->parallel ? "parallel" : "serial", cache->dir[0] ? cache->dir : "off");
+}
+
+static void SHD_BinaryPath(const ShaderCache* cache, u64 key, char* path, usize size) {
+  SDL_snprintf(path, size, "%s%016llx.glbin", cache->dir, (unsigned long long)key);
+}
+
+static bool SHD_LoadBinary(ShaderCache* cache, GLuint program, u64 key) {
+  char path[1100] = { };
+  SHD_BinaryPath(cache, key, path, sizeof(path));
+  usize size = 0;
+  u8* data = (u8*)SDL_LoadFile(path, &size);
+  if (!data) {
+    return false;
+  }
+  u32 header[3] = { };
+  bool loaded = false;
+  if (size >= sizeof(header)) {
+    std::memcpy(header, data, sizeof(header));
+  }
+  if (header[0] == SHD_BINARY_MAGIC && size == sizeof(header) + header[2]) {
+    cache->program_binary(program, header[1], data + sizeof(header), (GLsizei)header[2]);
+    GLint status = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    loaded = status != 0;
+  }
+  SDL_free(data);
+  return loaded;
+}
+
+static void SHD_SaveBinary(const ShaderCache* cache, GLuint program, u64 key) {
+  GLint size = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+  if (size <= 0) {
+    return;
+  }
+  u8* data = MemAlloc<u8>(3 * sizeof(u32) + size);
+  GLenum format = 0;
+  GLsizei length = 0;
+  cache->get_program_binary(program, size, &length, &format, data + 3 * sizeof(u32));
+  const u32 header[3] = { SHD_BINARY_MAGIC, format, (u32)length };
+  std::memcpy(data, header, sizeof(header));
+
+  char path[1100] = { };
+  SHD_BinaryPath(cache, key, path, sizeof(path));
+  if (!SDL_SaveFile(path, data, sizeof(header) + length)) {
+    SDL_Log("Failed to write program binary %s", path);
+  }
+  MemFree(data);
+}
+
+// Starts building a program. Nothing here waits on the compiler.
+ShaderBuild SHD_Begin(const char* vert_src, const char* frag_src) {
+  ShaderCache* cache = &g.shader_cache;
+  ShaderBuild build = { };
+  build.program = glCreateProgram();
+  build.key = SHD_Hash(SHD_Hash(cache->device_hash, vert_src), frag_src);
+  if (cache->dir[0] && SHD_LoadBinary(cache, build.program, build.key)) {
+    build.cached = true;
+    ++cache->hits;
+    return build;
+  }
+  ++cache->misses;
+
+  const char* sources[] = { vert_src, frag_src };
+  const GLenum types[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+  for (u32 i = 0; i < 2; ++i) {
+    build.shaders[i] = glCreateShader(types[i]);
+    glShaderSource(build.shaders[i], 1, &sources[i], 0);
+    glCompileShader(build.shaders[i]);
+    glAttachShader(build.program, build.shaders[i]);
+  }
+  if (cache->dir[0]) {
+    cache->program_parameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+  glLinkProgram(build.program);
+  return build;
+}
+
+// Whether SHD_Finish would return without waiting
+bool SHD_Ready(const ShaderBuild* build) {
+  if (build->cached || !g.shader_cache.parallel) {
+    return true;
+  }
+  GLint complete = 0;
+  glGetProgramiv(build->program, GL_COMPLETION_STATUS_KHR, &complete);
+  return complete != 0;
+}
+
+// Returns the linked program, or 0 after logging why it failed
+GLuint SHD_Finish(ShaderBuild* build, const char* name) {
+  GLuint program = build->program;
+  if (!build->cached) {
+    GLint linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+      char log[1024] = { };
+      bool compiled = true;
+      for (u32 i = 0; i < 2; ++i) {
+        GLint status = 0;
+        glGetShaderiv(build->shaders[i], GL_COMPILE_STATUS, &status);
+        if (!status) {
+          glGetShaderInfoLog(build->shaders[i], sizeof(log), 0, log);
+          SDL_Log("Failed to compile %s: %s", name, log);
+          compiled = false;
+        }
+      }
+      if (compiled) {
+        glGetProgramInfoLog(program, sizeof(log), 0, log);
+        SDL_Log("Failed to link %s: %s", name, log);
+      }
+    }
+    for (u32 i = 0; i < 2; ++i) {
+      glDetachShader(program, build->shaders[i]);
+      glDeleteShader(build->shaders[i]);
+    }
+    if (!linked) {
+      glDeleteProgram(program);
+      program = 0;
+    } else if (g.shader_cache.dir[0]) {
+      SHD_SaveBinary(&g.shader_cache, program, build->key);
+    }
+  }
+  *build = { };
+  return program;
+}
+
+GLuint LoadAndCompileProgram(const char* vert_src, const char* frag_src) {
+  ShaderBuild build = SHD_Begin(vert_src, frag_src);
+  GLuint prog = SHD_Finish(&build, "program");
+  if (!prog) {
+    exit(1);
+  }
+  return prog;
+}
+
+//
+// Pipeline
+//
+// Chain of fragment shaders run over the video texture. Each pass samples
+// the previous pass's output as u_sampler and the untouched frame as
+// u_original, with u_resolution the size of its input and
+// u_output_resolution the size it renders at. Intermediate passes render
+// into targets scaled relative to the video, shared between passes of the
+// same size and format so a uniform chain ping-pongs between two of them.
+//
+
+static void PIPE_AddPass(Pipeline* pipe, const char* dir, int dir_len, const char* file, f32 scale, u32 format) {
+  PipelinePass* pass = &pipe->passes[pipe->num_passes++];
+  SDL_snprintf(pass->path, sizeof(pass->path), "%.*s%s", dir_len, dir, file);
+  pass->scale = scale;
+  pass->format = format;
+}
+
+// Splits a kernel into a horizontal and a vertical pass. The horizontal pass
+// keeps its input's width and the vertical pass its input's height, so each
+// filters on texel centres and the scale is applied along the other axis.
+static void PIPE_AddKernel(Pipeline* pipe, u8 kernel, f32 radius, f32 scale, u32 format) {
+  for (u32 i = 0; i < 2; ++i) {
+    PipelinePass* pass = &pipe->passes[pipe->num_passes++];
+    SDL_snprintf(pass->path, sizeof(pass->path), "%s %g %s", PIPE_KERNEL_NAMES[kernel], radius, i ? "vertical" : "horizontal");
+    pass->kernel = kernel;
+    pass->vertical = i == 1;
+    pass->radius = radius;
+    pass->scale = scale;
+    pass->format = format;
+  }
+}
+
+// A kernel pass with no radius resamples its input to the screen. It ends
+// pipelines whose last pass is a kernel, which can't render at screen size.
+static void PIPE_AddCopy(Pipeline* pipe) {
+  PipelinePass* pass = &pipe->passes[pipe->num_passes++];
+  SDL_strlcpy(pass->path, "copy", sizeof(pass->path));
+  pass->kernel = PIPE_KERNEL_BOX;
+  pass->radius = 0.0f;
+  pass->scale = 1.0f;
+}
+
+// A path ending in .pipe is a pipeline description with one pass per line:
+//   <shader path> [scale] [rgba8|rgb10a2|r11g11b10f|rgba16f]
+//   gaussian|box <radius> [scale] [format]
+// Shader paths are relative to the description and # starts a comment. Any
+// other path is a single shader.
+bool PIPE_Load(Pipeline* pipe, const char* path) {
+  *pipe = { };
+  pipe->notify_fd = -1;
+  const usize len = SDL_strlen(path);
+  if (len < 5 || SDL_strcmp(path + len - 5, ".pipe") != 0) {
+    PIPE_AddPass(pipe, "", 0, path, 1.0f, 0);
+    return true;
+  }
+
+  char* text = (char*)SDL_LoadFile(path, 0);
+  if (!text) {
+    SDL_Log("Failed to load file %s", path);
+    return false;
+  }
+  const char* slash = SDL_strrchr(path, '/');
+  const int dir_len = slash ? (int)(slash - path + 1) : 0;
+
+  bool valid = true;
+  char* next = text;
+  while (valid && next && *next) {
+    char* line = next;
+    next = SDL_strchr(line, '\n');
+    if (next) {
+      *next++ = 0;
+    }
+    char* comment = SDL_strchr(line, '#');
+    if (comment) {
+      *comment = 0;
+    }
+
+    char* fields[5] = { };
+    u32 num_fields = 0;
+    for (char* c = line; *c && num_fields < SDL_arraysize(fields);) {
+      while (*c && SDL_isspace(*c)) {
+        *c++ = 0;
+      }
+      if (*c) {
+        fields[num_fields++] = c;
+      }
+      while (*c && !SDL_isspace(*c)) {
+        ++c;
+      }
+    }
+    if (num_fields == 0) {
+      continue;
+    }
+
+    u8 kernel = PIPE_KERNEL_NONE + 1;
+    while (kernel < PIPE_KERNEL_COUNT && SDL_strcmp(fields[0], PIPE_KERNEL_NAMES[kernel]) != 0) {
+      ++kernel;
+    }
+    kernel %= PIPE_KERNEL_COUNT;
+    const u32 first = kernel ? 2 : 1;
+    const f32 radius = kernel && num_fields > 1 ? (f32)SDL_atof(fields[1]) : 0.0f;
+    const f32 scale = num_fields > first ? (f32)SDL_atof(fields[first]) : 1.0f;
+    u32 format = 0;
+    while (num_fields > first + 1 && format < SDL_arraysize(PIPE_FORMAT_NAMES) && SDL_strcmp(fields[first + 1], PIPE_FORMAT_NAMES[format]) != 0) {
+      ++format;
+    }
+    valid = num_fields <= first + 2 && scale > 0.0f && scale <= 4.0f && format < SDL_arraysize(PIPE_FORMAT_NAMES) &&
+            (!kernel || (radius >= 1.0f && radius <= PIPE_MAX_KERNEL_RADIUS)) &&
+            pipe->num_passes + (kernel ? 2 : 1) <= PIPE_MAX_PASSES;
+    if (!valid) {
+      SDL_Log("Invalid pass in %s: %s", path, fields[0]);
+      break;
+    }
+    if (kernel) {
+      PIPE_AddKernel(pipe, kernel, radius, scale, format);
+    } else {
+      PIPE_AddPass(pipe, path, fields[0][0] == '/' ? 0 : dir_len, fields[0], scale, format);
+    }
+  }
+  SDL_free(text);
+
+  if (valid && pipe->num_passes == 0) {
+    SDL_Log("No passes in %s", path);
+    valid = false;
+  }
+  if (valid && pipe->passes[pipe->num_passes - 1].kernel) {
+    valid = pipe->num_passes < PIPE_MAX_PASSES;
+    if (valid) {
+      PIPE_AddCopy(pipe);
+    } else {
+      SDL_Log("Too many passes in %s", path);
+    }
+  }
+  return valid;
+}
+
+static i32 PIPE_GetTarget(Pipeline* pipe, u32 w, u32 h, u32 format, i32 input) {
+  for (u32 i = 0; i < pipe->num_targets; ++i) {
+    const PipelineTarget* target = &pipe->targets[i];
+    if ((i32)i != input && target->w == w && target->h == h && target->format == format) {
+      return (i32)i;
+    }
+  }
+
+  PipelineTarget* target = &pipe->targets[pipe->num_targets];
+  target->w = w;
+  target->h = h;
+  target->format = format;
+  glGenTextures(1, &target->tex);
+  glBindTexture(GL_TEXTURE_2D, target->tex);
+  glTexImage2D(GL_TEXTURE_2D, 0, PIPE_FORMATS[format], w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glGenFramebuffers(1, &target->fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target->tex, 0);
+  assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  return (i32)pipe->num_targets++;
+}
+
+// Works out the taps for one direction of a kernel whose radius is in input
+// texels, once when the pass is set up. Pairs of texels share a tap placed
+// where bilinear filtering weighs them correctly, which halves the fetches.
+// The radius is clamped before sigma is derived from it, so the curve always
+// fits the taps. A radius of 0 leaves a single tap that copies the input.
+static void PIPE_SetKernelWeights(const PipelinePass* pass, f32 radius, f32 texel) {
+  radius = pass->radius > 0.0f ? Clamp(radius, 1.0f, (f32)PIPE_MAX_KERNEL_RADIUS) : 0.0f;
+  const u32 r = (u32)SDL_ceilf(radius);
+  f32 texel_weights[PIPE_MAX_KERNEL_RADIUS + 2] = { };
+  const f32 sigma = radius / 3.0f;
+  f32 sum = 0.0f;
+  for (u32 i = 0; i <= r; ++i) {
+    texel_weights[i] = pass->kernel == PIPE_KERNEL_BOX ? 1.0f : SDL_expf(-(f32)(i * i) / (2.0f * sigma * sigma));
+    sum += i ? 2.0f * texel_weights[i] : texel_weights[i];
+  }
+
+  f32 offsets[PIPE_MAX_TAPS] = { };
+  f32 weights[PIPE_MAX_TAPS] = { };
+  weights[0] = texel_weights[0] / sum;
+  u32 num_taps = 1;
+  for (u32 i = 1; i <= r; i += 2) {
+    const f32 w = texel_weights[i] + texel_weights[i + 1];
+    offsets[num_taps] = (i * texel_weights[i] + (i + 1) * texel_weights[i + 1]) / w;
+    weights[num_taps] = w / sum;
+    ++num_taps;
+  }
+
+  glUseProgram(pass->program);
+  const Vec2 step = pass->vertical ? Vec2(0.0f, texel) : Vec2(texel, 0.0f);
+  glUniform2fv(glGetUniformLocation(pass->program, "u_step"), 1, &step.x);
+  glUniform1i(glGetUniformLocation(pass->program, "u_num_taps"), num_taps);
+  glUniform1fv(glGetUniformLocation(pass->program, "u_offsets"), num_taps, offsets);
+  glUniform1fv(glGetUniformLocation(pass->program, "u_weights"), num_taps, weights);
+}
+
+// Looks up the uniforms of a freshly linked pass program and sets the ones
+// that never change
+static void PIPE_SetupProgram(Pipeline* pipe, u32 i) {
+  PipelinePass* pass = &pipe->passes[i];
+  pass->loc_sampler = glGetUniformLocation(pass->program, "u_sampler");
+  pass->loc_original = glGetUniformLocation(pass->program, "u_original");
+  pass->loc_resolution = glGetUniformLocation(pass->program, "u_resolution");
+  pass->loc_output_resolution = glGetUniformLocation(pass->program, "u_output_resolution");
+  glUseProgram(pass->program);
+  glUniform1i(pass->loc_sampler, 0);
+  glUniform1i(pass->loc_original, 1);
+  glUniform1i(glGetUniformLocation(pass->program, "u_flip"), i + 1 < pipe->num_passes);
+  const GLuint block = glGetUniformBlockIndex(pass->program, "FrameUniforms");
+  if (block != GL_INVALID_INDEX) {
+    glUniformBlockBinding(pass->program, block, PIPE_FRAME_UNIFORMS_BINDING);
+  }
+}
+
+// Compiles every pass and sizes the targets for w x h video. Returns whether
+// any pass picks mip levels itself.
+bool PIPE_Init(Pipeline* pipe, u32 w, u32 h) {
+  // Start every build before waiting on any, so drivers with compiler
+  // threads work on them together
+  ShaderBuild builds[PIPE_MAX_PASSES] = { };
+  bool use_mips = false;
+  for (u32 i = 0; i < pipe->num_passes; ++i) {
+    PipelinePass* pass = &pipe->passes[i];
+    if (pass->kernel) {
+      builds[i] = SHD_Begin(VERTEX_SHADER, KERNEL_FRAGMENT_SHADER);
+      continue;
+    }
+    char* source = (char*)SDL_LoadFile(pass->path, 0);
+    if (!source) {
+      SDL_Log("Failed to load file %s", pass->path);
+      exit(1);
+    }
+    use_mips |= SDL_strstr(source, "textureLod") || SDL_strstr(source, "textureGrad");
+    builds[i] = SHD_Begin(VERTEX_SHADER, source);
+    SDL_free(source);
+  }
+
+  glGenBuffers(1, &pipe->frame_ubo);
+  glBindBuffer(GL_UNIFORM_BUFFER, pipe->frame_ubo);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), 0, GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  glBindBufferBase(GL_UNIFORM_BUFFER, PIPE_FRAME_UNIFORMS_BINDING, pipe->frame_ubo);
+
+  u32 input_w = w;
+  u32 input_h = h;
+  for (u32 i = 0; i < pipe->num_passes; ++i) {
+    PipelinePass* pass = &pipe->passes[i];
+    pass->program = SHD_Finish(&builds[i], pass->path);
+    if (!pass->program) {
+      exit(1);
+    }
+    PIPE_SetupProgram(pipe, i);
+    glGenQueries(PIPE_QUERY_COUNT, pass->query);
+    if (pass->kernel) {
+      const u32 input_size = pass->vertical ? input_h : input_w;
+      const f32 radius = pass->radius * input_size / (pass->vertical ? h : w);
+      PIPE_SetKernelWeights(pass, radius, 1.0f / input_size);
+    }
+
+    pass->target = -1;
+    if (i + 1 < pipe->num_passes) {
+      pass->w = Max((u32)(w * pass->scale + 0.5f), 1u);
+      pass->h = Max((u32)(h * pass->scale + 0.5f), 1u);
+      if (pass->kernel && pass->vertical) {
+        pass->h = input_h;
+      } else if (pass->kernel) {
+        pass->w = input_w;
+      }
+      pass->target = PIPE_GetTarget(pipe, pass->w, pass->h, pass->format, i > 0 ? pipe->passes[i - 1].target : -1);
+      input_w = pass->w;
+      input_h = pass->h;
+      SDL_Log("Pass %u: %s, %ux%u %s", i, pass->path, pass->w, pass->h, PIPE_FORMAT_NAMES[pass->format]);
+    } else {
+      SDL_Log("Pass %u: %s", i, pass->path);
+    }
+  }
+  SDL_Log("Built %u programs, %u from cached binaries", g.shader_cache.hits + g.shader_cache.misses, g.shader_cache.hits);
+  return use_mips;
+}
+
+static const char* PIPE_FileName(const char* path) {
+  const char* slash = SDL_strrchr(path, '/');
+  return slash ? slash + 1 : path;
+}
+
+// Starts watching the shader files of the pipeline for changes. Editors
+// often save by renaming over a file, so inotify watches their directories.
+void PIPE_Watch(Pipeline* pipe) {
+#ifdef __linux__
+  pipe->notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+  for (u32 i = 0; i < pipe->num_passes; ++i) {
+    PipelinePass* pass = &pipe->passes[i];
+    pass->watch = -1;
+    if (pass->kernel) {
+      continue;
+    }
+#ifdef __linux__
+    if (pipe->notify_fd >= 0) {
+      char dir[256] = { };
+      const int dir_len = (int)(PIPE_FileName(pass->path) - pass->path);
+      SDL_snprintf(dir, sizeof(dir), "%.*s", dir_len, dir_len ? pass->path : "./");
+      pass->watch = inotify_add_watch(pipe->notify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    }
+#endif
+    SDL_PathInfo info = { };
+    if (SDL_GetPathInfo(pass->path, &info)) {
+      pass->mtime = info.modify_time;
+    }
+  }
+}
+
+static void PIPE_FindChanges(Pipeline* pipe) {
+#ifdef __linux__
+  if (pipe->notify_fd >= 0) {
+    alignas(inotify_event) char buf[4096];
+    ssize_t len = 0;
+    while ((len = read(pipe->notify_fd, buf, sizeof(buf))) > 0) {
+      const inotify_event* event = 0;
+      for (char* p = buf; p < buf + len; p += sizeof(inotify_event) + event->len) {
+        event = (const inotify_event*)p;
+        for (u32 i = 0; i < pipe->num_passes; ++i) {
+          PipelinePass* pass = &pipe->passes[i];
+          if (pass->watch == event->wd && event->len && SDL_strcmp(event->name, PIPE_FileName(pass->path)) == 0) {
+            pass->dirty = true;
+          }
+        }
+      }
+    }
+    return;
+  }
+#endif
+
+  // Elsewhere compare modification times a couple of times a second
+  const u64 now = SDL_GetTicksNS();
+  if (now - pipe->poll_ns < 500 * SDL_NS_PER_MS) {
+    return;
+  }
+  pipe->poll_ns = now;
+  for (u32 i = 0; i < pipe->num_passes; ++i) {
+    PipelinePass* pass = &pipe->passes[i];
+    SDL_PathInfo info = { };
+    if (!pass->kernel && SDL_GetPathInfo(pass->path, &info) && info.modify_time != pass->mtime) {
+      pass->mtime = info.modify_time;
+      pass->dirty = true;
+    }
+  }
+}
+
+// Rebuilds changed passes. A pass keeps drawing with its old program until
+// the new one has linked, and keeps it for good if the new one fails.
+void PIPE_Reload(Pipeline* pipe) {
+  PIPE_FindChanges(pipe);
+  for (u32 i = 0; i < pipe->num_passes; ++i) {
+    PipelinePass* pass = &pipe->passes[i];
+    if (pass->reload.program) {
+      if (!SHD_Ready(&pass->reload)) {
+        continue;
+      }
+      const GLuint program = SHD_Finish(&pass->reload, pass->path);
+      if (program) {
+        glDeleteProgram(pass->program);
+        pass->program = program;
+        PIPE_SetupProgram(pipe, i);
+        SDL_Log("Reloaded %s", pass->path);
+      }
+    }
+    if (pass->dirty) {
+      // A file caught halfway through being saved is retried next frame
+      char* source = (char*)SDL_LoadFile(pass->path, 0);
+      if (!source) {
+        continue;
+      }
+      pass->dirty = false;
+      pass->reload = SHD_Begin(VERTEX_SHADER, source);
+      SDL_free(source);
+    }
+  }
+}
+
+// Runs every pass over g.texture, with the last one drawing into out_fbo
+void PIPE_Run(Pipeline* pipe, GLuint out_fbo, u32 out_w, u32 out_h) {
+  const u32 slot = pipe->frame % PIPE_QUERY_COUNT;
+
+  // One upload shared by every pass
+  FrameUniforms frame_uniforms = { };
+  frame_uniforms.video_resolution = g.resolution;
+  frame_uniforms.mouse = g.mouse;
+  frame_uniforms.time = (f32)g.media_t;
+  frame_uniforms.frame_time = (f32)g.current_t;
+  frame_uniforms.frame = (i32)pipe->frame;
+  glBindBuffer(GL_UNIFORM_BUFFER, pipe->frame_ubo);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frame_uniforms), &frame_uniforms);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+  GLuint input = g.texture;
+  Vec2 input_res = g.resolution;
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, g.texture);
+  glActiveTexture(GL_TEXTURE0);
+
+  for (u32 i = 0; i < pipe->num_passes; ++i) {
+    PipelinePass* pass = &pipe->passes[i];
+
+    // This slot's query was issued PIPE_QUERY_COUNT frames ago
+    if (pipe->frame >= PIPE_QUERY_COUNT) {
+      GLint available = 0;
+      glGetQueryObjectiv(pass->query[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+      if (available) {
+        GLuint64 elapsed_ns = 0;
+        glGetQueryObjectui64v(pass->query[slot], GL_QUERY_RESULT, &elapsed_ns);
+        const f64 ms = (f64)elapsed_ns / 1e6;
+        pass->gpu_ms = pass->gpu_ms > 0.0 ? pass->gpu_ms * 0.9 + ms * 0.1 : ms;
+      }
+    }
+
+    const PipelineTarget* target = pass->target >= 0 ? &pipe->targets[pass->target] : 0;
+    const Vec2 output_res = target ? Vec2(target->w, target->h) : Vec2(out_w, out_h);
+    glBindFramebuffer(GL_FRAMEBUFFER, target ? target->fbo : out_fbo);
+    glViewport(0, 0, (GLsizei)output_res.x, (GLsizei)output_res.y);
+    glBindTexture(GL_TEXTURE_2D, input);
+    glUseProgram(pass->program);
+    glUniform2fv(pass->loc_resolution, 1, &input_res.x);
+    glUniform2fv(pass->loc_output_resolution, 1, &output_res.x);
+
+    glBeginQuery(GL_TIME_ELAPSED, pass->query[slot]);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+    glEndQuery(GL_TIME_ELAPSED);
+
+    if (target) {
+      input = target->tex;
+      input_res = output_res;
+    }
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glBindTexture(GL_TEXTURE_2D, g.texture);
+  ++pipe->frame;
+}
+
+// Appends per-pass GPU times to a status line
+void PIPE_FormatStats(const Pipeline* pipe, char* buf, usize size) {
+  for (u32 i = 0; i < pipe->num_passes; ++i) {
+    const usize len = SDL_strlen(buf);
+    SDL_snprintf(buf + len, size - len, "%s%.2f", i == 0 ? ", gpu " : " + ", pipe->passes[i].gpu_ms);
+  }
+  SDL_strlcat(buf, " ms", size);
+}
+
+void PIPE_Free(Pipeline* pipe) {
+#ifdef __linux__
+  if (pipe->notify_fd >= 0) {
+    close(pipe->notify_fd);
+  }
+#endif
+  for (u32 i = 0; i < pipe->num_passes; ++i) {
+    PipelinePass* pass = &pipe->passes[i];
+    if (pass->reload.program) {
+      SHD_Finish(&pass->reload, pass->path);
+    }
+    if (pass->program) {
+      SDL_Log("Pass %u: %s, %.3f ms GPU", i, pass->path, pass->gpu_ms);
+      glDeleteQueries(PIPE_QUERY_COUNT, pass->query);
+      glDeleteProgram(pass->program);
+    }
+  }
+  for (u32 i = 0; i < pipe->num_targets; ++i) {
+    glDeleteFramebuffers(1, &pipe->targets[i].fbo);
+    glDeleteTextures(1, &pipe->targets[i].tex);
+  }
+  glDeleteBuffers(1, &pipe->frame_ubo);
+  *pipe = { };
+}
+
+//
+// Keyframe index
+//
+// Timestamps of every keyframe in the video stream, found by demuxing the
+// whole file once on a background thread with its own format context. The
+// result is kept in a sidecar file next to the video, keyed by a hash of the
+// file's size and its first and last megabyte, so later opens load it
+// instantly. Seeks start decoding at the nearest keyframe before the target.
+//
+
+static u64 IDX_HashFile(const char* path) {
+  // SDL_IO sizes and offsets are 64-bit everywhere, unlike ftell's long
+  SDL_IOStream* file = SDL_IOFromFile(path, "rb");
+  if (!file) {
+    return 0;
+  }
+  const i64 size = (i64)SDL_GetIOSize(file);
+
+  // FNV-1a
+  u64 hash = 0xCBF29CE484222325ull;
+  auto mix = [&hash](const u8* data, usize len) {
+    for (usize i = 0; i < len; ++i) {
+      hash = (hash ^ data[i]) * 0x100000001B3ull;
+    }
+  };
+  mix((const u8*)&size, sizeof(size));
+  u8* chunk = MemAlloc<u8>(IDX_HASH_CHUNK);
+  mix(chunk, SDL_ReadIO(file, chunk, IDX_HASH_CHUNK));
+  if (size > (i64)IDX_HASH_CHUNK) {
+    SDL_SeekIO(file, Max(size - (i64)IDX_HASH_CHUNK, (i64)IDX_HASH_CHUNK), SDL_IO_SEEK_SET);
+    mix(chunk, SDL_ReadIO(file, chunk, IDX_HASH_CHUNK));
+  }
+  MemFree(chunk);
+  SDL_CloseIO(file);
+  return hash;
+}
+
+static void IDX_Push(KeyframeIndex* index, i64 pts) {
+  if (index->count == index->capacity) {
+    index->capacity = Max(index->capacity * 2, 256u);
+    i64* grown = MemAlloc<i64>(index->capacity);
+    if (index->count) {
+      std::memcpy(grown, index->pts, index->count * sizeof(i64));
+    }
+    MemFree(index->pts);
+    index->pts = grown;
+  }
+  // Keyframes arrive in decode order, which is nearly always ascending
+  u32 i = index->count++;
+  while (i > 0 && index->pts[i - 1] > pts) {
+    index->pts[i] = index->pts[i - 1];
+    --i;
+  }
+  index->pts[i] = pts;
+}
+
+static bool IDX_Load(KeyframeIndex* index) {
+  usize size = 0;
+  u8* data = (u8*)SDL_LoadFile(index->sidecar_path, &size);
+  if (!data) {
+    return false;
+  }
+  u32 header[5] = { };
+  bool valid = size >= sizeof(header);
+  if (valid) {
+    std::memcpy(header, data, sizeof(header));
+    const u64 key = (u64)header[1] | ((u64)header[2] << 32);
+    valid = header[0] == IDX_MAGIC && key == index->key && (int)header[3] == index->stream &&
+            size == sizeof(header) + (usize)header[4] * sizeof(i64);
+  }
+  if (valid) {
+    for (u32 i = 0; i < header[4]; ++i) {
+      i64 pts = 0;
+      std::memcpy(&pts, data + sizeof(header) + i * sizeof(i64), sizeof(pts));
+      IDX_Push(index, pts);
+    }
+  }
+  SDL_free(data);
+  return valid;
+}
+
+static void IDX_Save(const KeyframeIndex* index) {
+  FILE* file = std::fopen(index->sidecar_path, "wb");
+  if (!file) {
+    SDL_Log("Failed to write keyframe index %s", index->sidecar_path);
+    return;
+  }
+  const u32 header[5] = { IDX_MAGIC, (u32)index->key, (u32)(index->key >> 32), (u32)index->stream, index->count };
+  std::fwrite(header, sizeof(header), 1, file);
+  std::fwrite(index->pts, sizeof(i64), index->count, file);
+  std::fclose(file);
+}
+
+int SDLCALL IDX_BuildThread(void* userdata) {
+  KeyframeIndex* index = (KeyframeIndex*)userdata;
+  const u64 t0 = SDL_GetTicksNS();
+  index->key = IDX_HashFile(index->video_path);
+  if (IDX_Load(index)) {
+    SDL_Log("Loaded %u keyframes from %s", index->count, index->sidecar_path);
+    SDL_SetAtomicInt(&index->ready, 1);
+    return 0;
+  }
+
+  AV_FileInput input;
+  AVFormatContext* avfc = 0;
+  if (AV_FileInputOpen(&input, &avfc, index->video_path, index->input_mode) != 0) {
+    return 0;
+  }
+  AVPacket* pkt = av_packet_alloc();
+  assert(pkt);
+  bool complete = true;
+  while (av_read_frame(avfc, pkt) == 0) {
+    if (pkt->stream_index == index->stream && (pkt->flags & AV_PKT_FLAG_KEY)) {
+      IDX_Push(index, pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts);
+    }
+    av_packet_unref(pkt);
+    if (SDL_GetAtomicInt(&index->quit)) {
+      complete = false;
+      break;
+    }
+  }
+  av_packet_free(&pkt);
+  avformat_close_input(&avfc);
+  AV_FileInputClose(&input);
+  if (!complete) {
+    return 0;
+  }
+
+  SDL_Log("Indexed %u keyframes in %.1f ms", index->count, (f64)(SDL_GetTicksNS() - t0) / 1e6);
+  IDX_Save(index);
+  SDL_SetAtomicInt(&index->ready, 1);
+  return 0;
+}
+
+void IDX_Start(KeyframeIndex* index, const char* video_path, int stream, u8 input_mode) {
+  *index = { };
+  index->video_path = video_path;
+  index->stream = stream;
+  index->input_mode = input_mode;
+  SDL_snprintf(index->sidecar_path, sizeof(index->sidecar_path), "%s.kfidx", video_path);
+  index->thread = SDL_CreateThread(IDX_BuildThread, "vidshader_idx", index);
+  assert(index->thread);
+}
+
+void IDX_Stop(KeyframeIndex* index) {
+  if (!index->thread) {
+    return;
+  }
+  SDL_SetAtomicInt(&index->quit, 1);
+  SDL_WaitThread(index->thread, 0);
+  MemFree(index->pts);
+  *index = { };
+}
+
+// Latest keyframe at or before pts, or AV_NOPTS_VALUE while the index is
+// still being built
+i64 IDX_FindKeyframe(KeyframeIndex* index, i64 pts) {
+  if (!SDL_GetAtomicInt(&index->ready) || index->count == 0) {
+    return AV_NOPTS_VALUE;
+  }
+  u32 lo = 0;
+  u32 hi = index->count;
+  while (hi - lo > 1) {
+    const u32 mid = (lo + hi) / 2;
+    if (index->pts[mid] <= pts) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return index->pts[lo];
+}
+
+//
+// Audio
+//
+// The decoder thread hands audio packets to an audio thread, which decodes
+// and resamples them to float into a single producer, single consumer ring.
+// SDL's device callback drains the ring and publishes the media time of what
+// it just queued, and the render thread presents video against that clock.
+// Marks in a second ring tie ring positions to media time and loop, so the
+// clock follows loops and seeks the same way video frames do.
+//
+
+// Copies what the ring holds into the device stream, pads with silence and
+// updates the clock. Runs on SDL's audio thread.
+static void SDLCALL AUD_Callback(void* userdata, SDL_AudioStream* stream, int additional_amount, int total_amount) {
+  AudioPlayer* a = (AudioPlayer*)userdata;
+  const u32 frame_bytes = a->channels * sizeof(f32);
+  const u32 wanted = (u32)additional_amount / frame_bytes;
+
+  // Skip whatever was written before the last seek
+  u32 read = (u32)SDL_GetAtomicInt(&a->read_pos);
+  const u32 discard = (u32)SDL_GetAtomicInt(&a->discard_pos);
+  if ((i32)(discard - read) > 0) {
+    read = discard;
+    a->has_mark = false;
+  }
+
+  const u32 count = Min(wanted, (u32)SDL_GetAtomicInt(&a->write_pos) - read);
+  const u32 start = read % AUD_RING_FRAMES;
+  const u32 first = Min(count, AUD_RING_FRAMES - start);
+  SDL_PutAudioStreamData(stream, a->ring + start * a->channels, first * frame_bytes);
+  if (count > first) {
+    SDL_PutAudioStreamData(stream, a->ring, (count - first) * frame_bytes);
+  }
+  read += count;
+  SDL_SetAtomicInt(&a->read_pos, (int)read);
+
+  // Underrun: playing, but the ring ran dry
+  const bool starved = count < wanted;
+  if (starved && !a->starved && a->has_mark) {
+    SDL_AddAtomicInt(&a->underruns, 1);
+  }
+  a->starved = starved;
+  for (u32 left = wanted - count; left > 0;) {
+    const u32 n = Min(left, AUD_SILENCE_FRAMES);
+    SDL_PutAudioStreamData(stream, a->silence, n * frame_bytes);
+    left -= n;
+  }
+
+  // Last mark at or before the samples just queued
+  u32 mark_read = (u32)SDL_GetAtomicInt(&a->mark_read);
+  const u32 mark_write = (u32)SDL_GetAtomicInt(&a->mark_write);
+  while (mark_read != mark_write && (i32)(a->marks[mark_read % AUD_MARK_COUNT].pos - read) < 0) {
+    const AudioMark* mark = &a->marks[mark_read % AUD_MARK_COUNT];
+    if ((i32)(mark->pos - discard) >= 0) {
+      a->mark = *mark;
+      a->has_mark = true;
+    }
+    ++mark_read;
+  }
+  SDL_SetAtomicInt(&a->mark_read, (int)mark_read);
+
+  // Silence stops the clock, so video falls back to the wall clock rather
+  // than freezing when audio ends early or stalls
+  const f64 t = a->mark.t + (f64)(read - a->mark.pos) / a->rate;
+  const f64 delay = (f64)SDL_GetAudioStreamQueued(stream) / frame_bytes / a->rate + a->device_latency;
+  SDL_LockSpinlock(&a->clock_lock);
+  a->clock_valid = a->has_mark && !starved;
+  a->clock_t = t;
+  a->clock_loop = a->mark.loop;
+  a->clock_ns = SDL_GetTicksNS();
+  a->clock_delay = delay;
+  SDL_UnlockSpinlock(&a->clock_lock);
+}
+
+// Resample one decoded frame into the ring, waiting for the device to make
+// room. Gives up on the rest of the frame when a seek or quit comes in.
+static void AUD_WriteFrame(AudioPlayer* a, u32 loop, f64 t) {
+  const int max_out = swr_get_out_samples(a->swr, a->frame->nb_samples);
+  if (max_out > a->convert_frames) {
+    MemFree(a->convert_buf);
+    a->convert_frames = max_out;
+    a->convert_buf = MemAlloc<f32>((usize)max_out * a->channels);
+  }
+  u8* out = (u8*)a->convert_buf;
+  int n = swr_convert(a->swr, &out, max_out, (const u8**)a->frame->extended_data, a->frame->nb_samples);
+  if (n <= 0) {
+    return;
+  }
+
+  // Audio from the keyframe before a seek target is not played
+  const f32* samples = a->convert_buf;
+  if (t < a->skip_t) {
+    const int skip = Min(n, (int)((a->skip_t - t) * a->rate));
+    samples += skip * a->channels;
+    n -= skip;
+    t += (f64)skip / a->rate;
+    if (n == 0) {
+      return;
+    }
+  }
+  a->skip_t = -1.0;
+
+  const u32 pos = (u32)SDL_GetAtomicInt(&a->write_pos);
+  const u32 mark_write = (u32)SDL_GetAtomicInt(&a->mark_write);
+  if (mark_write - (u32)SDL_GetAtomicInt(&a->mark_read) < AUD_MARK_COUNT) {
+    a->marks[mark_write % AUD_MARK_COUNT] = { pos, loop, t };
+    SDL_SetAtomicInt(&a->mark_write, (int)(mark_write + 1));
+  }
+
+  u32 written = 0;
+  while (written < (u32)n) {
+    const u32 write = pos + written;
+    const u32 space = AUD_RING_FRAMES - (write - (u32)SDL_GetAtomicInt(&a->read_pos));
+    if (space == 0) {
+      SDL_LockMutex(a->mtx);
+      if (!a->quit && !a->flush) {
+        SDL_WaitConditionTimeout(a->cond, a->mtx, AUD_WAIT_MS);
+      }
+      const bool stop = a->quit || a->flush;
+      SDL_UnlockMutex(a->mtx);
+      if (stop) {
+        return;
+      }
+      continue;
+    }
+    const u32 count = Min(space, (u32)n - written);
+    const u32 start = write % AUD_RING_FRAMES;
+    const u32 first = Min(count, AUD_RING_FRAMES - start);
+    SDL_memcpy(a->ring + start * a->channels, samples + written * a->channels, first * a->channels * sizeof(f32));
+    SDL_memcpy(a->ring, samples + (written + first) * a->channels, (count - first) * a->channels * sizeof(f32));
+    written += count;
+    SDL_SetAtomicInt(&a->write_pos, (int)(pos + written));
+  }
+}
+
+static int SDLCALL AUD_AudioThread(void* userdata) {
+  AudioPlayer* a = (AudioPlayer*)userdata;
+  const f64 time_base = av_q2d(g.avfc->streams[a->stream_index]->time_base);
+  f64 next_t = 0.0;
+  while (true) {
+    SDL_LockMutex(a->mtx);
+    while (a->count == 0 && !a->quit && !a->flush) {
+      SDL_WaitCondition(a->cond, a->mtx);
+    }
+    if (a->quit) {
+      SDL_UnlockMutex(a->mtx);
+      break;
+    }
+    const bool flush = a->flush;
+    const u32 min_loop = a->min_loop;
+    const f64 start_t = a->start_t;
+    a->flush = false;
+    const bool got_packet = a->count > 0;
+    u32 loop = 0;
+    if (got_packet) {
+      av_packet_move_ref(a->pkt, a->packets[a->head]);
+      loop = a->packet_loops[a->head];
+      a->head = (a->head + 1) % AUD_PACKET_QUEUE;
+      --a->count;
+      SDL_BroadcastCondition(a->cond);
+    }
+    SDL_UnlockMutex(a->mtx);
+
+    if (flush) {
+      // swr_init drops any samples buffered for resampling
+      avcodec_flush_buffers(a->avcc);
+      swr_init(a->swr);
+      SDL_SetAtomicInt(&a->discard_pos, SDL_GetAtomicInt(&a->write_pos));
+      a->skip_t = start_t;
+    }
+    if (!got_packet) {
+      continue;
+    }
+    if (loop < min_loop) {
+      av_packet_unref(a->pkt);
+      continue;
+    }
+
+    // Damaged packets are skipped rather than stopping audio
+    const int ret = avcodec_send_packet(a->avcc, a->pkt);
+    av_packet_unref(a->pkt);
+    if (ret < 0) {
+      continue;
+    }
+    while (avcodec_receive_frame(a->avcc, a->frame) == 0) {
+      const i64 pts = a->frame->best_effort_timestamp;
+      const f64 t = pts != AV_NOPTS_VALUE ? pts * time_base - a->start_offset : next_t;
+      next_t = t + (f64)a->frame->nb_samples / a->frame->sample_rate;
+      AUD_WriteFrame(a, loop, t);
+      av_frame_unref(a->frame);
+    }
+  }
+  return 0;
+}
+
+// Opens the best audio stream and the default playback device. Returns false,
+// leaving video on the wall clock, when there is no audio to play.
+bool AUD_Start(AudioPlayer* a) {
+  *a = { };
+  a->stream_index = -1;
+  const AVCodec* avc = 0;
+  const int index = av_find_best_stream(g.avfc, AVMEDIA_TYPE_AUDIO, -1, g.avfc_video_stream, &avc, 0);
+  if (index < 0 || !avc) {
+    return false;
+  }
+  if (!SDL_InitSubSystem(SDL_INIT_AUDIO)) {
+    SDL_Log("Failed to initialize SDL audio: %s", SDL_GetError());
+    return false;
+  }
+
+  const AVStream* avs = g.avfc->streams[index];
+  a->avcc = avcodec_alloc_context3(avc);
+  assert(a->avcc);
+  int ret = avcodec_parameters_to_context(a->avcc, avs->codecpar);
+  assert(ret == 0);
+  a->avcc->pkt_timebase = avs->time_base;
+  ret = avcodec_open2(a->avcc, avc, 0);
+  assert(ret == 0);
+
+  a->rate = a->avcc->sample_rate;
+  a->channels = Clamp((u32)a->avcc->ch_layout.nb_channels, 1u, AUD_MAX_CHANNELS);
+  AVChannelLayout out_layout = { };
+  av_channel_layout_default(&out_layout, a->channels);
+  ret = swr_alloc_set_opts2(&a->swr, &out_layout, AV_SAMPLE_FMT_FLT, a->rate,
+                            &a->avcc->ch_layout, a->avcc->sample_fmt, a->avcc->sample_rate, 0, 0);
+  assert(ret >= 0);
+  ret = swr_init(a->swr);
+  assert(ret >= 0);
+  av_channel_layout_uninit(&out_layout);
+
+  const SDL_AudioSpec spec = { SDL_AUDIO_F32, (int)a->channels, (int)a->rate };
+  a->stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, AUD_Callback, a);
+  if (!a->stream) {
+    SDL_Log("Failed to open audio device: %s", SDL_GetError());
+    swr_free(&a->swr);
+    avcodec_free_context(&a->avcc);
+    return false;
+  }
+  SDL_AudioSpec device_spec = { };
+  int device_frames = 0;
+  if (SDL_GetAudioDeviceFormat(SDL_GetAudioStreamDevice(a->stream), &device_spec, &device_frames) && device_spec.freq > 0) {
+    a->device_latency = (f64)device_frames / device_spec.freq;
+  }
+
+  const AVStream* video = g.avfc->streams[g.avfc_video_stream];
+  a->start_offset = video->start_time != AV_NOPTS_VALUE ? video->start_time * av_q2d(video->time_base) : 0.0;
+  a->stream_index = index;
+  for (u32 i = 0; i < AUD_PACKET_QUEUE; ++i) {
+    a->packets[i] = av_packet_alloc();
+    assert(a->packets[i]);
+  }
+  a->pkt = av_packet_alloc();
+  a->frame = av_frame_alloc();
+  assert(a->pkt && a->frame);
+  a->ring = MemAllocZ<f32>((usize)AUD_RING_FRAMES * a->channels);
+  a->silence = MemAllocZ<f32>((usize)AUD_SILENCE_FRAMES * a->channels);
+  a->skip_t = -1.0;
+  a->mtx = SDL_CreateMutex();
+  a->cond = SDL_CreateCondition();
+  a->thread = SDL_CreateThread(AUD_AudioThread, "vidshader_audio", a);
+  assert(a->mtx && a->cond && a->thread);
+
+  SDL_Log("Audio: %s, %u Hz, %u channels, %.1f ms device buffer", avc->long_name, a->rate, a->channels,
+    a->device_latency * 1e3);
+  SDL_ResumeAudioStreamDevice(a->stream);
+  return true;
+}
+
+// Called by the decoder thread for every packet of the audio stream. Blocks
+// while the queue is full.
+void AUD_PushPacket(AudioPlayer* a, AVPacket* pkt, u32 loop) {
+  SDL_LockMutex(a->mtx);
+  while (a->count == AUD_PACKET_QUEUE && !a->quit) {
+    SDL_WaitCondition(a->cond, a->mtx);
+  }
+  if (!a->quit) {
+    const u32 slot = (a->head + a->count) % AUD_PACKET_QUEUE;
+    av_packet_move_ref(a->packets[slot], pkt);
+    a->packet_loops[slot] = loop;
+    ++a->count;
+    SDL_BroadcastCondition(a->cond);
+  }
+  SDL_UnlockMutex(a->mtx);
+}
+
+// Drop everything queued and restart at media time t, where the decoder
+// numbers its frames from loop
+void AUD_Flush(AudioPlayer* a, u32 loop, f64 t) {
+  if (!a->stream) {
+    return;
+  }
+  SDL_LockMutex(a->mtx);
+  while (a->count > 0) {
+    av_packet_unref(a->packets[a->head]);
+    a->head = (a->head + 1) % AUD_PACKET_QUEUE;
+    --a->count;
+  }
+  a->flush = true;
+  a->min_loop = loop;
+  a->start_t = t;
+  SDL_BroadcastCondition(a->cond);
+  SDL_UnlockMutex(a->mtx);
+
+  SDL_ClearAudioStream(a->stream);
+  SDL_LockSpinlock(&a->clock_lock);
+  a->clock_valid = false;
+  SDL_UnlockSpinlock(&a->clock_lock);
+}
+
+void AUD_SetPaused(AudioPlayer* a, bool paused) {
+  if (!a->stream) {
+    return;
+  }
+  if (paused) {
+    SDL_PauseAudioStreamDevice(a->stream);
+  } else {
+    // The clock restarts with the next callback
+    SDL_LockSpinlock(&a->clock_lock);
+    a->clock_valid = false;
+    SDL_UnlockSpinlock(&a->clock_lock);
+    SDL_ResumeAudioStreamDevice(a->stream);
+  }
+}
+
+// Media time being heard right now and the loop it belongs to. False until
+// the device has played something since the last seek or resume.
+bool AUD_Clock(AudioPlayer* a, f64* t, u32* loop) {
+  if (!a->stream) {
+    return false;
+  }
+  SDL_LockSpinlock(&a->clock_lock);
+  const bool valid = a->clock_valid;
+  const f64 clock_t = a->clock_t;
+  const u32 clock_loop = a->clock_loop;
+  const u64 clock_ns = a->clock_ns;
+  const f64 delay = a->clock_delay;
+  SDL_UnlockSpinlock(&a->clock_lock);
+  if (!valid) {
+    return false;
+  }
+  // Queued samples play out between callbacks
+  const f64 elapsed = Min((f64)(SDL_GetTicksNS() - clock_ns) / (f64)SDL_NS_PER_SECOND, delay);
+  *t = clock_t - delay + elapsed;
+  *loop = clock_loop;
+  return true;
+}
+
+// Positive offsets are video frames shown ahead of their audio
+void AUD_RecordOffset(AudioPlayer* a, f64 offset) {
+  const f64 offset_ms = offset * 1e3;
+  a->offset_ms_avg = a->offset_ms_avg * 0.95 + offset_ms * 0.05;
+  a->offset_ms_max = Max(a->offset_ms_max, SDL_fabs(offset_ms));
+}
+
+// Stops the audio thread and device. The packet queue stays usable until
+// AUD_Free, so the decoder thread can still be running.
+void AUD_Stop(AudioPlayer* a) {
+  if (!a->thread) {
+    return;
+  }
+  SDL_LockMutex(a->mtx);
+  a->quit = true;
+  SDL_BroadcastCondition(a->cond);
+  SDL_UnlockMutex(a->mtx);
+  SDL_WaitThread(a->thread, 0);
+  a->thread = 0;
+  SDL_DestroyAudioStream(a->stream);
+  a->stream = 0;
+  SDL_Log("Audio: %d underruns, A/V offset avg %+.1f ms, max %.1f ms", SDL_GetAtomicInt(&a->underruns),
+    a->offset_ms_avg, a->offset_ms_max);
+}
+
+void AUD_Free(AudioPlayer* a) {
+  if (!a->mtx) {
+    return;
+  }
+  for (u32 i = 0; i < AUD_PACKET_QUEUE; ++i) {
+    av_packet_free(&a->packets[i]);
+  }
+  av_packet_free(&a->pkt);
+  av_frame_free(&a->frame);
+  swr_free(&a->swr);
+  avcodec_free_context(&a->avcc);
+  MemFree(a->convert_buf);
+  MemFree(a->silence);
+  MemFree(a->ring);
+  SDL_DestroyCondition(a->cond);
+  SDL_DestroyMutex(a->mtx);
+  *a = { };
+  a->stream_index = -1;
+}
+
+//
+// Decoder
+//
+// A decoder thread demuxes and decodes ahead of playback into a bounded ring
+// of frames. The render thread only picks the frame due at the current
+// presentation time, so a slow packet or keyframe is absorbed by the frames
+// already decoded instead of stalling the display.
+//
+
+// Decode the next frame into dec->decoded, looping back to the start at the
+// end of the stream. Returns false at the end when not looping.
+static bool DEC_DecodeFrame(Decoder* dec) {
+  while (true) {
+    int ret = avcodec_receive_frame(g.avcc, dec->decoded);
+    if (ret == 0) {
+      return true;
+    }
+    if (ret == AVERROR_EOF) {
+      if (dec->once) {
+        return false;
+      }
+      // Drained, start the next loop
+      avcodec_flush_buffers(g.avcc);
+      ret = av_seek_frame(g.avfc, g.avfc_video_stream, dec->start_pts, AVSEEK_FLAG_BACKWARD);
+      assert(ret >= 0);
+      ++dec->loop;
+      dec->skipping = false;
+      continue;
+    }
+    assert(ret == AVERROR(EAGAIN));
+
+    ret = av_read_frame(g.avfc, dec->pkt);
+    if (ret == AVERROR_EOF) {
+      // Flush the frames still buffered in the decoder
+      ret = avcodec_send_packet(g.avcc, 0);
+      assert(ret >= 0);
+      continue;
+    }
+    assert(ret == 0);
+    if (dec->pkt->stream_index == g.avfc_video_stream) {
+      ret = avcodec_send_packet(g.avcc, dec->pkt);
+      assert(ret >= 0);
+    } else if (g.audio.avcc && dec->pkt->stream_index == g.audio.stream_index) {
+      AUD_PushPacket(&g.audio, dec->pkt, dec->loop);
+    }
+    av_packet_unref(dec->pkt);
+  }
+}
+
+// Restart decoding at the keyframe before t, on the decoder thread
+static void DEC_SeekTo(Decoder* dec, f64 t) {
+  const AVStream* avs = g.avfc->streams[g.avfc_video_stream];
+  const i64 target = dec->start_pts + (i64)(t / av_q2d(avs->time_base));
+  const i64 keyframe = IDX_FindKeyframe(&g.index, target);
+  int ret = av_seek_frame(g.avfc, g.avfc_video_stream, keyframe != AV_NOPTS_VALUE ? keyframe : target, AVSEEK_FLAG_BACKWARD);
+  if (ret < 0) {
+    ret = av_seek_frame(g.avfc, g.avfc_video_stream, dec->start_pts, AVSEEK_FLAG_BACKWARD);
+    assert(ret >= 0);
+  }
+  avcodec_flush_buffers(g.avcc);
+  dec->skipping = true;
+  dec->skip_t = t;
+}
+
+int SDLCALL DEC_DecoderThread(void* userdata) {
+  Decoder* dec = (Decoder*)userdata;
+  const AVStream* avs = g.avfc->streams[g.avfc_video_stream];
+  while (true) {
+    SDL_LockMutex(dec->mtx);
+    while (dec->count == dec->depth && !dec->quit && !dec->seek_pending) {
+      SDL_WaitCondition(dec->cond, dec->mtx);
+    }
+    const bool quit = dec->quit;
+    const bool seek = dec->seek_pending;
+    const f64 seek_t = dec->seek_t;
+    dec->seek_pending = false;
+    if (seek) {
+      dec->loop = dec->seek_loop;
+    }
+    SDL_UnlockMutex(dec->mtx);
+    if (quit) {
+      break;
+    }
+    if (seek) {
+      DEC_SeekTo(dec, seek_t);
+    }
+
+    const u64 t0 = SDL_GetTicksNS();
+    if (!DEC_DecodeFrame(dec)) {
+      SDL_LockMutex(dec->mtx);
+      dec->eof = true;
+      SDL_BroadcastCondition(dec->cond);
+      SDL_UnlockMutex(dec->mtx);
+      break;
+    }
+    const u64 decode_ns = SDL_GetTicksNS() - t0;
+    const f64 decode_ms = (f64)decode_ns / 1e6;
+    i64 pts = dec->decoded->best_effort_timestamp;
+    if (pts == AV_NOPTS_VALUE) {
+      pts = dec->start_pts;
+    }
+    const f64 t = (f64)(pts - dec->start_pts) * av_q2d(avs->time_base);
+
+    // Decoding from the keyframe before a seek target, or a newer seek came
+    // in while this frame was decoding
+    SDL_LockMutex(dec->mtx);
+    if ((dec->skipping && t + g.frame_dur <= dec->skip_t) || dec->seek_pending) {
+      SDL_UnlockMutex(dec->mtx);
+      av_frame_unref(dec->decoded);
+      continue;
+    }
+    dec->skipping = false;
+    DecodedFrame* slot = &dec->ring[(dec->head + dec->count) % dec->depth];
+    av_frame_move_ref(slot->frame, dec->decoded);
+    slot->t = t;
+    slot->loop = dec->loop;
+    ++dec->count;
+    dec->decode_ms_last = decode_ms;
+    dec->decode_ms_avg = dec->decode_ms_avg * 0.95 + decode_ms * 0.05;
+    ++dec->frames_decoded;
+    dec->busy_ns += decode_ns;
+    SDL_BroadcastCondition(dec->cond);
+    SDL_UnlockMutex(dec->mtx);
+  }
+  return 0;
+}
+
+// Frames per second the decoder manages while it is not waiting on the ring,
+// i.e. what it could sustain unthrottled
+static f64 DEC_Throughput(const Decoder* dec) {
+  return dec->busy_ns ? (f64)dec->frames_decoded * (f64)SDL_NS_PER_SECOND / (f64)dec->busy_ns : 0.0;
+}
+
+static const char* DEC_ThreadTypeName(int thread_type) {
+  switch (thread_type) {
+  case FF_THREAD_FRAME: return "frame threads";
+  case FF_THREAD_SLICE: return "slice threads";
+  default: return "single threaded";
+  }
+}
+
+// Apply threading and preview options before avcodec_open2
+void DEC_Configure(AVCodecContext* avcc, const DecodeOptions* opts) {
+  avcc->thread_count = opts->threads;
+  avcc->thread_type = opts->thread_type;
+  avcc->lowres = Min(opts->lowres, (int)avcc->codec->max_lowres);
+  if (avcc->lowres != opts->lowres) {
+    SDL_Log("Decoder supports lowres up to %d", (int)avcc->codec->max_lowres);
+  }
+  avcc->skip_loop_filter = opts->skip_loop_filter;
+}
+
+void DEC_Start(u32 depth, bool once) {
+  Decoder* dec = &g.dec;
+  const AVStream* avs = g.avfc->streams[g.avfc_video_stream];
+  dec->depth = depth;
+  dec->once = once;
+  dec->start_pts = avs->start_time != AV_NOPTS_VALUE ? avs->start_time : 0;
+  for (u32 i = 0; i < depth; ++i) {
+    dec->ring[i].frame = av_frame_alloc();
+    assert(dec->ring[i].frame);
+  }
+  dec->pkt = av_packet_alloc();
+  dec->decoded = av_frame_alloc();
+  assert(dec->pkt && dec->decoded);
+
+  dec->mtx = SDL_CreateMutex();
+  dec->cond = SDL_CreateCondition();
+  dec->thread = SDL_CreateThread(DEC_DecoderThread, "vidshader_dec", dec);
+  assert(dec->mtx && dec->cond && dec->thread);
+}
+
+void DEC_Stop() {
+  Decoder* dec = &g.dec;
+  if (!dec->thread) {
+    return;
+  }
+  SDL_LockMutex(dec->mtx);
+  dec->quit = true;
+  SDL_BroadcastCondition(dec->cond);
+  SDL_UnlockMutex(dec->mtx);
+  SDL_WaitThread(dec->thread, 0);
+
+  SDL_Log("Decoded %llu frames at %.1f fps while busy (%d threads, %s)", (unsigned long long)dec->frames_decoded,
+    DEC_Throughput(dec), g.avcc->thread_count, DEC_ThreadTypeName(g.avcc->active_thread_type));
+
+  for (u32 i = 0; i < dec->depth; ++i) {
+    av_frame_free(&dec->ring[i].frame);
+  }
+  av_frame_free(&dec->decoded);
+  av_packet_free(&dec->pkt);
+  SDL_DestroyCondition(dec->cond);
+  SDL_DestroyMutex(dec->mtx);
+  *dec = { };
+}
+
+// Move the newest frame that is due at the current media time into
+// g.current, skipping any that are already late. Returns whether it changed.
+bool DEC_PickFrame() {
+  Decoder* dec = &g.dec;
+  bool picked = false;
+  SDL_LockMutex(dec->mtx);
+  while (dec->count > 0) {
+    DecodedFrame* next = &dec->ring[dec->head];
+    if (next->loop != g.clock_loop) {
+      // Let the last frame of the previous loop run out, then restart the
+      // clock at the first frame of the next one
+      if (g.media_t < g.current_t + g.frame_dur) {
+        break;
+      }
+      g.clock_loop = next->loop;
+      g.media_t = next->t;
+    }
+    if (next->t > g.media_t) {
+      break;
+    }
+    if (picked) {
+      ++g.dropped;
+    }
+    av_frame_unref(g.current);
+    av_frame_move_ref(g.current, next->frame);
+    g.current_t = next->t;
+    dec->head = (dec->head + 1) % dec->depth;
+    --dec->count;
+    picked = true;
+  }
+  const u32 ahead = dec->count;
+  if (picked) {
+    SDL_BroadcastCondition(dec->cond);
+  }
+  SDL_UnlockMutex(dec->mtx);
+
+  // Underrun: the frame on screen has run out and nothing is decoded yet
+  const bool starved = ahead == 0 && g.current->buf[0] && g.media_t >= g.current_t + g.frame_dur;
+  if (starved && !g.starved) {
+    ++g.underruns;
+  }
+  g.starved = starved;
+  if (picked) {
+    ++g.presented;
+  } else if (g.current->buf[0]) {
+    ++g.repeated;
+  }
+  return picked;
+}
+
+// Wait for the next frame in decode order and move it into out. Returns
+// false once a decoder that stops at the end has no frames left.
+bool DEC_NextFrame(AVFrame* out, f64* t) {
+  Decoder* dec = &g.dec;
+  SDL_LockMutex(dec->mtx);
+  while (dec->count == 0 && !dec->eof) {
+    SDL_WaitCondition(dec->cond, dec->mtx);
+  }
+  const bool got_frame = dec->count > 0;
+  if (got_frame) {
+    DecodedFrame* next = &dec->ring[dec->head];
+    av_frame_unref(out);
+    av_frame_move_ref(out, next->frame);
+    *t = next->t;
+    dec->head = (dec->head + 1) % dec->depth;
+    --dec->count;
+    SDL_BroadcastCondition(dec->cond);
+  }
+  SDL_UnlockMutex(dec->mtx);
+  return got_frame;
+}
+
+// Drop everything decoded so far and restart from the frame showing at t
+void DEC_Seek(f64 t) {
+  Decoder* dec = &g.dec;
+  // Some containers do not know their duration
+  const f64 last_t = g.duration > 0.0 ? g.duration - g.frame_dur : 1e12;
+  t = Clamp(t, 0.0, Max(last_t, 0.0));
+  SDL_LockMutex(dec->mtx);
+  while (dec->count > 0) {
+    av_frame_unref(dec->ring[dec->head].frame);
+    dec->head = (dec->head + 1) % dec->depth;
+    --dec->count;
+  }
+  dec->seek_pending = true;
+  dec->seek_t = t;
+  dec->seek_loop = ++g.clock_loop;
+  SDL_BroadcastCondition(dec->cond);
+  SDL_UnlockMutex(dec->mtx);
+  AUD_Flush(&g.audio, dec->seek_loop, t);
+
+  // Show the new position as soon as it is decoded, even while paused
+  g.media_t = t;
+  g.seek_show = true;
+  g.resume_seek = false;
+}
+
+// Playback stats in the window title, a few times a second
+void DEC_ShowStats() {
+  const u64 now = SDL_GetTicksNS();
+  if (now - g.title_ns < 250 * SDL_NS_PER_MS) {
+    return;
+  }
+  g.title_ns = now;
+
+  Decoder* dec = &g.dec;
+  SDL_LockMutex(dec->mtx);
+  const u32 ahead = dec->count;
+  const f64 decode_ms_last = dec->decode_ms_last;
+  const f64 decode_ms_avg = dec->decode_ms_avg;
+  const f64 decode_fps = DEC_Throughput(dec);
+  SDL_UnlockMutex(dec->mtx);
+
+  // Packets, frames and pixel buffers are allocated once up front, so only
+  // new decoder buffers can allocate during playback
+  const u32 allocs = (u32)SDL_GetAtomicInt(&g.dec_buffers.buffers_allocated);
+
+  char title[512] = { };
+  SDL_snprintf(title, sizeof(title), "vidshader - %.2f/%.2f s, %llu shown, %llu dropped, %llu repeated, ahead %u/%u, %u underruns, "
+    "decode %.2f ms (avg %.2f ms, %.0f fps), %u buffer allocations", g.current_t, g.duration, (unsigned long long)g.presented, (unsigned long long)g.dropped,
+    (unsigned long long)g.repeated, ahead, dec->depth, g.underruns, decode_ms_last, decode_ms_avg, decode_fps, allocs);
+  if (g.audio.stream) {
+    const usize len = SDL_strlen(title);
+    SDL_snprintf(title + len, sizeof(title) - len, ", audio %d underruns, A/V %+.1f ms (max %.1f ms)",
+      SDL_GetAtomicInt(&g.audio.underruns), g.audio.offset_ms_avg, g.audio.offset_ms_max);
+  }
+  PIPE_FormatStats(&g.pipe, title, sizeof(title));
+  SDL_SetWindowTitle(g.wnd, title);
+}
+
+// Decoders may change resolution or pixel format mid-stream. Textures and
+// converters keep the geometry they were set up with, so frames that no
+// longer match it are scaled back to it.
+const AVFrame* DEC_ConformFrame(const AVFrame* frame) {
+  const int w = (int)g.resolution.x;
+  const int h = (int)g.resolution.y;
+  if (frame->width == w && frame->height == h && frame->format == g.frame_fmt) {
+    return frame;
+  }
+  if (!g.conformed) {
+    g.conformed = av_frame_alloc();
+    assert(g.conformed);
+    g.conformed->width = w;
+    g.conformed->height = h;
+    g.conformed->format = g.frame_fmt;
+    const int ret = av_frame_get_buffer(g.conformed, 0);
+    assert(ret == 0);
+  }
+  SwsContext* prev = g.conform_sws;
+  g.conform_sws = sws_getCachedContext(g.conform_sws, frame->width, frame->height, (AVPixelFormat)frame->format,
+                                       w, h, g.frame_fmt, SWS_BILINEAR, 0, 0, 0);
+  assert(g.conform_sws);
+  if (g.conform_sws != prev) {
+    SDL_Log("Frames changed to %dx%d %s, scaling them to %dx%d %s", frame->width, frame->height,
+      av_get_pix_fmt_name((AVPixelFormat)frame->format), w, h, av_get_pix_fmt_name(g.frame_fmt));
+  }
+  sws_scale(g.conform_sws, frame->data, frame->linesize, 0, frame->height, g.conformed->data, g.conformed->linesize);
+  return g.conformed;
+}
+
+//
+// Navigation
+//
+// Seeks go through the decoder, which restarts at the nearest keyframe. The
+// last few frames shown are kept in a small LRU cache of frame references,
+// so stepping back over them just re-uploads a frame. Once playback resumes
+// after such a step, the decoder is moved to the frame on screen.
+//
+
+void FC_Put(FrameCache* cache, const AVFrame* frame, f64 t) {
+  CachedFrame* victim = &cache->entries[0];
+  for (u32 i = 0; i < FC_SIZE; ++i) {
+    CachedFrame* entry = &cache->entries[i];
+    if (entry->frame && entry->t == t) {
+      entry->last_used = ++cache->clock;
+      return;
+    }
+    if (entry->last_used < victim->last_used) {
+      victim = entry;
+    }
+  }
+  if (!victim->frame) {
+    victim->frame = av_frame_alloc();
+    assert(victim->frame);
+  }
+  av_frame_unref(victim->frame);
+  int ret = av_frame_ref(victim->frame, frame);
+  assert(ret >= 0);
+  victim->t = t;
+  victim->last_used = ++cache->clock;
+}
+
+// Show the cached frame covering t, if there is one
+bool FC_Show(FrameCache* cache, f64 t) {
+  for (u32 i = 0; i < FC_SIZE; ++i) {
+    CachedFrame* entry = &cache->entries[i];
+    if (entry->last_used && SDL_fabs(entry->t - t) < g.frame_dur * 0.5) {
+      entry->last_used = ++cache->clock;
+      av_frame_unref(g.current);
+      int ret = av_frame_ref(g.current, entry->frame);
+      assert(ret >= 0);
+      g.current_t = entry->t;
+      g.media_t = entry->t;
+      TEX_Upload(&g.stream, DEC_ConformFrame(g.current), &g.conv);
+      return true;
+    }
+  }
+  return false;
+}
+
+void FC_Free(FrameCache* cache) {
+  for (u32 i = 0; i < FC_SIZE; ++i) {
+    av_frame_free(&cache->entries[i].frame);
+  }
+  *cache = { };
+}
+
+// Pause and move one frame forwards or backwards
+void NAV_Step(i32 dir) {
+  g.paused = true;
+  const f64 t = g.current_t + dir * g.frame_dur;
+  if (FC_Show(&g.cache, t)) {
+    g.resume_seek = true;
+  } else if (dir < 0 || g.resume_seek) {
+    DEC_Seek(t);
+  } else {
+    // The next frame is normally decoded already
+    g.media_t = t;
+    g.seek_show = true;
+  }
+}
+
+void NAV_SetPaused(bool paused) {
+  g.paused = paused;
+  AUD_SetPaused(&g.audio, paused);
+  if (!paused && g.resume_seek) {
+    DEC_Seek(g.current_t);
+  }
+}
+
+void NAV_Scrub(f32 x) {
+  int w = 0;
+  int h = 0;
+  SDL_GetWindowSize(g.wnd, &w, &h);
+  DEC_Seek(Clamp(x / Max(w, 1), 0.0f, 1.0f) * g.duration);
+}
+
+//
+// Offline render
+//
+// Renders every decoded frame through the shader pipeline into an offscreen
+// framebuffer and encodes the result, as fast as decode, render and encode
+// allow. Readback goes through a ring of pixel pack buffers so the GPU is a
+// couple of frames ahead of the CPU, and an encoder thread takes converted
+// frames from a bounded queue. Only needs a hidden window, so Mesa's software
+// rasterizer (LIBGL_ALWAYS_SOFTWARE=1) works on machines without a GPU.
+//
+
+static void OFF_WritePackets(OfflineRender* off) {
+  while (true) {
+    int ret = avcodec_receive_packet(off->avcc, off->pkt);
+    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+      return;
+    }
+    assert(ret >= 0);
+    av_packet_rescale_ts(off->pkt, off->avcc->time_base, off->avst->time_base);
+    off->pkt->stream_index = off->avst->index;
+    ret = av_interleaved_write_frame(off->avfc, off->pkt);
+    assert(ret >= 0);
+  }
+}
+
+int SDLCALL OFF_EncoderThread(void* userdata) {
+  OfflineRender* off = (OfflineRender*)userdata;
+  SDL_LockMutex(off->mtx);
+  while (true) {
+    while (off->count == 0 && !off->quit) {
+      SDL_WaitCondition(off->cond, off->mtx);
+    }
+    if (off->count == 0) {
+      break;
+    }
+    AVFrame* frame = off->queue[off->head];
+    SDL_UnlockMutex(off->mtx);
 
-layout (location = 0) in vec2 v_position;
-layout (location = 1) in vec2 v_texcoord;
+    int ret = avcodec_send_frame(off->avcc, frame);
+    assert(ret >= 0);
+    av_frame_unref(frame);
+    OFF_WritePackets(off);
+    ++off->frames_encoded;
 
-out vec2 texcoord;
+    SDL_LockMutex(off->mtx);
+    off->head = (off->head + 1) % OFF_QUEUE_SIZE;
+    --off->count;
+    SDL_BroadcastCondition(off->cond);
+  }
+  SDL_UnlockMutex(off->mtx);
 
-void main() {
-  texcoord = vec2(v_texcoord.x, 1.0f - v_texcoord.y);
-  gl_Position = vec4(v_position.x, v_position.y, -1.0f, 1.0f);
+  // Drain the encoder
+  int ret = avcodec_send_frame(off->avcc, 0);
+  assert(ret >= 0);
+  OFF_WritePackets(off);
+  return 0;
 }
-)""";
 
-const char* DEFAULT_FRAGMENT_SHADER = R"""(#version 330 core
+// Hand a frame to the encoder thread, waiting while the queue is full
+static void OFF_Push(OfflineRender* off, const AVFrame* frame) {
+  SDL_LockMutex(off->mtx);
+  while (off->count == OFF_QUEUE_SIZE) {
+    SDL_WaitCondition(off->cond, off->mtx);
+  }
+  int ret = av_frame_ref(off->queue[(off->head + off->count) % OFF_QUEUE_SIZE], frame);
+  assert(ret >= 0);
+  ++off->count;
+  SDL_BroadcastCondition(off->cond);
+  SDL_UnlockMutex(off->mtx);
+}
 
-in vec2 texcoord;
+static GLuint OFF_CreateTarget(u32 w, u32 h, GLuint* texture) {
+  glGenTextures(1, texture);
+  glBindTexture(GL_TEXTURE_2D, *texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  GLuint fbo = 0;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *texture, 0);
+  assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  return fbo;
+}
 
-out vec4 color;
+// Frames filtered on the CPU skip the GL targets and go straight to the
+// encoder
+void OFF_Begin(const char* out_path, i64 bit_rate, bool readback) {
+  OfflineRender* off = &g.off;
+  const AVStream* avs = g.avfc->streams[g.avfc_video_stream];
+  off->w = (u32)g.resolution.x & ~1u;
+  off->h = (u32)g.resolution.y & ~1u;
 
-uniform sampler2D u_sampler;
+  // Render targets and readback buffers
+  if (readback) {
+    off->render_fbo = OFF_CreateTarget(off->w, off->h, &off->render_tex);
+    off->read_fbo = OFF_CreateTarget(off->w, off->h, &off->read_tex);
+    glGenBuffers(OFF_READBACK_COUNT, off->pbo);
+    for (u32 i = 0; i < OFF_READBACK_COUNT; ++i) {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, off->pbo[i]);
+      glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)off->w * off->h * 3, 0, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  }
 
-void main() {
-  color = vec4(texture(u_sampler, texcoord).rgb, 1.0f);
+  // Encoder, with timestamps in microseconds of stream time
+  const AVOutputFormat* avof = av_guess_format(0, out_path, 0);
+  assert(avof);
+  const AVCodec* avc = avcodec_find_encoder(AV_CODEC_ID_H264);
+  assert(avc);
+  off->avcc = avcodec_alloc_context3(avc);
+  assert(off->avcc);
+  off->avcc->bit_rate = bit_rate;
+  off->avcc->width = off->w;
+  off->avcc->height = off->h;
+  off->avcc->time_base = { 1, 1000000 };
+  off->avcc->framerate = avs->avg_frame_rate.num > 0 ? avs->avg_frame_rate : AVRational { 30, 1 };
+  off->avcc->gop_size = 12;
+  off->avcc->pix_fmt = AV_PIX_FMT_YUV420P;
+  off->avcc->thread_count = 0;
+  if (avof->flags & AVFMT_GLOBALHEADER) {
+    off->avcc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  }
+  int ret = avcodec_open2(off->avcc, avc, 0);
+  assert(ret >= 0);
+
+  // Output file
+  ret = avformat_alloc_output_context2(&off->avfc, 0, 0, out_path);
+  assert(ret >= 0 && off->avfc);
+  off->avst = avformat_new_stream(off->avfc, 0);
+  assert(off->avst);
+  off->avst->time_base = off->avcc->time_base;
+  ret = avcodec_parameters_from_context(off->avst->codecpar, off->avcc);
+  assert(ret >= 0);
+  av_dump_format(off->avfc, 0, out_path, 1);
+  ret = avio_open(&off->avfc->pb, out_path, AVIO_FLAG_WRITE);
+  assert(ret >= 0);
+  ret = avformat_write_header(off->avfc, 0);
+  assert(ret >= 0);
+
+  // Conversion of read back RGB into encoder frames
+  AV_ConverterInit(&off->conv, off->w, off->h, AV_PIX_FMT_RGB24, off->w, off->h, AV_PIX_FMT_YUV420P, AV_CONVERT_SIMD, &g.jobs);
+  AV_FramePoolInit(&off->frame_pool, AV_PIX_FMT_YUV420P, off->w, off->h, OFF_POOL_FRAMES);
+
+  off->pkt = av_packet_alloc();
+  assert(off->pkt);
+  for (u32 i = 0; i < OFF_QUEUE_SIZE; ++i) {
+    off->queue[i] = av_frame_alloc();
+    assert(off->queue[i]);
+  }
+  off->mtx = SDL_CreateMutex();
+  off->cond = SDL_CreateCondition();
+  off->thread = SDL_CreateThread(OFF_EncoderThread, "vidshader_enc", off);
+  assert(off->mtx && off->cond && off->thread);
 }
 
-)""";
+// Render the shader over g.texture and start reading the result back
+static void OFF_RenderFrame(u32 slot) {
+  OfflineRender* off = &g.off;
+  PIPE_Run(&g.pipe, off->render_fbo, off->w, off->h);
 
-GLuint LoadAndCompileShader(GLenum type, const char* source) {
-  GLuint shader = glCreateShader(type);
-  glShaderSource(shader, 1, &source, 0);
-  glCompileShader(shader);
-  GLint status = 0;
-  glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
-  if (!status) {
-    char log[1024] = { };
-    glGetShaderInfoLog(shader, sizeof(log), 0, log);
-    SDL_Log("Failed to compile shader: %s", log);
-    exit(1);
-    return -1;
+  // Flip so rows come back top first, as the encoder wants them
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, off->render_fbo);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, off->read_fbo);
+  glBlitFramebuffer(0, 0, off->w, off->h, 0, off->h, off->w, 0, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, off->read_fbo);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, off->pbo[slot]);
+  glReadPixels(0, 0, off->w, off->h, GL_RGB, GL_UNSIGNED_BYTE, 0);
+  off->fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Wait for a readback to land, convert it and queue it for encoding
+static void OFF_FinishFrame(u32 slot) {
+  OfflineRender* off = &g.off;
+  while (glClientWaitSync(off->fence[slot], GL_SYNC_FLUSH_COMMANDS_BIT, SDL_NS_PER_SECOND) == GL_TIMEOUT_EXPIRED) { }
+  glDeleteSync(off->fence[slot]);
+  off->fence[slot] = 0;
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, off->pbo[slot]);
+  const u8* pixels = (const u8*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)off->w * off->h * 3, GL_MAP_READ_BIT);
+  assert(pixels);
+
+  AVFrame* frame = AV_FramePoolGetWritable(&off->frame_pool);
+  const u8* const rgb_planes[] = { pixels, 0, 0, 0 };
+  const int rgb_pitches[] = { (int)off->w * 3, 0, 0, 0 };
+  AV_ConverterRun(&off->conv, rgb_planes, rgb_pitches, frame->data, frame->linesize);
+  glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  frame->pts = off->pts[slot];
+  OFF_Push(off, frame);
+}
+
+void OFF_End() {
+  OfflineRender* off = &g.off;
+  SDL_LockMutex(off->mtx);
+  off->quit = true;
+  SDL_BroadcastCondition(off->cond);
+  SDL_UnlockMutex(off->mtx);
+  SDL_WaitThread(off->thread, 0);
+
+  int ret = av_write_trailer(off->avfc);
+  assert(ret >= 0);
+  avio_closep(&off->avfc->pb);
+  avformat_free_context(off->avfc);
+
+  for (u32 i = 0; i < OFF_QUEUE_SIZE; ++i) {
+    av_frame_free(&off->queue[i]);
+  }
+  av_packet_free(&off->pkt);
+  avcodec_free_context(&off->avcc);
+  AV_FramePoolFree(&off->frame_pool);
+  AV_ConverterFree(&off->conv);
+  SDL_DestroyCondition(off->cond);
+  SDL_DestroyMutex(off->mtx);
+
+  if (off->render_fbo) {
+    glDeleteBuffers(OFF_READBACK_COUNT, off->pbo);
+    glDeleteFramebuffers(1, &off->render_fbo);
+    glDeleteFramebuffers(1, &off->read_fbo);
+    glDeleteTextures(1, &off->render_tex);
+    glDeleteTextures(1, &off->read_tex);
   }
-  return shader;
+  *off = { };
 }
 
-GLuint LoadAndCompileProgram(const char* vert_src, const char* frag_src) {
-  GLuint prog = glCreateProgram();
-  glAttachShader(prog, LoadAndCompileShader(GL_VERTEX_SHADER, vert_src));
-  glAttachShader(prog, LoadAndCompileShader(GL_FRAGMENT_SHADER, frag_src));
-  glLinkProgram(prog);
-  GLint status = 0;
-  glGetProgramiv(prog, GL_LINK_STATUS, &status);
-  if (!status) {
-    SDL_Log("Failed to link program");
-    exit(1);
-    return -1;
+SDL_AppResult OFF_Run(const char* out_path, i64 bit_rate) {
+  OFF_Begin(out_path, bit_rate, true);
+
+  OfflineRender* off = &g.off;
+  const u64 t0 = SDL_GetTicksNS();
+  u64 t_upload = 0;
+  u64 t_render = 0;
+  u64 t_finish = 0;
+  u32 num_frames = 0;
+  f64 t = 0.0;
+  while (true) {
+    const bool got_frame = DEC_NextFrame(g.current, &t);
+    const u64 t1 = SDL_GetTicksNS();
+
+    // Readbacks trail rendering by OFF_READBACK_COUNT - 1 frames
+    const u32 slot = num_frames % OFF_READBACK_COUNT;
+    if (num_frames >= OFF_READBACK_COUNT || (!got_frame && off->fence[slot])) {
+      OFF_FinishFrame(slot);
+    }
+    const u64 t2 = SDL_GetTicksNS();
+    t_finish += t2 - t1;
+
+    if (!got_frame) {
+      // Flush the remaining readbacks in order
+      for (u32 i = 1; i < OFF_READBACK_COUNT; ++i) {
+        const u32 rest = (num_frames + i) % OFF_READBACK_COUNT;
+        if (off->fence[rest]) {
+          OFF_FinishFrame(rest);
+        }
+      }
+      break;
+    }
+
+    TEX_Upload(&g.stream, DEC_ConformFrame(g.current), &g.conv);
+    const u64 t3 = SDL_GetTicksNS();
+    off->pts[slot] = (i64)(t * 1e6 + 0.5);
+    // Animated shaders follow stream time, as they do during playback
+    g.current_t = t;
+    g.media_t = t;
+    OFF_RenderFrame(slot);
+    t_upload += t3 - t2;
+    t_render += SDL_GetTicksNS() - t3;
+    ++num_frames;
   }
-  return prog;
+  const u64 t_end = SDL_GetTicksNS();
+  const u32 w = off->w;
+  const u32 h = off->h;
+  OFF_End();
+  const u64 t_drain = SDL_GetTicksNS() - t_end;
+
+  const f64 secs = (f64)(t_end + t_drain - t0) / (f64)SDL_NS_PER_SECOND;
+  SDL_Log("Rendered %u frames (%ux%u) to %s in %.3fs, %.1f fps", num_frames, w, h, out_path, secs, num_frames / secs);
+  SDL_Log("  upload:   %8.3f ms/frame", (f64)t_upload / 1e6 / Max(num_frames, 1u));
+  SDL_Log("  render:   %8.3f ms/frame", (f64)t_render / 1e6 / Max(num_frames, 1u));
+  SDL_Log("  readback: %8.3f ms/frame (includes waiting on the encoder)", (f64)t_finish / 1e6 / Max(num_frames, 1u));
+  SDL_Log("  drain:    %8.3f ms", (f64)t_drain / 1e6);
+  return SDL_APP_SUCCESS;
+}
+
+//
+// CPU filters
+//
+// The shaders that ship with vidshader reimplemented over RGB24 frames for
+// machines without a GL driver. Frames are split into bands of rows run on
+// the job pool, each with scalar, SSE2 and AVX2 row functions. Results match
+// the GL output to within rounding, which --validate-filters checks.
+//
+
+static void FLT_InvertRow_Scalar(const u8* src, u8* dst, u32 n) {
+  for (u32 i = 0; i < n; ++i) {
+    dst[i] = 255 - src[i];
+  }
+}
+
+// Vertical half of s_kernel's 3x3 gaussian: a + 2b + c per byte
+static void FLT_KernelSumRow_Scalar(const u8* a, const u8* b, const u8* c, u16* sums, u32 n) {
+  for (u32 i = 0; i < n; ++i) {
+    sums[i] = a[i] + 2 * b[i] + c[i];
+  }
+}
+
+// Horizontal half over sums padded by one pixel on both sides
+static void FLT_KernelBlurRow_Scalar(const u16* sums, u8* dst, u32 n) {
+  for (u32 i = 0; i < n; ++i) {
+    const u16* s = sums + i;
+    dst[i] = (u8)((s[-3] + 2 * s[0] + s[3] + 8) >> 4);
+  }
+}
+
+// s_abbr: red from 5 pixels right, blue from 5 pixels left, both clamped
+static void FLT_AbbrPixels_Scalar(const u8* src, u8* dst, u32 w, u32 x0, u32 x1) {
+  for (u32 x = x0; x < x1; ++x) {
+    dst[x * 3 + 0] = src[Min(x + 5, w - 1) * 3 + 0];
+    dst[x * 3 + 1] = src[x * 3 + 1];
+    dst[x * 3 + 2] = src[(x >= 5 ? x - 5 : 0) * 3 + 2];
+  }
+}
+
+static void FLT_AbbrRow_Scalar(const u8* src, u8* dst, u32 w) {
+  FLT_AbbrPixels_Scalar(src, dst, w, 0, w);
+}
+
+// s_wave: each column is shifted vertically with bilinear filtering
+static void FLT_WavePixels_Scalar(const CPUFilter* f, u32 y, u8* dst, u32 x0, u32 x1) {
+  for (u32 x = x0; x < x1; ++x) {
+    const i32 r0 = Clamp((i32)y + f->wave_offset[x], 0, (i32)f->h - 1);
+    const i32 r1 = Clamp((i32)y + f->wave_offset[x] + 1, 0, (i32)f->h - 1);
+    const u8* a = f->src + r0 * f->src_pitch + x * 3;
+    const u8* b = f->src + r1 * f->src_pitch + x * 3;
+    const i32 wb = f->wave_frac[x];
+    for (u32 c = 0; c < 3; ++c) {
+      dst[x * 3 + c] = (u8)((a[c] * (256 - wb) + b[c] * wb + 128) >> 8);
+    }
+  }
+}
+
+static void FLT_WaveRow_Scalar(const CPUFilter* f, u32 y, u8* dst) {
+  FLT_WavePixels_Scalar(f, y, dst, 0, f->w);
+}
+
+#ifdef FUN_X64
+
+// Channel of each byte in a run of RGB24 pixels
+alignas(32) const u8 FLT_BYTE_CHANNELS[96] = {
+  0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2,
+  0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2,
+  0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2,
+  0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2,
 };
 
-static struct {
-  SDL_Window* wnd;
-  SDL_GLContext gl;
-  GLuint quad_vao;
-  GLuint quad_vbo;
-  GLuint quad_ibo;
-  GLuint program;
-  GLuint program_default;
-  GLuint texture;
-  Vec2 resolution;
-  AVFormatContext* avfc;
-  int avfc_video_stream;
-  const AVCodec* avc;
-  AVCodecContext* avcc;
-  SwsContext* sws_ctx;
-  bool paused;
-  bool show_original;
-} g = { };
+static void FLT_InvertRow_SSE2(const u8* src, u8* dst, u32 n) {
+  const __m128i ones = _mm_set1_epi8(-1);
+  u32 i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + i)), ones));
+  }
+  FLT_InvertRow_Scalar(src + i, dst + i, n - i);
+}
 
-SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[]) {
-  if (argc != 3) {
-    SDL_Log("Usage: vidshader <video path> <shader path>");
-    return SDL_APP_FAILURE;
+FUN_TARGET("avx2")
+static void FLT_InvertRow_AVX2(const u8* src, u8* dst, u32 n) {
+  const __m256i ones = _mm256_set1_epi8(-1);
+  u32 i = 0;
+  for (; i + 32 <= n; i += 32) {
+    _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(src + i)), ones));
   }
+  FLT_InvertRow_Scalar(src + i, dst + i, n - i);
+}
 
-  const char* fragment_shader = (const char*)SDL_LoadFile(argv[2], 0);
-  if (!fragment_shader) {
-    SDL_Log("Failed to load file %s", argv[1]);
-    return SDL_APP_FAILURE;
+static void FLT_KernelSumRow_SSE2(const u8* a, const u8* b, const u8* c, u16* sums, u32 n) {
+  const __m128i zero = _mm_setzero_si128();
+  u32 i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+    const __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+    const __m128i vc = _mm_loadu_si128((const __m128i*)(c + i));
+    const __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vc, zero)),
+                                     _mm_slli_epi16(_mm_unpacklo_epi8(vb, zero), 1));
+    const __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vc, zero)),
+                                     _mm_slli_epi16(_mm_unpackhi_epi8(vb, zero), 1));
+    _mm_storeu_si128((__m128i*)(sums + i), lo);
+    _mm_storeu_si128((__m128i*)(sums + i + 8), hi);
+  }
+  FLT_KernelSumRow_Scalar(a + i, b + i, c + i, sums + i, n - i);
+}
+
+FUN_TARGET("avx2")
+static void FLT_KernelSumRow_AVX2(const u8* a, const u8* b, const u8* c, u16* sums, u32 n) {
+  u32 i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m256i va = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(a + i)));
+    const __m256i vb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(b + i)));
+    const __m256i vc = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(c + i)));
+    _mm256_storeu_si256((__m256i*)(sums + i), _mm256_add_epi16(_mm256_add_epi16(va, vc), _mm256_slli_epi16(vb, 1)));
+  }
+  FLT_KernelSumRow_Scalar(a + i, b + i, c + i, sums + i, n - i);
+}
+
+static void FLT_KernelBlurRow_SSE2(const u16* sums, u8* dst, u32 n) {
+  const __m128i round = _mm_set1_epi16(8);
+  u32 i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i half[2];
+    for (u32 j = 0; j < 2; ++j) {
+      const u16* s = sums + i + j * 8;
+      const __m128i l = _mm_loadu_si128((const __m128i*)(s - 3));
+      const __m128i m = _mm_loadu_si128((const __m128i*)s);
+      const __m128i r = _mm_loadu_si128((const __m128i*)(s + 3));
+      half[j] = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(l, r), _mm_add_epi16(_mm_slli_epi16(m, 1), round)), 4);
+    }
+    _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(half[0], half[1]));
+  }
+  FLT_KernelBlurRow_Scalar(sums + i, dst + i, n - i);
+}
+
+FUN_TARGET("avx2")
+static void FLT_KernelBlurRow_AVX2(const u16* sums, u8* dst, u32 n) {
+  const __m256i round = _mm256_set1_epi16(8);
+  u32 i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m256i l = _mm256_loadu_si256((const __m256i*)(sums + i - 3));
+    const __m256i m = _mm256_loadu_si256((const __m256i*)(sums + i));
+    const __m256i r = _mm256_loadu_si256((const __m256i*)(sums + i + 3));
+    const __m256i v = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(l, r), _mm256_add_epi16(_mm256_slli_epi16(m, 1), round)), 4);
+    _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+  }
+  FLT_KernelBlurRow_Scalar(sums + i, dst + i, n - i);
+}
+
+// Away from the edges every output byte comes from its own channel 15 bytes
+// right, in place, or 15 bytes left, so three loads are blended by masks
+// that repeat every 48 bytes
+static void FLT_AbbrRow_SSE2(const u8* src, u8* dst, u32 w) {
+  __m128i masks[3][3];
+  for (u32 k = 0; k < 3; ++k) {
+    const __m128i channels = _mm_load_si128((const __m128i*)(FLT_BYTE_CHANNELS + k * 16));
+    for (u32 c = 0; c < 3; ++c) {
+      masks[k][c] = _mm_cmpeq_epi8(channels, _mm_set1_epi8((char)c));
+    }
+  }
+  u32 x = Min(5u, w);
+  for (; x + 16 + 5 <= w; x += 16) {
+    for (u32 k = 0; k < 3; ++k) {
+      const u8* s = src + x * 3 + k * 16;
+      const __m128i r = _mm_and_si128(masks[k][0], _mm_loadu_si128((const __m128i*)(s + 15)));
+      const __m128i g = _mm_and_si128(masks[k][1], _mm_loadu_si128((const __m128i*)s));
+      const __m128i b = _mm_and_si128(masks[k][2], _mm_loadu_si128((const __m128i*)(s - 15)));
+      _mm_storeu_si128((__m128i*)(dst + x * 3 + k * 16), _mm_or_si128(_mm_or_si128(r, g), b));
+    }
+  }
+  FLT_AbbrPixels_Scalar(src, dst, w, 0, Min(5u, w));
+  FLT_AbbrPixels_Scalar(src, dst, w, x, w);
+}
+
+FUN_TARGET("avx2")
+static void FLT_AbbrRow_AVX2(const u8* src, u8* dst, u32 w) {
+  __m256i masks[3][3];
+  for (u32 k = 0; k < 3; ++k) {
+    const __m256i channels = _mm256_load_si256((const __m256i*)(FLT_BYTE_CHANNELS + k * 32));
+    for (u32 c = 0; c < 3; ++c) {
+      masks[k][c] = _mm256_cmpeq_epi8(channels, _mm256_set1_epi8((char)c));
+    }
+  }
+  u32 x = Min(5u, w);
+  for (; x + 32 + 5 <= w; x += 32) {
+    for (u32 k = 0; k < 3; ++k) {
+      const u8* s = src + x * 3 + k * 32;
+      const __m256i r = _mm256_and_si256(masks[k][0], _mm256_loadu_si256((const __m256i*)(s + 15)));
+      const __m256i g = _mm256_and_si256(masks[k][1], _mm256_loadu_si256((const __m256i*)s));
+      const __m256i b = _mm256_and_si256(masks[k][2], _mm256_loadu_si256((const __m256i*)(s - 15)));
+      _mm256_storeu_si256((__m256i*)(dst + x * 3 + k * 32), _mm256_or_si256(_mm256_or_si256(r, g), b));
+    }
+  }
+  FLT_AbbrPixels_Scalar(src, dst, w, 0, Min(5u, w));
+  FLT_AbbrPixels_Scalar(src, dst, w, x, w);
+}
+
+// Gathers 8 pixels from each of the two source rows as 32-bit words, blends
+// them 16 bits per channel and packs the RGBX results back down to RGB. SSE2
+// has no gather, so its wave filter is the scalar one.
+FUN_TARGET("avx2")
+static void FLT_WaveRow_AVX2(const CPUFilter* f, u32 y, u8* dst) {
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i row_y = _mm256_set1_epi32((i32)y);
+  const __m256i last_row = _mm256_set1_epi32((i32)f->h - 1);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i pitch = _mm256_set1_epi32((i32)f->src_pitch);
+  const __m256i full = _mm256_set1_epi32(256);
+  const __m256i round = _mm256_set1_epi16(128);
+  const __m256i compact = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                           0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  // Stop while the last gather still ends inside the row and the last 16
+  // byte store inside the output row
+  u32 x = 0;
+  for (; x + 10 <= f->w; x += 8) {
+    const __m256i offset = _mm256_add_epi32(row_y, _mm256_loadu_si256((const __m256i*)(f->wave_offset + x)));
+    const __m256i r0 = _mm256_min_epi32(_mm256_max_epi32(offset, zero), last_row);
+    const __m256i r1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(offset, _mm256_set1_epi32(1)), zero), last_row);
+    const __m256i col = _mm256_mullo_epi32(_mm256_add_epi32(lanes, _mm256_set1_epi32((i32)x)), _mm256_set1_epi32(3));
+    const __m256i a = _mm256_i32gather_epi32((const int*)f->src, _mm256_add_epi32(_mm256_mullo_epi32(r0, pitch), col), 1);
+    const __m256i b = _mm256_i32gather_epi32((const int*)f->src, _mm256_add_epi32(_mm256_mullo_epi32(r1, pitch), col), 1);
+
+    const __m256i wb = _mm256_loadu_si256((const __m256i*)(f->wave_frac + x));
+    const __m256i wa = _mm256_sub_epi32(full, wb);
+    const __m256i wb16 = _mm256_or_si256(wb, _mm256_slli_epi32(wb, 16));
+    const __m256i wa16 = _mm256_or_si256(wa, _mm256_slli_epi32(wa, 16));
+    const __m256i lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(
+      _mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi32(wa16, wa16)),
+      _mm256_mullo_epi16(_mm256_unpacklo_epi8(b, zero), _mm256_unpacklo_epi32(wb16, wb16))), round), 8);
+    const __m256i hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(
+      _mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi32(wa16, wa16)),
+      _mm256_mullo_epi16(_mm256_unpackhi_epi8(b, zero), _mm256_unpackhi_epi32(wb16, wb16))), round), 8);
+
+    const __m256i rgb = _mm256_shuffle_epi8(_mm256_packus_epi16(lo, hi), compact);
+    _mm_storeu_si128((__m128i*)(dst + x * 3), _mm256_castsi256_si128(rgb));
+    _mm_storeu_si128((__m128i*)(dst + x * 3 + 12), _mm256_extracti128_si256(rgb, 1));
+  }
+  FLT_WavePixels_Scalar(f, y, dst, x, f->w);
+}
+
+#endif // FUN_X64
+
+static void FLT_TileJob(void* userdata, u32 tile) {
+  const CPUFilter* f = (const CPUFilter*)userdata;
+  const u32 y0 = tile * FLT_TILE_ROWS;
+  const u32 y1 = Min(y0 + FLT_TILE_ROWS, f->h);
+  const u32 n = f->w * 3;
+
+  auto invert_row = FLT_InvertRow_Scalar;
+  auto sum_row = FLT_KernelSumRow_Scalar;
+  auto blur_row = FLT_KernelBlurRow_Scalar;
+  auto abbr_row = FLT_AbbrRow_Scalar;
+  auto wave_row = FLT_WaveRow_Scalar;
+#ifdef FUN_X64
+  if (f->isa == FLT_ISA_SSE2) {
+    invert_row = FLT_InvertRow_SSE2;
+    sum_row = FLT_KernelSumRow_SSE2;
+    blur_row = FLT_KernelBlurRow_SSE2;
+    abbr_row = FLT_AbbrRow_SSE2;
+  } else if (f->isa == FLT_ISA_AVX2) {
+    invert_row = FLT_InvertRow_AVX2;
+    sum_row = FLT_KernelSumRow_AVX2;
+    blur_row = FLT_KernelBlurRow_AVX2;
+    abbr_row = FLT_AbbrRow_AVX2;
+    wave_row = FLT_WaveRow_AVX2;
+  }
+#endif
+
+  for (u32 y = y0; y < y1; ++y) {
+    const u8* src = f->src + y * f->src_pitch;
+    u8* dst = f->dst + y * f->dst_pitch;
+    switch (f->filter) {
+    case FLT_KERNEL: {
+      // Edges repeat, like the clamped texture the shader samples
+      const u8* above = f->src + (y > 0 ? y - 1 : 0) * f->src_pitch;
+      const u8* below = f->src + Min(y + 1, f->h - 1) * f->src_pitch;
+      u16* sums = f->sums + tile * f->sums_stride + 3;
+      sum_row(above, src, below, sums, n);
+      for (u32 c = 0; c < 3; ++c) {
+        sums[(i32)c - 3] = sums[c];
+        sums[n + c] = sums[n - 3 + c];
+      }
+      blur_row(sums, dst, n);
+    } break;
+    case FLT_INVERT: {
+      invert_row(src, dst, n);
+    } break;
+    case FLT_ABBR: {
+      abbr_row(src, dst, f->w);
+    } break;
+    case FLT_WAVE: {
+      wave_row(f, y, dst);
+    } break;
+    }
+  }
+}
+
+// Picks the best instruction set up to the one requested
+void FLT_Init(CPUFilter* f, u8 filter, u8 isa, u32 w, u32 h, JobPool* jobs) {
+  *f = { };
+  f->filter = filter;
+#ifdef FUN_X64
+  static const bool has_avx2 = CPU_HasAVX2();
+  f->isa = isa == FLT_ISA_AVX2 && !has_avx2 ? (u8)FLT_ISA_SSE2 : isa;
+#else
+  f->isa = FLT_ISA_SCALAR;
+#endif
+  f->w = w;
+  f->h = h;
+  f->num_tiles = (h + FLT_TILE_ROWS - 1) / FLT_TILE_ROWS;
+  f->jobs = jobs;
+  f->sums_stride = (usize)w * 3 + 6;
+  f->sums = MemAlloc<u16>(f->sums_stride * f->num_tiles);
+  f->wave_offset = MemAlloc<i32>(w);
+  f->wave_frac = MemAlloc<i32>(w);
+}
+
+void FLT_Free(CPUFilter* f) {
+  MemFree(f->sums);
+  MemFree(f->wave_offset);
+  MemFree(f->wave_frac);
+  *f = { };
+}
+
+// Filters one RGB24 frame. time is u_time for the animated filters.
+void FLT_Run(CPUFilter* f, const u8* src, usize src_pitch, u8* dst, usize dst_pitch, f32 time) {
+  f->src = src;
+  f->src_pitch = src_pitch;
+  f->dst = dst;
+  f->dst_pitch = dst_pitch;
+
+  if (f->filter == FLT_WAVE) {
+    // Same offset as s_wave.glsl, in texels of the source rows
+    for (u32 x = 0; x < f->w; ++x) {
+      const f32 u = (x + 0.5f) / f->w;
+      const f32 shift = SDL_sinf(u * 10.0f + time * 2.0f) / 10.0f * f->h;
+      const f32 offset = SDL_floorf(shift);
+      const i32 frac = (i32)((shift - offset) * 256.0f + 0.5f);
+      f->wave_offset[x] = (i32)offset + (frac >> 8);
+      f->wave_frac[x] = frac & 0xFF;
+    }
+  }
+
+  if (f->jobs) {
+    f->jobs->Run(f->num_tiles, FLT_TileJob, f);
+  } else {
+    for (u32 i = 0; i < f->num_tiles; ++i) {
+      FLT_TileJob(f, i);
+    }
+  }
+}
+
+static u8* FLT_AllocTestImage(u32 w, u32 h) {
+  u8* image = MemAlloc<u8>((usize)w * h * 3);
+  Xorshift rng;
+  for (u32 y = 0; y < h; ++y) {
+    for (u32 x = 0; x < w; ++x) {
+      // Gradients with noise, so blurs and shifts all change the picture
+      u8* p = image + ((usize)y * w + x) * 3;
+      p[0] = (u8)Clamp((i32)(x * 255 / w) + (i32)rng.RandomFloat(64.0f) - 32, 0, 255);
+      p[1] = (u8)Clamp((i32)(y * 255 / h) + (i32)rng.RandomFloat(64.0f) - 32, 0, 255);
+      p[2] = (u8)rng.RandomFloat(255.0f);
+    }
+  }
+  return image;
+}
+
+// Throughput of every filter with every instruction set, on one thread and
+// on the job pool
+SDL_AppResult FLT_Benchmark() {
+  constexpr u32 ITERATIONS = 30;
+  constexpr u32 W = 1920;
+  constexpr u32 H = 1080;
+  g.jobs.Init();
+  u8* src = FLT_AllocTestImage(W, H);
+  u8* dst = MemAlloc<u8>(W * H * 3);
+  for (u8 filter = 0; filter < FLT_COUNT; ++filter) {
+    for (u8 isa = 0; isa < FLT_ISA_COUNT; ++isa) {
+      for (u32 threaded = 0; threaded < 2; ++threaded) {
+        CPUFilter f;
+        FLT_Init(&f, filter, isa, W, H, threaded ? &g.jobs : 0);
+        if (f.isa != isa) {
+          FLT_Free(&f);
+          continue;
+        }
+        const u64 t0 = SDL_GetPerformanceCounter();
+        for (u32 i = 0; i < ITERATIONS; ++i) {
+          FLT_Run(&f, src, W * 3, dst, W * 3, i * 0.04f);
+        }
+        const f64 secs = (f64)(SDL_GetPerformanceCounter() - t0) / (f64)SDL_GetPerformanceFrequency();
+        SDL_Log("filter %-6s %-6s %2u threads %8.1f MP/s %7.2f ms/frame", FLT_NAMES[filter], FLT_ISA_NAMES[isa],
+          threaded ? g.jobs.Concurrency() : 1, (f64)W * H * ITERATIONS / secs / 1e6, secs / ITERATIONS * 1e3);
+        FLT_Free(&f);
+      }
+    }
   }
+  MemFree(dst);
+  MemFree(src);
+  g.jobs.Shutdown();
+  return SDL_APP_SUCCESS;
+}
+
+// Renders each filter's shader from shader_dir over a test image and
+// compares the result with every CPU implementation. Needs the GL context.
+SDL_AppResult FLT_Validate(const char* shader_dir) {
+  constexpr u32 W = 640;
+  constexpr u32 H = 360;
+  constexpr f32 TIME = 0.75f;
+  u8* src = FLT_AllocTestImage(W, H);
+  u8* gl_out = MemAlloc<u8>(W * H * 3);
+  u8* cpu_out = MemAlloc<u8>(W * H * 3);
+
+  // Same filtering and wrapping as the video texture
+  glGenTextures(1, &g.texture);
+  glBindTexture(GL_TEXTURE_2D, g.texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, W, H, 0, GL_RGB, GL_UNSIGNED_BYTE, src);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  GLuint target_tex = 0;
+  const GLuint target_fbo = OFF_CreateTarget(W, H, &target_tex);
+  g.resolution = Vec2(W, H);
+  g.media_t = TIME;
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+  bool passed = true;
+  for (u8 filter = 0; filter < FLT_COUNT; ++filter) {
+    char path[1024] = { };
+    SDL_snprintf(path, sizeof(path), "%s/%s", shader_dir, FLT_SHADERS[filter]);
+    Pipeline pipe;
+    if (!PIPE_Load(&pipe, path)) {
+      passed = false;
+      continue;
+    }
+    PIPE_Init(&pipe, W, H);
+    PIPE_Run(&pipe, target_fbo, W, H);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, target_fbo);
+    glReadPixels(0, 0, W, H, GL_RGB, GL_UNSIGNED_BYTE, gl_out);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    PIPE_Free(&pipe);
+
+    for (u8 isa = 0; isa < FLT_ISA_COUNT; ++isa) {
+      CPUFilter f;
+      FLT_Init(&f, filter, isa, W, H, 0);
+      if (f.isa == isa) {
+        FLT_Run(&f, src, W * 3, cpu_out, W * 3, TIME);
+        // Read back rows start at the bottom
+        u32 max_diff = 0;
+        u32 num_off = 0;
+        for (u32 y = 0; y < H; ++y) {
+          const u8* a = cpu_out + (usize)y * W * 3;
+          const u8* b = gl_out + (usize)(H - 1 - y) * W * 3;
+          for (u32 i = 0; i < W * 3; ++i) {
+            const u32 diff = (u32)SDL_abs(a[i] - b[i]);
+            max_diff = Max(max_diff, diff);
+            num_off += diff > 1;
+          }
+        }
+        const bool ok = max_diff <= FLT_MAX_DIFF;
+        passed &= ok;
+        SDL_Log("validate %-6s %-6s max diff %3u, %6u of %u values off by more than 1: %s", FLT_NAMES[filter],
+          FLT_ISA_NAMES[isa], max_diff, num_off, W * H * 3, ok ? "ok" : "FAILED");
+      }
+      FLT_Free(&f);
+    }
+  }
+
+  glDeleteFramebuffers(1, &target_fbo);
+  glDeleteTextures(1, &target_tex);
+  glDeleteTextures(1, &g.texture);
+  g.texture = 0;
+  MemFree(cpu_out);
+  MemFree(gl_out);
+  MemFree(src);
+  return passed ? SDL_APP_SUCCESS : SDL_APP_FAILURE;
+}
+
+// Offline render without GL: decoded frames are converted to RGB24, filtered
+// on the CPU and converted again for the encoder
+SDL_AppResult FLT_RunOffline(const char* out_path, i64 bit_rate) {
+  OFF_Begin(out_path, bit_rate, false);
+
+  OfflineRender* off = &g.off;
+  CPUFilter* f = &g.filter;
+  const usize pitch = (usize)f->w * 3;
+  u8* rgb = MemAlloc<u8>(pitch * f->h);
+  u8* filtered = MemAlloc<u8>(pitch * f->h);
+  u8* const rgb_planes[] = { rgb, 0, 0, 0 };
+  const u8* const filtered_planes[] = { filtered, 0, 0, 0 };
+  const int pitches[] = { (int)pitch, 0, 0, 0 };
+
+  const u64 t0 = SDL_GetTicksNS();
+  u64 t_convert = 0;
+  u64 t_filter = 0;
+  u64 t_encode = 0;
+  u32 num_frames = 0;
+  f64 t = 0.0;
+  while (DEC_NextFrame(g.current, &t)) {
+    const u64 t1 = SDL_GetTicksNS();
+    const AVFrame* decoded = DEC_ConformFrame(g.current);
+    AV_ConverterRun(&g.conv, decoded->data, decoded->linesize, rgb_planes, pitches);
+    const u64 t2 = SDL_GetTicksNS();
+    FLT_Run(f, rgb, pitch, filtered, pitch, (f32)t);
+    const u64 t3 = SDL_GetTicksNS();
 
+    // Waits here when the encoder falls behind
+    AVFrame* frame = AV_FramePoolGetWritable(&off->frame_pool);
+    AV_ConverterRun(&off->conv, filtered_planes, pitches, frame->data, frame->linesize);
+    frame->pts = (i64)(t * 1e6 + 0.5);
+    OFF_Push(off, frame);
+    t_convert += t2 - t1;
+    t_filter += t3 - t2;
+    t_encode += SDL_GetTicksNS() - t3;
+    ++num_frames;
+  }
+  const u64 t_end = SDL_GetTicksNS();
+  const u32 w = off->w;
+  const u32 h = off->h;
+  OFF_End();
+  const u64 t_drain = SDL_GetTicksNS() - t_end;
+  MemFree(filtered);
+  MemFree(rgb);
+
+  const f64 secs = (f64)(t_end + t_drain - t0) / (f64)SDL_NS_PER_SECOND;
+  SDL_Log("Filtered %u frames (%ux%u, %s %s) to %s in %.3fs, %.1f fps", num_frames, w, h, FLT_NAMES[f->filter],
+    FLT_ISA_NAMES[f->isa], out_path, secs, num_frames / secs);
+  SDL_Log("  convert:  %8.3f ms/frame", (f64)t_convert / 1e6 / Max(num_frames, 1u));
+  SDL_Log("  filter:   %8.3f ms/frame", (f64)t_filter / 1e6 / Max(num_frames, 1u));
+  SDL_Log("  encode:   %8.3f ms/frame (includes waiting on the encoder)", (f64)t_encode / 1e6 / Max(num_frames, 1u));
+  SDL_Log("  drain:    %8.3f ms", (f64)t_drain / 1e6);
+  return SDL_APP_SUCCESS;
+}
+
+//
+// App
+//
+
+// A hidden window only exists for its GL context, so it comes from the
+// offscreen driver and needs no display. SDL_VIDEO_DRIVER in the environment
+// still takes precedence.
+void InitWindowAndGL(bool hidden) {
+  if (hidden) {
+    SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "offscreen");
+  }
   if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS)) {
     SDL_Log("Failed to initialize SDL: %s", SDL_GetError());
   }
+  SDL_Log("Video driver: %s", SDL_GetCurrentVideoDriver());
   SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
   SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
   SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
   SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
-  if (!(g.wnd = SDL_CreateWindow(__FILE__, 800, 600, 0))) {
+  if (!(g.wnd = SDL_CreateWindow(__FILE__, 800, 600, hidden ? SDL_WINDOW_HIDDEN : 0))) {
     SDL_Log("Failed to create SDL window: %s", SDL_GetError());
   }
   if (!(g.gl = SDL_GL_CreateContext(g.wnd))) {
@@ -124,45 +3012,123 @@ SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[]) {
   if (!gladLoadGLLoader((GLADloadproc)SDL_GL_GetProcAddress)) {
     SDL_Log("Failed to load OpenGL functinos");
   }
+  SHD_Init(&g.shader_cache);
 
-  const Vertex quad_verts[] = {
-    { Vec2(-1.0f,  1.0f), Vec2(0.0f, 1.0f) }, // top-left
-    { Vec2( 1.0f,  1.0f), Vec2(1.0f, 1.0f) }, // top-right
-    { Vec2( 1.0f, -1.0f), Vec2(1.0f, 0.0f) }, // bottom-right
-    { Vec2(-1.0f, -1.0f), Vec2(0.0f, 0.0f) }, // bottom-left
-  };
-
-  const u16 quad_indices[] = {
-    0, 1, 2,
-    0, 2, 3,
-  };
-
-  glGenVertexArrays(1, &g.quad_vao);
-  glBindVertexArray(g.quad_vao);
-
-  glGenBuffers(1, &g.quad_vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, g.quad_vbo);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(quad_verts), quad_verts, GL_STATIC_DRAW);
-
-  glGenBuffers(1, &g.quad_ibo);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g.quad_ibo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(quad_indices), quad_indices, GL_STATIC_DRAW);
+  TEX_CreateQuad(&g.quad_vao, &g.quad_vbo, &g.quad_ibo);
 
-  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
-  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texcoord));
-  glEnableVertexAttribArray(0);
-  glEnableVertexAttribArray(1);
+  g.program_default = LoadAndCompileProgram(VERTEX_SHADER, DEFAULT_FRAGMENT_SHADER);
+}
 
-  g.program = LoadAndCompileProgram(VERTEX_SHADER, fragment_shader);
-  glUseProgram(g.program);
+SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[]) {
+  const char* video_path = 0;
+  const char* shader_path = 0;
+  bool gpu_convert = true;
+  u8 convert_mode = AV_CONVERT_SIMD;
+  u32 ahead = DEC_DEFAULT_AHEAD;
+  const char* out_path = 0;
+  i64 bit_rate = OFF_DEFAULT_BIT_RATE;
+  bool play_audio = true;
+  u8 input_mode = AV_INPUT_MMAP;
+  u8 cpu_filter = FLT_COUNT;
+  u8 cpu_isa = FLT_ISA_AVX2;
+  const char* validate_dir = 0;
+  DecodeOptions decode_opts = { };
+  decode_opts.thread_type = DEC_THREAD_TYPES[0];
+  decode_opts.skip_loop_filter = AVDISCARD_DEFAULT;
+  bool valid_opts = true;
+  for (int i = 1; i < argc; ++i) {
+    if (SDL_strcmp(argv[i], "--convert") == 0 && i + 1 < argc) {
+      gpu_convert = SDL_strcmp(argv[++i], "gpu") == 0;
+      if (!gpu_convert) {
+        convert_mode = AV_ParseConvertMode(argv[i]);
+      }
+    } else if (SDL_strcmp(argv[i], "--ahead") == 0 && i + 1 < argc) {
+      ahead = (u32)Clamp(SDL_atoi(argv[++i]), 1, (int)DEC_MAX_AHEAD);
+    } else if (SDL_strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      out_path = argv[++i];
+    } else if (SDL_strcmp(argv[i], "--bitrate") == 0 && i + 1 < argc) {
+      bit_rate = Max((i64)SDL_strtoll(argv[++i], 0, 10), (i64)100000);
+    } else if (SDL_strcmp(argv[i], "--no-audio") == 0) {
+      play_audio = false;
+    } else if (SDL_strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+      input_mode = AV_ParseInputMode(argv[++i]);
+    } else if (SDL_strcmp(argv[i], "--cpu-filter") == 0 && i + 1 < argc) {
+      ++i;
+      cpu_filter = 0;
+      while (cpu_filter < FLT_COUNT && SDL_strcmp(argv[i], FLT_NAMES[cpu_filter]) != 0) {
+        ++cpu_filter;
+      }
+      valid_opts &= cpu_filter < FLT_COUNT;
+    } else if (SDL_strcmp(argv[i], "--cpu-isa") == 0 && i + 1 < argc) {
+      ++i;
+      cpu_isa = 0;
+      while (cpu_isa < FLT_ISA_COUNT && SDL_strcmp(argv[i], FLT_ISA_NAMES[cpu_isa]) != 0) {
+        ++cpu_isa;
+      }
+      valid_opts &= cpu_isa < FLT_ISA_COUNT;
+    } else if (SDL_strcmp(argv[i], "--bench-filters") == 0) {
+      return FLT_Benchmark();
+    } else if (SDL_strcmp(argv[i], "--validate-filters") == 0 && i + 1 < argc) {
+      validate_dir = argv[++i];
+    } else if (SDL_strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      decode_opts.threads = Max(SDL_atoi(argv[++i]), 0);
+    } else if (SDL_strcmp(argv[i], "--thread-type") == 0 && i + 1 < argc) {
+      ++i;
+      u32 type = 0;
+      while (type < SDL_arraysize(DEC_THREAD_TYPE_NAMES) && SDL_strcmp(argv[i], DEC_THREAD_TYPE_NAMES[type]) != 0) {
+        ++type;
+      }
+      valid_opts &= type < SDL_arraysize(DEC_THREAD_TYPE_NAMES);
+      decode_opts.thread_type = DEC_THREAD_TYPES[type % SDL_arraysize(DEC_THREAD_TYPES)];
+    } else if (SDL_strcmp(argv[i], "--lowres") == 0 && i + 1 < argc) {
+      decode_opts.lowres = Clamp(SDL_atoi(argv[++i]), 0, 3);
+    } else if (SDL_strcmp(argv[i], "--skip-loop-filter") == 0 && i + 1 < argc) {
+      ++i;
+      u32 discard = 0;
+      while (discard < SDL_arraysize(DEC_DISCARD_NAMES) && SDL_strcmp(argv[i], DEC_DISCARD_NAMES[discard]) != 0) {
+        ++discard;
+      }
+      valid_opts &= discard < SDL_arraysize(DEC_DISCARD_NAMES);
+      decode_opts.skip_loop_filter = DEC_DISCARDS[discard % SDL_arraysize(DEC_DISCARDS)];
+    } else if (!video_path) {
+      video_path = argv[i];
+    } else if (!shader_path) {
+      shader_path = argv[i];
+    } else {
+      video_path = 0;
+      break;
+    }
+  }
+  if (validate_dir && valid_opts) {
+    InitWindowAndGL(true);
+    return FLT_Validate(validate_dir);
+  }
+  // CPU filters only render offline and take the place of the shader
+  const bool cpu_only = cpu_filter < FLT_COUNT;
+  if (!video_path || (!shader_path && !cpu_only) || (cpu_only && (shader_path || !out_path)) ||
+      convert_mode == AV_CONVERT_COUNT || input_mode == AV_INPUT_COUNT || !valid_opts) {
+    SDL_Log("Usage: vidshader [--convert gpu|sws|sliced|simd] [--ahead <frames>] [--threads <n>] [--thread-type auto|frame|slice] "
+            "[--lowres 0-3] [--skip-loop-filter none|nonref|bidir|nonkey|all] [--no-audio] [--input default|mmap|pread] [--out <path> [--bitrate <bps>]] <video path> <shader or .pipe path>");
+    SDL_Log("       vidshader [options] --out <path> --cpu-filter kernel|invert|abbr|wave [--cpu-isa scalar|sse2|avx2] <video path>");
+    SDL_Log("       vidshader --bench-filters");
+    SDL_Log("       vidshader --validate-filters <shader dir>");
+    return SDL_APP_FAILURE;
+  }
 
-  g.program_default = LoadAndCompileProgram(VERTEX_SHADER, DEFAULT_FRAGMENT_SHADER);
+  if (!cpu_only) {
+    if (!PIPE_Load(&g.pipe, shader_path)) {
+      return SDL_APP_FAILURE;
+    }
+    // Offline rendering never shows the window but still needs its context
+    InitWindowAndGL(out_path != 0);
+  }
 
-  int ret = avformat_open_input(&g.avfc, argv[1], 0, 0);
+  int ret = AV_FileInputOpen(&g.input, &g.avfc, video_path, input_mode);
   assert(ret == 0);
+  SDL_Log("Input: %s", AV_INPUT_NAMES[g.input.mode]);
   avformat_find_stream_info(g.avfc, 0);
 
-  av_dump_format(g.avfc, 0, argv[1], 0);
+  av_dump_format(g.avfc, 0, video_path, 0);
 
   g.avfc_video_stream = -1;
   for (unsigned int i = 0; i < g.avfc->nb_streams; ++i) {
@@ -184,92 +3150,122 @@ SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[]) {
   ret = avcodec_parameters_to_context(g.avcc, g.avfc->streams[g.avfc_video_stream]->codecpar);
   assert(ret == 0);
 
+  // Decoded frames recycle pooled buffers
+  AV_DecodeBufferPoolAttach(&g.dec_buffers, g.avcc);
+  DEC_Configure(g.avcc, &decode_opts);
+
   ret = avcodec_open2(g.avcc, g.avc, 0);
   assert(ret == 0);
+  SDL_Log("Decoding with %d threads (%s), lowres %d", g.avcc->thread_count,
+    DEC_ThreadTypeName(g.avcc->active_thread_type), g.avcc->lowres);
 
+  // Lowres decoding shrinks frames but not the window
   AVCodecParameters* cpar = avs->codecpar;
-  g.sws_ctx = sws_getContext(cpar->width, cpar->height, (AVPixelFormat)cpar->format,
-                             cpar->width, cpar->height, AV_PIX_FMT_RGB24,
-                             SWS_BICUBIC, 0, 0, 0);
-  assert(g.sws_ctx);
-
-  g.resolution = Vec2(cpar->width, cpar->height);
-  SDL_SetWindowSize(g.wnd, cpar->width, cpar->height);
-  SDL_SetWindowPosition(g.wnd, 100, 100);
-
-  glGenTextures(1, &g.texture);
-  glBindTexture(GL_TEXTURE_2D, g.texture);
-
-  return SDL_APP_CONTINUE;
-}
-
-void GetFrameTexture() {
-  int ret = 0;
+  const u32 frame_w = (cpar->width + (1 << g.avcc->lowres) - 1) >> g.avcc->lowres;
+  const u32 frame_h = (cpar->height + (1 << g.avcc->lowres) - 1) >> g.avcc->lowres;
+  g.resolution = Vec2(frame_w, frame_h);
+  g.frame_fmt = (AVPixelFormat)cpar->format;
+  g.viewport = Vec2(cpar->width, cpar->height);
+  if (!cpu_only) {
+    SDL_SetWindowSize(g.wnd, cpar->width, cpar->height);
+    SDL_SetWindowPosition(g.wnd, 100, 100);
 
-  // av_seek_frame(g.avfc, g.avfc_video_stream, 10, 0);
+    // Only shaders that pick levels themselves need a mip chain; the quad is
+    // never drawn smaller than the video
+    const bool use_mips = PIPE_Init(&g.pipe, frame_w, frame_h);
+    TEX_Init(&g.stream, g.avcc, (AVPixelFormat)cpar->format, frame_w, frame_h, gpu_convert, use_mips);
+    g.texture = g.stream.texture;
+  }
 
-  // TEST: read 1 frame
-  AVPacket* pkt = av_packet_alloc(); assert(pkt);
-  AVFrame* frame = av_frame_alloc(); assert(frame);
-  bool got_frame = false;
-  while (!got_frame) {
-    ret = av_read_frame(g.avfc, pkt);
-    if (ret == AVERROR_EOF) {
-      av_seek_frame(g.avfc, g.avfc_video_stream, 0, 0);
-      return;
-    }
-    assert(ret == 0);
-    // SDL_Log("+packet");
+  // Formats the shader pass does not handle convert on the CPU, and so does
+  // offline readback. CPU filters take RGB24 like the texture.
+  if (cpu_only || !g.stream.gpu_convert || out_path) {
+    g.jobs.Init();
+  }
+  if (cpu_only || !g.stream.gpu_convert) {
+    convert_mode = AV_ConverterInit(&g.conv, frame_w, frame_h, (AVPixelFormat)cpar->format,
+                                    frame_w, frame_h, AV_PIX_FMT_RGB24, convert_mode, &g.jobs);
+    SDL_Log("Colour conversion: %s, %u slices", AV_CONVERT_NAMES[convert_mode], g.conv.num_slices);
+  }
 
-    if (pkt->stream_index == g.avfc_video_stream) {
-      ret = avcodec_send_packet(g.avcc, pkt);
-      assert(ret >= 0);
-      ret = avcodec_receive_frame(g.avcc, frame);
-      if (ret != AVERROR(EAGAIN)) {
-        assert(ret == 0);
-        // SDL_Log("+frame");
-        got_frame = true;
-      }
+  // Present at the stream's frame rate
+  g.frame_dur = avs->avg_frame_rate.num > 0 ? 1.0 / av_q2d(avs->avg_frame_rate) : 1.0 / 30.0;
+  g.current = av_frame_alloc();
+  assert(g.current);
+  g.duration = avs->duration != AV_NOPTS_VALUE ? avs->duration * av_q2d(avs->time_base) :
+               g.avfc->duration != AV_NOPTS_VALUE ? (f64)g.avfc->duration / AV_TIME_BASE : 0.0;
+  g.last_iter_ns = SDL_GetTicksNS();
+  // Before the decoder starts, so it knows where audio packets go
+  g.audio.stream_index = -1;
+  if (play_audio && !out_path) {
+    AUD_Start(&g.audio);
+  }
+  DEC_Start(ahead, out_path != 0);
+  if (cpu_only) {
+    FLT_Init(&g.filter, cpu_filter, cpu_isa, frame_w, frame_h, &g.jobs);
+    if (g.filter.isa != cpu_isa) {
+      SDL_Log("%s is not supported, filtering with %s", FLT_ISA_NAMES[cpu_isa], FLT_ISA_NAMES[g.filter.isa]);
     }
-
-    av_packet_unref(pkt);
+    return FLT_RunOffline(out_path, bit_rate);
   }
-
-  AVFrame* frame2 = av_frame_alloc();
-  frame2->width = frame->width;
-  frame2->height = frame->height;
-  frame2->format = AV_PIX_FMT_RGB24;
-  av_frame_get_buffer(frame2, 0);
-
-  u8* buffer = MemAllocZ<u8>(frame->width * frame->height * 3);
-  u8* buffers[] = { buffer, 0, 0 };
-  int rgb_strides[] = { frame->width * 3, 0, 0 };
-
-  for (i32 i = 0; i < frame->width * frame->height * 3; ++i) {
-    buffer[i] = 0xFF;
+  if (out_path) {
+    return OFF_Run(out_path, bit_rate);
   }
+  IDX_Start(&g.index, video_path, g.avfc_video_stream, input_mode);
+  PIPE_Watch(&g.pipe);
 
-  sws_scale(g.sws_ctx, frame->data, frame->linesize, 0, frame->height, buffers, rgb_strides);
+  return SDL_APP_CONTINUE;
+}
 
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, frame->width, frame->height, 0, GL_RGB, GL_UNSIGNED_BYTE, buffer);
-  glGenerateMipmap(GL_TEXTURE_2D);
+void GetFrameTexture() {
+  if (!DEC_PickFrame()) {
+    return;
+  }
+  TEX_Upload(&g.stream, DEC_ConformFrame(g.current), &g.conv);
+  FC_Put(&g.cache, g.current, g.current_t);
+  g.seek_show = false;
 }
 
 SDL_AppResult SDL_AppIterate(void* appstate) {
+  PIPE_Reload(&g.pipe);
+
+  // Media time only advances while playing. Audio drives it once the device
+  // is playing the current loop; before that, and without audio, the wall
+  // clock does.
+  const u64 now = SDL_GetTicksNS();
   if (!g.paused) {
+    f64 audio_t = 0.0;
+    u32 audio_loop = 0;
+    const bool audio_clock = AUD_Clock(&g.audio, &audio_t, &audio_loop) && audio_loop >= g.clock_loop;
+    if (audio_clock && audio_loop == g.clock_loop) {
+      g.media_t = audio_t;
+    } else if (audio_clock) {
+      // Audio has looped first: run out the video's loop so it catches up
+      g.media_t = 1e12;
+    } else {
+      g.media_t += (f64)(now - g.last_iter_ns) / (f64)SDL_NS_PER_SECOND;
+    }
+    const u64 presented = g.presented;
+    GetFrameTexture();
+    if (audio_clock && g.presented != presented && audio_loop == g.clock_loop) {
+      AUD_RecordOffset(&g.audio, g.current_t - audio_t);
+    }
+  } else if (g.seek_show) {
     GetFrameTexture();
   }
+  g.last_iter_ns = now;
+  DEC_ShowStats();
 
-  GLuint program = g.show_original ? g.program_default : g.program;
-
-  glUseProgram(program);
-  glUniform2fv(glGetUniformLocation(program, "u_resolution"), 1, &g.resolution.x);
-
-  glViewport(0, 0, (GLsizei)g.resolution.x, (GLsizei)g.resolution.y);
+  glViewport(0, 0, (GLsizei)g.viewport.x, (GLsizei)g.viewport.y);
   glClearColor(0.0f, 0.05, 0.06f, 1.0f);
   glClear(GL_COLOR_BUFFER_BIT);
 
-  glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+  if (g.show_original) {
+    glUseProgram(g.program_default);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+  } else {
+    PIPE_Run(&g.pipe, 0, (u32)g.viewport.x, (u32)g.viewport.y);
+  }
 
   SDL_GL_SwapWindow(g.wnd);
   return SDL_APP_CONTINUE;
@@ -282,11 +3278,46 @@ SDL_AppResult SDL_AppEvent(void* appstate, SDL_Event* event) {
   } break;
   case SDL_EVENT_KEY_DOWN: {
     if (event->key.key == SDLK_SPACE) {
-      g.paused = !g.paused;
+      NAV_SetPaused(!g.paused);
     }
     else if (event->key.key == SDLK_TAB) {
       g.show_original = true;
     }
+    else if (event->key.key == SDLK_LEFT || event->key.key == SDLK_RIGHT) {
+      const f64 step = (event->key.mod & SDL_KMOD_SHIFT) ? 30.0 : 5.0;
+      DEC_Seek(g.current_t + (event->key.key == SDLK_LEFT ? -step : step));
+    }
+    else if (event->key.key == SDLK_HOME) {
+      DEC_Seek(0.0);
+    }
+    else if (event->key.key == SDLK_COMMA) {
+      NAV_Step(-1);
+    }
+    else if (event->key.key == SDLK_PERIOD) {
+      NAV_Step(1);
+    }
+  } break;
+  case SDL_EVENT_MOUSE_BUTTON_DOWN: {
+    if (event->button.button == SDL_BUTTON_LEFT) {
+      g.scrubbing = true;
+      NAV_Scrub(event->button.x);
+    }
+  } break;
+  case SDL_EVENT_MOUSE_BUTTON_UP: {
+    if (event->button.button == SDL_BUTTON_LEFT) {
+      g.scrubbing = false;
+    }
+  } break;
+  case SDL_EVENT_MOUSE_MOTION: {
+    int w = 0;
+    int h = 0;
+    SDL_GetWindowSize(g.wnd, &w, &h);
+    g.mouse = Vec2(event->motion.x / Max(w, 1), event->motion.y / Max(h, 1));
+
+    // Seeks that arrive faster than the decoder takes them replace each other
+    if (g.scrubbing) {
+      NAV_Scrub(event->motion.x);
+    }
   } break;
   case SDL_EVENT_KEY_UP: {
     if (event->key.key == SDLK_TAB) {
@@ -299,5 +3330,35 @@ SDL_AppResult SDL_AppEvent(void* appstate, SDL_Event* event) {
 }
 
 void SDLCALL SDL_AppQuit(void* appstate, SDL_AppResult result) {
+  if (g.presented) {
+    SDL_Log("Presented %llu frames, dropped %llu, repeated %llu, %u underruns", (unsigned long long)g.presented,
+      (unsigned long long)g.dropped, (unsigned long long)g.repeated, g.underruns);
+  }
+  AUD_Stop(&g.audio);
+  DEC_Stop();
+  AUD_Free(&g.audio);
+  IDX_Stop(&g.index);
+  FC_Free(&g.cache);
+  av_frame_free(&g.current);
+  av_frame_free(&g.conformed);
+  sws_freeContext(g.conform_sws);
+  avcodec_free_context(&g.avcc);
+  AV_DecodeBufferPoolFree(&g.dec_buffers);
+  avformat_close_input(&g.avfc);
+  if (g.input.mode != AV_INPUT_DEFAULT) {
+    SDL_Log("Input read %.1f MiB in %llu reads", (f64)g.input.bytes / (1 << 20), (unsigned long long)g.input.reads);
+  }
+  AV_FileInputClose(&g.input);
+  // Nothing was loaded into GL for CPU filters and filter validation
+  if (g.gl) {
+    TEX_Free(&g.stream);
+    g.texture = 0;
+  }
+  if (g.gl && g.pipe.num_passes) {
+    PIPE_Free(&g.pipe);
+  }
+  FLT_Free(&g.filter);
+  AV_ConverterFree(&g.conv);
+  g.jobs.Shutdown();
   SDL_Quit();
 }
@@ -0,0 +1,611 @@
+#include "common_core.hh"
+#include "common_av.hh"
+#include "common_dsa.hh"
+#include "common_thread.hh"
+
+extern "C" {
+  #include <libavcodec/avcodec.h>
+  #include <libavformat/avformat.h>
+  #include <libavutil/pixdesc.h>
+}
+
+#define SDL_MAIN_USE_CALLBACKS
+#include <SDL3/SDL.h>
+#include <SDL3/SDL_main.h>
+
+#include <glad/glad.h>
+
+#include "vidshader_tex.hh"
+
+//
+// vidshader_bench
+//
+// Runs vidshader's decode -> convert -> upload path over a file with nothing
+// drawn and reports per-stage latency. Without a file it encodes its own
+// synthetic clip first, so results are comparable between machines.
+// --bench-input instead demuxes the whole file through each input mode.
+//
+
+constexpr u32 BENCH_DEFAULT_FRAMES = 300;
+constexpr u32 BENCH_DEFAULT_W = 1920;
+constexpr u32 BENCH_DEFAULT_H = 1080;
+constexpr i64 BENCH_SYNTH_BIT_RATE = 8000000;
+constexpr u32 BENCH_MAX_RUNS = 8;
+constexpr u32 BENCH_INPUT_ROUNDS = 3;
+
+// Decoder thread types, as in vidshader
+const char* const BENCH_THREAD_TYPE_NAMES[] = { "auto", "frame", "slice" };
+const int BENCH_THREAD_TYPES[] = { FF_THREAD_FRAME | FF_THREAD_SLICE, FF_THREAD_FRAME, FF_THREAD_SLICE };
+
+// Conversion paths: the AV_CONVERT modes, then none, which leaves YUV for a
+// shader to convert, as vidshader's --convert gpu does
+constexpr u8 BENCH_CONVERT_NONE = AV_CONVERT_COUNT;
+constexpr u8 BENCH_CONVERT_COUNT = AV_CONVERT_COUNT + 1;
+const char* const BENCH_CONVERT_NAMES[BENCH_CONVERT_COUNT] = { "sws", "sliced", "simd", "none" };
+
+enum : u8 {
+  BENCH_STAGE_DECODE = 0,
+  BENCH_STAGE_CONVERT,
+  BENCH_STAGE_UPLOAD,
+  BENCH_STAGE_COUNT,
+};
+
+const char* const BENCH_STAGE_NAMES[BENCH_STAGE_COUNT] = { "decode", "convert", "upload" };
+
+struct BenchOptions {
+  const char* path;
+  u32 max_frames;
+  u32 synth_w;
+  u32 synth_h;
+  u32 threads[BENCH_MAX_RUNS];
+  u32 num_threads;
+  u8 thread_type;
+  u8 converts[BENCH_CONVERT_COUNT];
+  u32 num_converts;
+  bool upload;
+  u8 input_mode;
+  bool bench_input;
+};
+
+static struct {
+  SDL_Window* wnd;
+  SDL_GLContext gl;
+  GLuint quad_vao;
+  GLuint quad_vbo;
+  GLuint quad_ibo;
+  JobPool jobs;
+  // Nanoseconds per frame and stage for the current run
+  u64* samples[BENCH_STAGE_COUNT];
+} g = { };
+
+//
+// Synthetic clip
+//
+
+// Moving gradients under per-frame noise, so every frame costs the decoder
+// real work and nothing can be skipped
+static void SYN_FillFrame(AVFrame* frame, u32 index, Xorshift* rng) {
+  for (i32 y = 0; y < frame->height; ++y) {
+    u8* row = frame->data[0] + (i64)y * frame->linesize[0];
+    for (i32 x = 0; x < frame->width; ++x) {
+      row[x] = (u8)((x + y + index * 4) & 0xFF) ^ ((u8)rng->RandomFloat(32.0f));
+    }
+  }
+  for (i32 y = 0; y < frame->height / 2; ++y) {
+    u8* row_u = frame->data[1] + (i64)y * frame->linesize[1];
+    u8* row_v = frame->data[2] + (i64)y * frame->linesize[2];
+    for (i32 x = 0; x < frame->width / 2; ++x) {
+      row_u[x] = (u8)(x * 2 + index);
+      row_v[x] = (u8)(y * 2 - index);
+    }
+  }
+}
+
+static void SYN_WritePackets(AVCodecContext* avcc, AVFormatContext* avfc, AVStream* avst, AVPacket* pkt) {
+  while (avcodec_receive_packet(avcc, pkt) == 0) {
+    av_packet_rescale_ts(pkt, avcc->time_base, avst->time_base);
+    pkt->stream_index = avst->index;
+    int ret = av_interleaved_write_frame(avfc, pkt);
+    assert(ret >= 0);
+  }
+}
+
+// Encodes the clip into path, unless an earlier run already did
+bool SYN_Write(const char* path, u32 w, u32 h, u32 num_frames) {
+  if (SDL_GetPathInfo(path, 0)) {
+    SDL_Log("Using synthetic clip %s", path);
+    return true;
+  }
+
+  const AVCodec* avc = avcodec_find_encoder(AV_CODEC_ID_H264);
+  if (!avc) {
+    avc = avcodec_find_encoder(AV_CODEC_ID_MPEG4);
+  }
+  if (!avc) {
+    SDL_Log("No H.264 or MPEG-4 encoder for the synthetic clip");
+    return false;
+  }
+  AVCodecContext* avcc = avcodec_alloc_context3(avc);
+  assert(avcc);
+  avcc->bit_rate = BENCH_SYNTH_BIT_RATE;
+  avcc->width = w;
+  avcc->height = h;
+  avcc->time_base = { 1, 30 };
+  avcc->framerate = { 30, 1 };
+  avcc->gop_size = 30;
+  avcc->pix_fmt = AV_PIX_FMT_YUV420P;
+  avcc->thread_count = 0;
+
+  AVFormatContext* avfc = 0;
+  int ret = avformat_alloc_output_context2(&avfc, 0, 0, path);
+  assert(ret >= 0 && avfc);
+  if (avfc->oformat->flags & AVFMT_GLOBALHEADER) {
+    avcc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  }
+  ret = avcodec_open2(avcc, avc, 0);
+  assert(ret >= 0);
+  AVStream* avst = avformat_new_stream(avfc, 0);
+  assert(avst);
+  avst->time_base = avcc->time_base;
+  ret = avcodec_parameters_from_context(avst->codecpar, avcc);
+  assert(ret >= 0);
+  ret = avio_open(&avfc->pb, path, AVIO_FLAG_WRITE);
+  if (ret < 0) {
+    SDL_Log("Failed to open %s for writing", path);
+    avformat_free_context(avfc);
+    avcodec_free_context(&avcc);
+    return false;
+  }
+  ret = avformat_write_header(avfc, 0);
+  assert(ret >= 0);
+
+  SDL_Log("Encoding %u frame %ux%u synthetic clip with %s to %s", num_frames, w, h, avc->name, path);
+  AVFrame* frame = av_frame_alloc();
+  AVPacket* pkt = av_packet_alloc();
+  assert(frame && pkt);
+  frame->format = AV_PIX_FMT_YUV420P;
+  frame->width = w;
+  frame->height = h;
+  ret = av_frame_get_buffer(frame, 0);
+  assert(ret >= 0);
+  Xorshift rng;
+  for (u32 i = 0; i < num_frames; ++i) {
+    ret = av_frame_make_writable(frame);
+    assert(ret >= 0);
+    SYN_FillFrame(frame, i, &rng);
+    frame->pts = i;
+    ret = avcodec_send_frame(avcc, frame);
+    assert(ret >= 0);
+    SYN_WritePackets(avcc, avfc, avst, pkt);
+  }
+  avcodec_send_frame(avcc, 0);
+  SYN_WritePackets(avcc, avfc, avst, pkt);
+
+  ret = av_write_trailer(avfc);
+  assert(ret >= 0);
+  avio_closep(&avfc->pb);
+  avformat_free_context(avfc);
+  av_packet_free(&pkt);
+  av_frame_free(&frame);
+  avcodec_free_context(&avcc);
+  return true;
+}
+
+//
+// Upload
+//
+// Uploads go through vidshader's own texture streaming, with its ring of
+// fenced PBOs and a GPU conversion pass for YUV. Nothing waits for the GPU
+// each frame, as in the player, so the upload stage is the time to hand a
+// frame over and stalls once the GPU falls behind.
+//
+
+GLuint LoadAndCompileProgram(const char* vert_src, const char* frag_src) {
+  const char* sources[] = { vert_src, frag_src };
+  const GLenum types[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+  GLuint program = glCreateProgram();
+  GLuint shaders[2] = { };
+  for (u32 i = 0; i < 2; ++i) {
+    shaders[i] = glCreateShader(types[i]);
+    glShaderSource(shaders[i], 1, &sources[i], 0);
+    glCompileShader(shaders[i]);
+    glAttachShader(program, shaders[i]);
+  }
+  glLinkProgram(program);
+  GLint linked = 0;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if (!linked) {
+    char log[1024] = { };
+    glGetProgramInfoLog(program, sizeof(log), 0, log);
+    SDL_Log("Failed to link program: %s", log);
+  }
+  assert(linked);
+  for (u32 i = 0; i < 2; ++i) {
+    glDetachShader(program, shaders[i]);
+    glDeleteShader(shaders[i]);
+  }
+  return program;
+}
+
+//
+// Benchmark
+//
+
+static int SDLCALL BENCH_CompareU64(const void* a, const void* b) {
+  const u64 x = *(const u64*)a;
+  const u64 y = *(const u64*)b;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+// Sorts the samples in place
+static void BENCH_LogStage(u8 stage, u64* samples, u32 count) {
+  if (count == 0) {
+    return;
+  }
+  SDL_qsort(samples, count, sizeof(u64), BENCH_CompareU64);
+  u64 total = 0;
+  for (u32 i = 0; i < count; ++i) {
+    total += samples[i];
+  }
+  const u32 p99 = Min(count - 1, (count * 99 + 99) / 100 - 1);
+  SDL_Log("  %-8s min %7.3f  avg %7.3f  p99 %7.3f ms", BENCH_STAGE_NAMES[stage], (f64)samples[0] / 1e6,
+    (f64)total / count / 1e6, (f64)samples[p99] / 1e6);
+}
+
+// Next decoded frame, demuxing as needed. False at the end of the stream.
+static bool BENCH_Decode(AVFormatContext* avfc, AVCodecContext* avcc, int stream, AVPacket* pkt, AVFrame* frame) {
+  while (true) {
+    int ret = avcodec_receive_frame(avcc, frame);
+    if (ret == 0) {
+      return true;
+    }
+    if (ret != AVERROR(EAGAIN)) {
+      return false;
+    }
+    do {
+      ret = av_read_frame(avfc, pkt);
+      if (ret < 0) {
+        avcodec_send_packet(avcc, 0);
+        break;
+      }
+      if (pkt->stream_index == stream) {
+        ret = avcodec_send_packet(avcc, pkt);
+        assert(ret >= 0 || ret == AVERROR(EAGAIN));
+        av_packet_unref(pkt);
+        break;
+      }
+      av_packet_unref(pkt);
+    } while (true);
+  }
+}
+
+void BENCH_Run(const BenchOptions* opts, u32 threads, u8 convert) {
+  AV_FileInput input;
+  AVFormatContext* avfc = 0;
+  int ret = AV_FileInputOpen(&input, &avfc, opts->path, opts->input_mode);
+  assert(ret == 0);
+  avformat_find_stream_info(avfc, 0);
+  const int stream = av_find_best_stream(avfc, AVMEDIA_TYPE_VIDEO, -1, -1, 0, 0);
+  assert(stream >= 0);
+
+  const AVCodec* avc = avcodec_find_decoder(avfc->streams[stream]->codecpar->codec_id);
+  assert(avc);
+  AVCodecContext* avcc = avcodec_alloc_context3(avc);
+  assert(avcc);
+  ret = avcodec_parameters_to_context(avcc, avfc->streams[stream]->codecpar);
+  assert(ret == 0);
+  AV_DecodeBufferPool dec_buffers = { };
+  AV_DecodeBufferPoolAttach(&dec_buffers, avcc);
+  avcc->thread_count = threads;
+  avcc->thread_type = BENCH_THREAD_TYPES[opts->thread_type];
+  ret = avcodec_open2(avcc, avc, 0);
+  assert(ret == 0);
+
+  AVPacket* pkt = av_packet_alloc();
+  AVFrame* frame = av_frame_alloc();
+  assert(pkt && frame);
+  AV_Converter conv = { };
+  u8 convert_used = convert;
+  u8* rgb = 0;
+  TextureStream up = { };
+
+  u32 num_frames = 0;
+  const u64 t0 = SDL_GetTicksNS();
+  while (num_frames < opts->max_frames) {
+    const u64 t1 = SDL_GetTicksNS();
+    if (!BENCH_Decode(avfc, avcc, stream, pkt, frame)) {
+      break;
+    }
+    const u64 t2 = SDL_GetTicksNS();
+
+    // Set up from the first frame, whose format the decoder picks. As in
+    // vidshader, none uploads YUV for the shader pass, and formats it does
+    // not handle convert on the CPU anyway.
+    if (num_frames == 0) {
+      const AVPixelFormat fmt = (AVPixelFormat)frame->format;
+      if (opts->upload) {
+        TEX_Init(&up, avcc, fmt, frame->width, frame->height, convert == BENCH_CONVERT_NONE, false);
+        convert_used = up.gpu_convert ? BENCH_CONVERT_NONE : convert == BENCH_CONVERT_NONE ? (u8)AV_CONVERT_SIMD : convert;
+      }
+      if (convert_used != BENCH_CONVERT_NONE) {
+        convert_used = AV_ConverterInit(&conv, frame->width, frame->height, fmt,
+                                        frame->width, frame->height, AV_PIX_FMT_RGB24, convert_used, &g.jobs);
+        rgb = MemAlloc<u8>((usize)frame->width * frame->height * 3);
+      }
+    }
+
+    // Uploads convert straight into the mapped buffer, so there the convert
+    // stage is part of the upload one
+    if (convert_used != BENCH_CONVERT_NONE && !opts->upload) {
+      u8* const rgb_planes[] = { rgb, 0, 0, 0 };
+      const int rgb_pitches[] = { frame->width * 3, 0, 0, 0 };
+      AV_ConverterRun(&conv, frame->data, frame->linesize, rgb_planes, rgb_pitches);
+    }
+    const u64 t3 = SDL_GetTicksNS();
+
+    if (opts->upload) {
+      TEX_Upload(&up, frame, &conv);
+    }
+    const u64 t4 = SDL_GetTicksNS();
+
+    g.samples[BENCH_STAGE_DECODE][num_frames] = t2 - t1;
+    g.samples[BENCH_STAGE_CONVERT][num_frames] = t3 - t2;
+    g.samples[BENCH_STAGE_UPLOAD][num_frames] = t4 - t3;
+    ++num_frames;
+  }
+  // The total includes the GPU catching up with the last uploads
+  if (opts->upload) {
+    glFinish();
+  }
+  const f64 secs = (f64)(SDL_GetTicksNS() - t0) / (f64)SDL_NS_PER_SECOND;
+
+  SDL_Log("%s, %d decoder threads (%s), convert %s%s: %u frames in %.3fs, %.1f fps", av_get_pix_fmt_name(avcc->pix_fmt),
+    avcc->thread_count, BENCH_THREAD_TYPE_NAMES[opts->thread_type], BENCH_CONVERT_NAMES[convert_used],
+    opts->upload ? ", upload" : "", num_frames, secs, num_frames / Max(secs, 1e-9));
+  BENCH_LogStage(BENCH_STAGE_DECODE, g.samples[BENCH_STAGE_DECODE], num_frames);
+  if (convert_used != BENCH_CONVERT_NONE && !opts->upload) {
+    BENCH_LogStage(BENCH_STAGE_CONVERT, g.samples[BENCH_STAGE_CONVERT], num_frames);
+  }
+  if (opts->upload) {
+    BENCH_LogStage(BENCH_STAGE_UPLOAD, g.samples[BENCH_STAGE_UPLOAD], num_frames);
+  }
+
+  TEX_Free(&up);
+  MemFree(rgb);
+  AV_ConverterFree(&conv);
+  av_frame_free(&frame);
+  av_packet_free(&pkt);
+  avcodec_free_context(&avcc);
+  AV_DecodeBufferPoolFree(&dec_buffers);
+  avformat_close_input(&avfc);
+  AV_FileInputClose(&input);
+}
+
+//
+// Input
+//
+// Demuxing alone, with no decoding, shows what the input path costs. Which
+// mode runs first pays for a cold page cache, so modes take turns over a few
+// rounds and the best round counts; drop caches between runs to measure
+// cold reads on their own.
+//
+
+struct InputResult {
+  u8 mode;
+  f64 best_secs;
+  f64 total_secs;
+  u64 packets;
+  u64 bytes;
+  u64 reads;
+};
+
+static void BENCH_Demux(const char* path, InputResult* result) {
+  AV_FileInput input;
+  AVFormatContext* avfc = 0;
+  const u64 t0 = SDL_GetTicksNS();
+  int ret = AV_FileInputOpen(&input, &avfc, path, result->mode);
+  assert(ret == 0);
+  AVPacket* pkt = av_packet_alloc();
+  assert(pkt);
+  u64 packets = 0;
+  u64 bytes = 0;
+  while (av_read_frame(avfc, pkt) == 0) {
+    ++packets;
+    bytes += pkt->size;
+    av_packet_unref(pkt);
+  }
+  const f64 secs = (f64)(SDL_GetTicksNS() - t0) / (f64)SDL_NS_PER_SECOND;
+  av_packet_free(&pkt);
+  avformat_close_input(&avfc);
+
+  result->mode = input.mode;
+  result->best_secs = result->total_secs > 0 ? Min(result->best_secs, secs) : secs;
+  result->total_secs += secs;
+  result->packets = packets;
+  result->bytes = bytes;
+  result->reads = input.reads;
+  AV_FileInputClose(&input);
+}
+
+void BENCH_Inputs(const char* path) {
+  InputResult results[AV_INPUT_COUNT] = { };
+  for (u8 mode = 0; mode < AV_INPUT_COUNT; ++mode) {
+    results[mode].mode = mode;
+  }
+  for (u32 round = 0; round < BENCH_INPUT_ROUNDS; ++round) {
+    for (u8 mode = 0; mode < AV_INPUT_COUNT; ++mode) {
+      BENCH_Demux(path, &results[mode]);
+    }
+  }
+  for (u8 mode = 0; mode < AV_INPUT_COUNT; ++mode) {
+    const InputResult* r = &results[mode];
+    const f64 mib = (f64)r->bytes / (1 << 20);
+    SDL_Log("input %-7s: %llu packets, %.1f MiB in %.3fs best, %.3fs avg, %.1f MiB/s, %.0f packets/s, %llu reads",
+      AV_INPUT_NAMES[r->mode], (unsigned long long)r->packets, mib, r->best_secs, r->total_secs / BENCH_INPUT_ROUNDS,
+      mib / Max(r->best_secs, 1e-9), r->packets / Max(r->best_secs, 1e-9), (unsigned long long)r->reads);
+  }
+}
+
+//
+// App
+//
+
+// Parses a comma separated list of up to max numbers
+static u32 ParseList(const char* text, u32* out, u32 max) {
+  u32 count = 0;
+  while (count < max) {
+    char* end = 0;
+    const long n = SDL_strtol(text, &end, 10);
+    if (end == text) {
+      break;
+    }
+    out[count++] = (u32)Max(n, 0L);
+    if (*end != ',') {
+      break;
+    }
+    text = end + 1;
+  }
+  return count;
+}
+
+SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[]) {
+  BenchOptions opts = { };
+  opts.max_frames = BENCH_DEFAULT_FRAMES;
+  opts.synth_w = BENCH_DEFAULT_W;
+  opts.synth_h = BENCH_DEFAULT_H;
+  opts.threads[0] = 0;
+  opts.num_threads = 1;
+  opts.converts[0] = AV_CONVERT_SIMD;
+  opts.num_converts = 1;
+  opts.input_mode = AV_INPUT_MMAP;
+  bool valid_opts = true;
+  for (int i = 1; i < argc; ++i) {
+    if (SDL_strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      opts.max_frames = (u32)Max(SDL_atoi(argv[++i]), 1);
+    } else if (SDL_strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+      valid_opts &= SDL_sscanf(argv[++i], "%ux%u", &opts.synth_w, &opts.synth_h) == 2 && opts.synth_w >= 16 && opts.synth_h >= 16;
+      opts.synth_w &= ~1u;
+      opts.synth_h &= ~1u;
+    } else if (SDL_strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      opts.num_threads = ParseList(argv[++i], opts.threads, BENCH_MAX_RUNS);
+      valid_opts &= opts.num_threads > 0;
+    } else if (SDL_strcmp(argv[i], "--thread-type") == 0 && i + 1 < argc) {
+      ++i;
+      u32 type = 0;
+      while (type < SDL_arraysize(BENCH_THREAD_TYPE_NAMES) && SDL_strcmp(argv[i], BENCH_THREAD_TYPE_NAMES[type]) != 0) {
+        ++type;
+      }
+      valid_opts &= type < SDL_arraysize(BENCH_THREAD_TYPE_NAMES);
+      opts.thread_type = (u8)(type % SDL_arraysize(BENCH_THREAD_TYPES));
+    } else if (SDL_strcmp(argv[i], "--convert") == 0 && i + 1 < argc) {
+      ++i;
+      if (SDL_strcmp(argv[i], "all") == 0) {
+        for (u8 mode = 0; mode < BENCH_CONVERT_COUNT; ++mode) {
+          opts.converts[mode] = mode;
+        }
+        opts.num_converts = BENCH_CONVERT_COUNT;
+      } else {
+        u8 mode = 0;
+        while (mode < BENCH_CONVERT_COUNT && SDL_strcmp(argv[i], BENCH_CONVERT_NAMES[mode]) != 0) {
+          ++mode;
+        }
+        valid_opts &= mode < BENCH_CONVERT_COUNT;
+        opts.converts[0] = mode;
+        opts.num_converts = 1;
+      }
+    } else if (SDL_strcmp(argv[i], "--upload") == 0) {
+      opts.upload = true;
+    } else if (SDL_strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+      opts.input_mode = AV_ParseInputMode(argv[++i]);
+      valid_opts &= opts.input_mode < AV_INPUT_COUNT;
+    } else if (SDL_strcmp(argv[i], "--bench-input") == 0) {
+      opts.bench_input = true;
+    } else if (!opts.path) {
+      opts.path = argv[i];
+    } else {
+      valid_opts = false;
+    }
+  }
+  if (!valid_opts) {
+    SDL_Log("Usage: vidshader_bench [--frames <n>] [--size <w>x<h>] [--threads <n>[,<n>...]] [--thread-type auto|frame|slice] "
+            "[--convert sws|sliced|simd|none|all] [--upload] [--input default|mmap|pread] [<video path>]");
+    SDL_Log("       vidshader_bench --bench-input [<video path>]");
+    return SDL_APP_FAILURE;
+  }
+
+  if (!SDL_Init(opts.upload ? SDL_INIT_VIDEO : 0)) {
+    SDL_Log("Failed to initialize SDL: %s", SDL_GetError());
+  }
+
+  // Without a file, decode a clip of our own, kept under the pref path
+  char synth_path[1024] = { };
+  if (!opts.path) {
+    char* pref = SDL_GetPrefPath("fun", "vidshader");
+    SDL_snprintf(synth_path, sizeof(synth_path), "%sbench_%ux%u_%u.mp4", pref ? pref : "", opts.synth_w, opts.synth_h,
+      opts.max_frames);
+    SDL_free(pref);
+    if (!SYN_Write(synth_path, opts.synth_w, opts.synth_h, opts.max_frames)) {
+      return SDL_APP_FAILURE;
+    }
+    opts.path = synth_path;
+  }
+
+  // Uploads need a context but never show anything
+  if (opts.upload) {
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+    if (!(g.wnd = SDL_CreateWindow(__FILE__, 64, 64, SDL_WINDOW_HIDDEN | SDL_WINDOW_OPENGL))) {
+      SDL_Log("Failed to create SDL window: %s", SDL_GetError());
+      return SDL_APP_FAILURE;
+    }
+    if (!(g.gl = SDL_GL_CreateContext(g.wnd))) {
+      SDL_Log("Failed to create OpenGL context for window: %s", SDL_GetError());
+      return SDL_APP_FAILURE;
+    }
+    if (!gladLoadGLLoader((GLADloadproc)SDL_GL_GetProcAddress)) {
+      SDL_Log("Failed to load OpenGL functions");
+      return SDL_APP_FAILURE;
+    }
+    SDL_GL_SetSwapInterval(0);
+    TEX_CreateQuad(&g.quad_vao, &g.quad_vbo, &g.quad_ibo);
+  }
+
+  if (opts.bench_input) {
+    SDL_Log("Benchmarking input for %s, %u rounds", opts.path, BENCH_INPUT_ROUNDS);
+    BENCH_Inputs(opts.path);
+    return SDL_APP_SUCCESS;
+  }
+
+  g.jobs.Init();
+  for (u8 stage = 0; stage < BENCH_STAGE_COUNT; ++stage) {
+    g.samples[stage] = MemAlloc<u64>(opts.max_frames);
+  }
+  SDL_Log("Benchmarking %s, %u job threads", opts.path, g.jobs.Concurrency());
+  for (u32 t = 0; t < opts.num_threads; ++t) {
+    for (u32 c = 0; c < opts.num_converts; ++c) {
+      BENCH_Run(&opts, opts.threads[t], opts.converts[c]);
+    }
+  }
+  return SDL_APP_SUCCESS;
+}
+
+SDL_AppResult SDL_AppIterate(void* appstate) {
+  return SDL_APP_SUCCESS;
+}
+
+SDL_AppResult SDL_AppEvent(void* appstate, SDL_Event* event) {
+  return SDL_APP_CONTINUE;
+}
+
+void SDLCALL SDL_AppQuit(void* appstate, SDL_AppResult result) {
+  for (u8 stage = 0; stage < BENCH_STAGE_COUNT; ++stage) {
+    MemFree(g.samples[stage]);
+  }
+  g.jobs.Shutdown();
+  if (g.gl) {
+    SDL_GL_DestroyContext(g.gl);
+  }
+  SDL_DestroyWindow(g.wnd);
+  SDL_Quit();
+}
@@ -0,0 +1,429 @@
+#ifndef _VIDSHADER_TEX_HH_
+#define _VIDSHADER_TEX_HH_
+
+#include "common_core.hh"
+#include "common_av.hh"
+#include "common_math.hh"
+
+#include <SDL3/SDL.h>
+
+#include <glad/glad.h>
+
+//
+// Texture streaming
+//
+// Frames are written straight into one of a ring of pixel buffer objects and
+// copied into immutable texture storage from there, so the driver transfers
+// one frame while the next is being written. Buffers are mapped persistently
+// when GL_ARB_buffer_storage is available and otherwise mapped unsynchronized
+// each frame; either way a fence guards reuse.
+//
+// Planar 8-bit YUV and NV12 frames are uploaded as they are, one single or
+// two channel texture per plane, and a shader pass converts them into the
+// stream's texture. Other formats, or --convert with a CPU mode, convert to
+// RGB24 on the CPU instead.
+//
+// vidshader and vidshader_bench share this, so the benchmark times the path
+// the player runs. The shader pass draws the quad from TEX_CreateQuad, which
+// must be bound, and programs come from LoadAndCompileProgram, which the
+// including program defines.
+//
+
+GLuint LoadAndCompileProgram(const char* vert_src, const char* frag_src);
+
+struct Vertex {
+  Vec2 position;
+  Vec2 texcoord;
+};
+
+const char* const VERTEX_SHADER = R"""(#version 330 core
+
+layout (location = 0) in vec2 v_position;
+layout (location = 1) in vec2 v_texcoord;
+
+out vec2 texcoord;
+
+// Intermediate pipeline passes render upside down so their targets keep the
+// top row first, like the video texture
+uniform bool u_flip;
+
+void main() {
+  texcoord = vec2(v_texcoord.x, 1.0f - v_texcoord.y);
+  gl_Position = vec4(v_position.x, u_flip ? -v_position.y : v_position.y, -1.0f, 1.0f);
+}
+)""";
+
+// Converts the uploaded planes of a YUV frame into the RGB texture that the
+// user shader samples as u_sampler
+const char* const YUV_FRAGMENT_SHADER = R"""(#version 330 core
+
+out vec4 color;
+
+uniform sampler2D u_plane_y;
+uniform sampler2D u_plane_u;
+uniform sampler2D u_plane_v;
+uniform bool u_nv12;
+uniform vec2 u_resolution;
+uniform vec3 u_offset;
+uniform mat3 u_matrix;
+
+void main() {
+  vec2 uv = gl_FragCoord.xy / u_resolution;
+  vec3 yuv;
+  yuv.x = texture(u_plane_y, uv).r;
+  yuv.yz = u_nv12 ? texture(u_plane_u, uv).rg : vec2(texture(u_plane_u, uv).r, texture(u_plane_v, uv).r);
+  color = vec4(clamp(u_matrix * (yuv - u_offset), 0.0f, 1.0f), 1.0f);
+}
+
+)""";
+
+constexpr u32 TEX_PBO_COUNT = 3;
+
+#ifndef GL_MAP_PERSISTENT_BIT
+# define GL_MAP_PERSISTENT_BIT 0x0040
+# define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+// GL_ARB_texture_storage and GL_ARB_buffer_storage, which the 3.3 loader
+// does not cover
+typedef void (APIENTRYP PFN_TexStorage2D)(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+typedef void (APIENTRYP PFN_BufferStorage)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+constexpr u32 TEX_MAX_PLANES = 3;
+
+struct TextureStream {
+  // RGB frame the rest of the app samples
+  GLuint texture;
+  u32 w;
+  u32 h;
+  u32 levels;
+  // Either one RGB24 plane converted on the CPU straight into texture, or
+  // the frame's own planes converted into it by a shader pass
+  bool gpu_convert;
+  u32 num_planes;
+  u32 plane_w[TEX_MAX_PLANES];
+  u32 plane_h[TEX_MAX_PLANES];
+  u32 plane_bpp[TEX_MAX_PLANES];
+  usize plane_offset[TEX_MAX_PLANES];
+  GLuint plane_tex[TEX_MAX_PLANES];
+  usize size;
+  GLuint fbo;
+  GLuint program;
+  GLuint pbo[TEX_PBO_COUNT];
+  GLsync fence[TEX_PBO_COUNT];
+  u8* mapped[TEX_PBO_COUNT];
+  u32 next;
+  bool persistent;
+};
+
+static inline void TEX_CreateQuad(GLuint* vao, GLuint* vbo, GLuint* ibo) {
+  const Vertex quad_verts[] = {
+    { Vec2(-1.0f,  1.0f), Vec2(0.0f, 1.0f) }, // top-left
+    { Vec2( 1.0f,  1.0f), Vec2(1.0f, 1.0f) }, // top-right
+    { Vec2( 1.0f, -1.0f), Vec2(1.0f, 0.0f) }, // bottom-right
+    { Vec2(-1.0f, -1.0f), Vec2(0.0f, 0.0f) }, // bottom-left
+  };
+
+  const u16 quad_indices[] = {
+    0, 1, 2,
+    0, 2, 3,
+  };
+
+  glGenVertexArrays(1, vao);
+  glBindVertexArray(*vao);
+
+  glGenBuffers(1, vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, *vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(quad_verts), quad_verts, GL_STATIC_DRAW);
+
+  glGenBuffers(1, ibo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(quad_indices), quad_indices, GL_STATIC_DRAW);
+
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texcoord));
+  glEnableVertexAttribArray(0);
+  glEnableVertexAttribArray(1);
+}
+
+// Plane bytes per pixel for formats converted on the GPU, or 0
+static inline u32 TEX_GPUPlaneLayout(AVPixelFormat fmt, u32* bpp) {
+  switch (fmt) {
+  case AV_PIX_FMT_YUV420P: case AV_PIX_FMT_YUVJ420P:
+  case AV_PIX_FMT_YUV422P: case AV_PIX_FMT_YUVJ422P:
+  case AV_PIX_FMT_YUV444P: case AV_PIX_FMT_YUVJ444P: {
+    bpp[0] = bpp[1] = bpp[2] = 1;
+    return 3;
+  }
+  case AV_PIX_FMT_NV12: {
+    bpp[0] = 1;
+    bpp[1] = 2;
+    return 2;
+  }
+  default: {
+    return 0;
+  }
+  }
+}
+
+static const GLenum TEX_FORMATS[][2] = {
+  { 0, 0 },
+  { GL_R8, GL_RED },
+  { GL_RG8, GL_RG },
+  { GL_RGB8, GL_RGB },
+};
+
+static inline GLuint TEX_CreateTexture(PFN_TexStorage2D tex_storage_2d, u32 bpp, u32 w, u32 h, u32 levels) {
+  GLuint texture = 0;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  if (tex_storage_2d) {
+    tex_storage_2d(GL_TEXTURE_2D, levels, TEX_FORMATS[bpp][0], w, h);
+  } else {
+    for (u32 level = 0; level < levels; ++level) {
+      glTexImage2D(GL_TEXTURE_2D, level, TEX_FORMATS[bpp][0], Max(w >> level, 1u), Max(h >> level, 1u), 0,
+        TEX_FORMATS[bpp][1], GL_UNSIGNED_BYTE, 0);
+    }
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  return texture;
+}
+
+// YUV -> RGB for the decoder's colour matrix and range, as a column-major
+// matrix applied after subtracting offset from normalized samples
+static inline void TEX_ColourMatrix(const AVCodecContext* avcc, AVPixelFormat fmt, u32 h, f32* matrix, f32* offset) {
+  f64 kr = 0.299;
+  f64 kb = 0.114;
+  switch (avcc->colorspace) {
+  case AVCOL_SPC_BT709: {
+    kr = 0.2126;
+    kb = 0.0722;
+  } break;
+  case AVCOL_SPC_BT2020_NCL: {
+    kr = 0.2627;
+    kb = 0.0593;
+  } break;
+  case AVCOL_SPC_SMPTE240M: {
+    kr = 0.212;
+    kb = 0.087;
+  } break;
+  case AVCOL_SPC_BT470BG: case AVCOL_SPC_SMPTE170M: case AVCOL_SPC_FCC: {
+  } break;
+  default: {
+    // Unspecified: HD is almost always BT.709
+    if (h > 576) {
+      kr = 0.2126;
+      kb = 0.0722;
+    }
+  } break;
+  }
+  const f64 kg = 1.0 - kr - kb;
+
+  const bool full = avcc->color_range == AVCOL_RANGE_JPEG ||
+    fmt == AV_PIX_FMT_YUVJ420P || fmt == AV_PIX_FMT_YUVJ422P || fmt == AV_PIX_FMT_YUVJ444P;
+  const f64 ys = full ? 1.0 : 255.0 / 219.0;
+  const f64 cs = full ? 1.0 : 255.0 / 224.0;
+  offset[0] = full ? 0.0f : 16.0f / 255.0f;
+  offset[1] = 128.0f / 255.0f;
+  offset[2] = 128.0f / 255.0f;
+
+  const f64 m[9] = {
+    ys, ys, ys,
+    0.0, -2.0 * kb * (1.0 - kb) / kg * cs, 2.0 * (1.0 - kb) * cs,
+    2.0 * (1.0 - kr) * cs, -2.0 * kr * (1.0 - kr) / kg * cs, 0.0,
+  };
+  for (u32 i = 0; i < 9; ++i) {
+    matrix[i] = (f32)m[i];
+  }
+}
+
+static inline void TEX_Init(TextureStream* stream, const AVCodecContext* avcc, AVPixelFormat fmt, u32 w, u32 h, bool gpu_convert, bool use_mips) {
+  *stream = { };
+  stream->w = w;
+  stream->h = h;
+  stream->levels = 1;
+  if (use_mips) {
+    for (u32 size = Max(w, h); size > 1; size /= 2) {
+      ++stream->levels;
+    }
+  }
+
+  // Upload layout
+  stream->gpu_convert = gpu_convert && TEX_GPUPlaneLayout(fmt, stream->plane_bpp) > 0;
+  if (stream->gpu_convert) {
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(fmt);
+    stream->num_planes = TEX_GPUPlaneLayout(fmt, stream->plane_bpp);
+    for (u32 p = 0; p < stream->num_planes; ++p) {
+      const u32 shift_w = p == 0 ? 0 : desc->log2_chroma_w;
+      const u32 shift_h = p == 0 ? 0 : desc->log2_chroma_h;
+      stream->plane_w[p] = (w + (1u << shift_w) - 1) >> shift_w;
+      stream->plane_h[p] = (h + (1u << shift_h) - 1) >> shift_h;
+    }
+  } else {
+    stream->num_planes = 1;
+    stream->plane_w[0] = w;
+    stream->plane_h[0] = h;
+    stream->plane_bpp[0] = 3;
+  }
+  stream->size = 0;
+  for (u32 p = 0; p < stream->num_planes; ++p) {
+    stream->plane_offset[p] = stream->size;
+    stream->size += (usize)stream->plane_w[p] * stream->plane_bpp[p] * stream->plane_h[p];
+  }
+
+  PFN_TexStorage2D tex_storage_2d = 0;
+  if (SDL_GL_ExtensionSupported("GL_ARB_texture_storage")) {
+    tex_storage_2d = (PFN_TexStorage2D)SDL_GL_GetProcAddress("glTexStorage2D");
+  }
+
+  // Textures, with the shader pass drawing into stream->texture
+  if (stream->gpu_convert) {
+    for (u32 p = 0; p < stream->num_planes; ++p) {
+      stream->plane_tex[p] = TEX_CreateTexture(tex_storage_2d, stream->plane_bpp[p], stream->plane_w[p], stream->plane_h[p], 1);
+    }
+    stream->texture = TEX_CreateTexture(tex_storage_2d, 3, w, h, stream->levels);
+    glGenFramebuffers(1, &stream->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, stream->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, stream->texture, 0);
+    assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    f32 matrix[9] = { };
+    f32 offset[3] = { };
+    TEX_ColourMatrix(avcc, fmt, h, matrix, offset);
+    const Vec2 resolution = Vec2((f32)w, (f32)h);
+    stream->program = LoadAndCompileProgram(VERTEX_SHADER, YUV_FRAGMENT_SHADER);
+    glUseProgram(stream->program);
+    glUniform1i(glGetUniformLocation(stream->program, "u_plane_y"), 0);
+    glUniform1i(glGetUniformLocation(stream->program, "u_plane_u"), 1);
+    glUniform1i(glGetUniformLocation(stream->program, "u_plane_v"), 2);
+    glUniform1i(glGetUniformLocation(stream->program, "u_nv12"), fmt == AV_PIX_FMT_NV12);
+    glUniform2fv(glGetUniformLocation(stream->program, "u_resolution"), 1, &resolution.x);
+    glUniform3fv(glGetUniformLocation(stream->program, "u_offset"), 1, offset);
+    glUniformMatrix3fv(glGetUniformLocation(stream->program, "u_matrix"), 1, GL_FALSE, matrix);
+  } else {
+    stream->texture = TEX_CreateTexture(tex_storage_2d, 3, w, h, stream->levels);
+    stream->plane_tex[0] = stream->texture;
+  }
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, stream->texture);
+  // Rows are tightly packed
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  PFN_BufferStorage buffer_storage = 0;
+  if (SDL_GL_ExtensionSupported("GL_ARB_buffer_storage")) {
+    buffer_storage = (PFN_BufferStorage)SDL_GL_GetProcAddress("glBufferStorage");
+  }
+  stream->persistent = buffer_storage != 0;
+
+  glGenBuffers(TEX_PBO_COUNT, stream->pbo);
+  for (u32 i = 0; i < TEX_PBO_COUNT; ++i) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stream->pbo[i]);
+    if (stream->persistent) {
+      const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      buffer_storage(GL_PIXEL_UNPACK_BUFFER, stream->size, 0, flags);
+      stream->mapped[i] = (u8*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, stream->size, flags);
+      assert(stream->mapped[i]);
+    } else {
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, stream->size, 0, GL_STREAM_DRAW);
+    }
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  SDL_Log("Texture streaming: %s conversion, %u PBOs, %s mapping, %s storage, %u mip levels",
+    stream->gpu_convert ? "GPU" : "CPU", TEX_PBO_COUNT, stream->persistent ? "persistent" : "per-frame",
+    tex_storage_2d ? "immutable" : "mutable", stream->levels);
+}
+
+// Frames must match the size and format the stream was set up for. CPU
+// conversion writes through conv straight into the mapped buffer.
+static inline void TEX_Upload(TextureStream* stream, const AVFrame* frame, AV_Converter* conv) {
+  const u32 idx = stream->next;
+  stream->next = (stream->next + 1) % TEX_PBO_COUNT;
+
+  // The transfer that last read this buffer must be done with it
+  if (stream->fence[idx]) {
+    while (glClientWaitSync(stream->fence[idx], GL_SYNC_FLUSH_COMMANDS_BIT, SDL_NS_PER_SECOND) == GL_TIMEOUT_EXPIRED) { }
+    glDeleteSync(stream->fence[idx]);
+    stream->fence[idx] = 0;
+  }
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stream->pbo[idx]);
+  u8* pixels = stream->mapped[idx];
+  if (!stream->persistent) {
+    pixels = (u8*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, stream->size,
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    assert(pixels);
+  }
+
+  if (stream->gpu_convert) {
+    for (u32 p = 0; p < stream->num_planes; ++p) {
+      const usize row = (usize)stream->plane_w[p] * stream->plane_bpp[p];
+      u8* dst = pixels + stream->plane_offset[p];
+      for (u32 y = 0; y < stream->plane_h[p]; ++y) {
+        SDL_memcpy(dst + y * row, frame->data[p] + (i64)y * frame->linesize[p], row);
+      }
+    }
+  } else {
+    u8* const rgb_planes[] = { pixels, 0, 0, 0 };
+    const int rgb_pitches[] = { (int)stream->w * 3, 0, 0, 0 };
+    AV_ConverterRun(conv, frame->data, frame->linesize, rgb_planes, rgb_pitches);
+  }
+
+  if (!stream->persistent) {
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  }
+  for (u32 p = 0; p < stream->num_planes; ++p) {
+    glActiveTexture(GL_TEXTURE0 + p);
+    glBindTexture(GL_TEXTURE_2D, stream->plane_tex[p]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, stream->plane_w[p], stream->plane_h[p],
+      TEX_FORMATS[stream->plane_bpp[p]][1], GL_UNSIGNED_BYTE, (const void*)stream->plane_offset[p]);
+  }
+  stream->fence[idx] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  // Convert into stream->texture with the planes still bound to units 0-2
+  if (stream->gpu_convert) {
+    glBindFramebuffer(GL_FRAMEBUFFER, stream->fbo);
+    glViewport(0, 0, stream->w, stream->h);
+    glUseProgram(stream->program);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, stream->texture);
+  if (stream->levels > 1) {
+    glGenerateMipmap(GL_TEXTURE_2D);
+  }
+}
+
+static inline void TEX_Free(TextureStream* stream) {
+  if (!stream->texture) {
+    return;
+  }
+  for (u32 i = 0; i < TEX_PBO_COUNT; ++i) {
+    if (stream->fence[i]) {
+      glDeleteSync(stream->fence[i]);
+    }
+    if (stream->mapped[i]) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stream->pbo[i]);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glDeleteBuffers(TEX_PBO_COUNT, stream->pbo);
+  if (stream->gpu_convert) {
+    glDeleteTextures(stream->num_planes, stream->plane_tex);
+    glDeleteFramebuffers(1, &stream->fbo);
+    glDeleteProgram(stream->program);
+  }
+  glDeleteTextures(1, &stream->texture);
+  *stream = { };
+}
+
+#endif // _VIDSHADER_TEX_HH_
@@ -0,0 +1,908 @@
+#ifndef _COMMON_AV_HH_
+#define _COMMON_AV_HH_
+
+#include "common_core.hh"
+#include "common_thread.hh"
+
+#ifdef FUN_X64
+# include <immintrin.h>
+#endif
+
+#ifdef FUN_POSIX
+# include <cerrno>
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+
+extern "C" {
+  #include <libavcodec/avcodec.h>
+  #include <libavformat/avformat.h>
+  #include <libavutil/imgutils.h>
+  #include <libavutil/pixdesc.h>
+  #include <libswscale/swscale.h>
+}
+
+//
+// Colour conversion
+//
+// BT.601 limited range, matching what swscale produces for RGB24 <-> YUV420P
+// by default. Widths and heights must be even.
+//
+
+static inline u8 AV_RGBToY(i32 r, i32 g, i32 b) {
+  return (u8)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+static inline u8 AV_RGBToU(i32 r, i32 g, i32 b) {
+  return (u8)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+}
+
+static inline u8 AV_RGBToV(i32 r, i32 g, i32 b) {
+  return (u8)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+static inline void AV_YUVToRGB(i32 y, i32 u, i32 v, u8* rgb) {
+  const i32 c = y - 16;
+  const i32 d = u - 128;
+  const i32 e = v - 128;
+  rgb[0] = (u8)Clamp((298 * c + 409 * e + 128) >> 8, 0, 255);
+  rgb[1] = (u8)Clamp((298 * c - 100 * d - 208 * e + 128) >> 8, 0, 255);
+  rgb[2] = (u8)Clamp((298 * c + 516 * d + 128) >> 8, 0, 255);
+}
+
+// Convert a w x h block of packed RGB24. dst_y points at the block's first
+// luma sample and dst_u/dst_v at its first chroma samples.
+static inline void AV_ConvertRGB24ToYUV420P_Scalar(const u8* src, usize src_pitch, u32 w, u32 h,
+                                                   u8* dst_y, usize pitch_y, u8* dst_u, usize pitch_u, u8* dst_v, usize pitch_v) {
+  for (u32 y = 0; y < h; y += 2) {
+    const u8* s0 = src + y * src_pitch;
+    const u8* s1 = s0 + src_pitch;
+    u8* y0 = dst_y + y * pitch_y;
+    u8* y1 = y0 + pitch_y;
+    u8* u = dst_u + (y / 2) * pitch_u;
+    u8* v = dst_v + (y / 2) * pitch_v;
+    for (u32 x = 0; x < w; x += 2) {
+      const u8* p00 = s0 + x * 3;
+      const u8* p01 = p00 + 3;
+      const u8* p10 = s1 + x * 3;
+      const u8* p11 = p10 + 3;
+      y0[x + 0] = AV_RGBToY(p00[0], p00[1], p00[2]);
+      y0[x + 1] = AV_RGBToY(p01[0], p01[1], p01[2]);
+      y1[x + 0] = AV_RGBToY(p10[0], p10[1], p10[2]);
+      y1[x + 1] = AV_RGBToY(p11[0], p11[1], p11[2]);
+      const i32 r = (p00[0] + p01[0] + p10[0] + p11[0] + 2) >> 2;
+      const i32 g = (p00[1] + p01[1] + p10[1] + p11[1] + 2) >> 2;
+      const i32 b = (p00[2] + p01[2] + p10[2] + p11[2] + 2) >> 2;
+      u[x / 2] = AV_RGBToU(r, g, b);
+      v[x / 2] = AV_RGBToV(r, g, b);
+    }
+  }
+}
+
+static inline void AV_ConvertYUV420PToRGB24_Scalar(const u8* src_y, usize pitch_y, const u8* src_u, usize pitch_u, const u8* src_v, usize pitch_v,
+                                                   u32 w, u32 h, u8* dst, usize dst_pitch) {
+  for (u32 y = 0; y < h; ++y) {
+    const u8* row_y = src_y + y * pitch_y;
+    const u8* row_u = src_u + (y / 2) * pitch_u;
+    const u8* row_v = src_v + (y / 2) * pitch_v;
+    u8* out = dst + y * dst_pitch;
+    for (u32 x = 0; x < w; ++x) {
+      AV_YUVToRGB(row_y[x], row_u[x / 2], row_v[x / 2], &out[x * 3]);
+    }
+  }
+}
+
+#ifdef FUN_X64
+
+// pshufb masks moving bytes between packed RGB24 (3 x 16 bytes) and planar
+// R, G, B vectors (16 pixels each)
+struct AV_RGB24ShuffleMasks {
+  alignas(16) u8 unpack[3][3][16]; // [channel][source block] -> planar
+  alignas(16) u8 pack[3][3][16];   // [output block][channel] -> packed
+
+  AV_RGB24ShuffleMasks() {
+    for (u32 c = 0; c < 3; ++c) {
+      for (u32 b = 0; b < 3; ++b) {
+        for (u32 k = 0; k < 16; ++k) {
+          const u32 src_byte = k * 3 + c;
+          unpack[c][b][k] = (src_byte / 16 == b) ? (u8)(src_byte % 16) : 0x80;
+          const u32 out_byte = b * 16 + k;
+          pack[b][c][k] = (out_byte % 3 == c) ? (u8)(out_byte / 3) : 0x80;
+        }
+      }
+    }
+  }
+};
+
+static const AV_RGB24ShuffleMasks AV_RGB24_MASKS;
+
+FUN_TARGET("ssse3")
+static inline void AV_UnpackRGB24_SSSE3(const u8* src, __m128i* r, __m128i* g, __m128i* b) {
+  const __m128i in0 = _mm_loadu_si128((const __m128i*)(src + 0));
+  const __m128i in1 = _mm_loadu_si128((const __m128i*)(src + 16));
+  const __m128i in2 = _mm_loadu_si128((const __m128i*)(src + 32));
+  __m128i* out[3] = { r, g, b };
+  for (u32 c = 0; c < 3; ++c) {
+    *out[c] = _mm_or_si128(_mm_or_si128(
+      _mm_shuffle_epi8(in0, _mm_load_si128((const __m128i*)AV_RGB24_MASKS.unpack[c][0])),
+      _mm_shuffle_epi8(in1, _mm_load_si128((const __m128i*)AV_RGB24_MASKS.unpack[c][1]))),
+      _mm_shuffle_epi8(in2, _mm_load_si128((const __m128i*)AV_RGB24_MASKS.unpack[c][2])));
+  }
+}
+
+FUN_TARGET("ssse3")
+static inline void AV_PackRGB24_SSSE3(__m128i r, __m128i g, __m128i b, u8* dst) {
+  for (u32 k = 0; k < 3; ++k) {
+    const __m128i out = _mm_or_si128(_mm_or_si128(
+      _mm_shuffle_epi8(r, _mm_load_si128((const __m128i*)AV_RGB24_MASKS.pack[k][0])),
+      _mm_shuffle_epi8(g, _mm_load_si128((const __m128i*)AV_RGB24_MASKS.pack[k][1]))),
+      _mm_shuffle_epi8(b, _mm_load_si128((const __m128i*)AV_RGB24_MASKS.pack[k][2])));
+    _mm_storeu_si128((__m128i*)(dst + k * 16), out);
+  }
+}
+
+// Y for 8 pixels held as u16
+FUN_TARGET("ssse3")
+static inline __m128i AV_LumaRGB16_SSSE3(__m128i r, __m128i g, __m128i b) {
+  __m128i y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)), _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+  y = _mm_add_epi16(y, _mm_mullo_epi16(b, _mm_set1_epi16(25)));
+  y = _mm_srli_epi16(_mm_add_epi16(y, _mm_set1_epi16(128)), 8);
+  return _mm_add_epi16(y, _mm_set1_epi16(16));
+}
+
+FUN_TARGET("ssse3")
+static inline __m128i AV_Luma16_SSSE3(__m128i r, __m128i g, __m128i b) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i lo = AV_LumaRGB16_SSSE3(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(g, zero), _mm_unpacklo_epi8(b, zero));
+  const __m128i hi = AV_LumaRGB16_SSSE3(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero), _mm_unpackhi_epi8(b, zero));
+  return _mm_packus_epi16(lo, hi);
+}
+
+// 2x2 averages of one channel over two rows of 16 pixels, as 8 x u16
+FUN_TARGET("ssse3")
+static inline __m128i AV_Average2x2_SSSE3(__m128i row0, __m128i row1) {
+  const __m128i ones = _mm_set1_epi8(1);
+  const __m128i sum = _mm_add_epi16(_mm_maddubs_epi16(row0, ones), _mm_maddubs_epi16(row1, ones));
+  return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}
+
+FUN_TARGET("ssse3")
+static inline __m128i AV_Chroma8_SSSE3(__m128i r, __m128i g, __m128i b, i16 kr, i16 kg, i16 kb) {
+  __m128i c = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(kr)), _mm_mullo_epi16(g, _mm_set1_epi16(kg)));
+  c = _mm_add_epi16(c, _mm_mullo_epi16(b, _mm_set1_epi16(kb)));
+  c = _mm_srai_epi16(_mm_add_epi16(c, _mm_set1_epi16(128)), 8);
+  return _mm_add_epi16(c, _mm_set1_epi16(128));
+}
+
+FUN_TARGET("ssse3")
+static void AV_ConvertRGB24ToYUV420P_SSSE3(const u8* src, usize src_pitch, u32 w, u32 h,
+                                           u8* dst_y, usize pitch_y, u8* dst_u, usize pitch_u, u8* dst_v, usize pitch_v) {
+  const u32 w16 = w & ~15u;
+  for (u32 y = 0; y < h; y += 2) {
+    const u8* s0 = src + y * src_pitch;
+    const u8* s1 = s0 + src_pitch;
+    u8* y0 = dst_y + y * pitch_y;
+    u8* y1 = y0 + pitch_y;
+    u8* u = dst_u + (y / 2) * pitch_u;
+    u8* v = dst_v + (y / 2) * pitch_v;
+    for (u32 x = 0; x < w16; x += 16) {
+      __m128i r0, g0, b0, r1, g1, b1;
+      AV_UnpackRGB24_SSSE3(s0 + x * 3, &r0, &g0, &b0);
+      AV_UnpackRGB24_SSSE3(s1 + x * 3, &r1, &g1, &b1);
+      _mm_storeu_si128((__m128i*)(y0 + x), AV_Luma16_SSSE3(r0, g0, b0));
+      _mm_storeu_si128((__m128i*)(y1 + x), AV_Luma16_SSSE3(r1, g1, b1));
+
+      const __m128i r = AV_Average2x2_SSSE3(r0, r1);
+      const __m128i g = AV_Average2x2_SSSE3(g0, g1);
+      const __m128i b = AV_Average2x2_SSSE3(b0, b1);
+      const __m128i cu = AV_Chroma8_SSSE3(r, g, b, -38, -74, 112);
+      const __m128i cv = AV_Chroma8_SSSE3(r, g, b, 112, -94, -18);
+      _mm_storel_epi64((__m128i*)(u + x / 2), _mm_packus_epi16(cu, cu));
+      _mm_storel_epi64((__m128i*)(v + x / 2), _mm_packus_epi16(cv, cv));
+    }
+  }
+  if (w16 < w) {
+    AV_ConvertRGB24ToYUV420P_Scalar(src + w16 * 3, src_pitch, w - w16, h,
+      dst_y + w16, pitch_y, dst_u + w16 / 2, pitch_u, dst_v + w16 / 2, pitch_v);
+  }
+}
+
+// (a * ka + b * kb + bias) >> 8 for 8 i16 pairs, saturated to 8 x i16
+FUN_TARGET("ssse3")
+static inline __m128i AV_MaddPair_SSSE3(__m128i a, __m128i b, i16 ka, i16 kb, __m128i extra_lo, __m128i extra_hi) {
+  const __m128i k = _mm_set_epi16(kb, ka, kb, ka, kb, ka, kb, ka);
+  const __m128i lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(a, b), k), extra_lo), 8);
+  const __m128i hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(a, b), k), extra_hi), 8);
+  return _mm_packs_epi32(lo, hi);
+}
+
+// RGB for 8 pixels from i16 c = y - 16 and per-pixel d = u - 128, e = v - 128
+FUN_TARGET("ssse3")
+static inline void AV_RGB8_SSSE3(__m128i c, __m128i d, __m128i e, __m128i* r, __m128i* g, __m128i* b) {
+  const __m128i bias = _mm_set1_epi32(128);
+  // -208 * e + 128 as the second half of the green sum
+  const __m128i one = _mm_set1_epi16(1);
+  const __m128i k_e = _mm_set_epi16(128, -208, 128, -208, 128, -208, 128, -208);
+  const __m128i ge_lo = _mm_madd_epi16(_mm_unpacklo_epi16(e, one), k_e);
+  const __m128i ge_hi = _mm_madd_epi16(_mm_unpackhi_epi16(e, one), k_e);
+  *r = AV_MaddPair_SSSE3(c, e, 298, 409, bias, bias);
+  *g = AV_MaddPair_SSSE3(c, d, 298, -100, ge_lo, ge_hi);
+  *b = AV_MaddPair_SSSE3(c, d, 298, 516, bias, bias);
+}
+
+FUN_TARGET("ssse3")
+static void AV_ConvertYUV420PToRGB24_SSSE3(const u8* src_y, usize pitch_y, const u8* src_u, usize pitch_u, const u8* src_v, usize pitch_v,
+                                           u32 w, u32 h, u8* dst, usize dst_pitch) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i k16 = _mm_set1_epi16(16);
+  const __m128i k128 = _mm_set1_epi16(128);
+  const u32 w16 = w & ~15u;
+  for (u32 y = 0; y < h; ++y) {
+    const u8* row_y = src_y + y * pitch_y;
+    const u8* row_u = src_u + (y / 2) * pitch_u;
+    const u8* row_v = src_v + (y / 2) * pitch_v;
+    u8* out = dst + y * dst_pitch;
+    for (u32 x = 0; x < w16; x += 16) {
+      const __m128i yy = _mm_loadu_si128((const __m128i*)(row_y + x));
+      // Duplicate each chroma sample for its two pixels
+      const __m128i uu = _mm_loadl_epi64((const __m128i*)(row_u + x / 2));
+      const __m128i vv = _mm_loadl_epi64((const __m128i*)(row_v + x / 2));
+      const __m128i u2 = _mm_unpacklo_epi8(uu, uu);
+      const __m128i v2 = _mm_unpacklo_epi8(vv, vv);
+
+      __m128i r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+      AV_RGB8_SSSE3(_mm_sub_epi16(_mm_unpacklo_epi8(yy, zero), k16),
+                    _mm_sub_epi16(_mm_unpacklo_epi8(u2, zero), k128),
+                    _mm_sub_epi16(_mm_unpacklo_epi8(v2, zero), k128), &r_lo, &g_lo, &b_lo);
+      AV_RGB8_SSSE3(_mm_sub_epi16(_mm_unpackhi_epi8(yy, zero), k16),
+                    _mm_sub_epi16(_mm_unpackhi_epi8(u2, zero), k128),
+                    _mm_sub_epi16(_mm_unpackhi_epi8(v2, zero), k128), &r_hi, &g_hi, &b_hi);
+      AV_PackRGB24_SSSE3(_mm_packus_epi16(r_lo, r_hi), _mm_packus_epi16(g_lo, g_hi), _mm_packus_epi16(b_lo, b_hi), out + x * 3);
+    }
+  }
+  if (w16 < w) {
+    AV_ConvertYUV420PToRGB24_Scalar(src_y + w16, pitch_y, src_u + w16 / 2, pitch_u, src_v + w16 / 2, pitch_v,
+      w - w16, h, dst + w16 * 3, dst_pitch);
+  }
+}
+
+#endif // FUN_X64
+
+static inline void AV_ConvertRGB24ToYUV420P(const u8* src, usize src_pitch, u32 w, u32 h,
+                                            u8* dst_y, usize pitch_y, u8* dst_u, usize pitch_u, u8* dst_v, usize pitch_v) {
+#ifdef FUN_X64
+  static const bool has_ssse3 = CPU_HasSSSE3();
+  if (has_ssse3) {
+    AV_ConvertRGB24ToYUV420P_SSSE3(src, src_pitch, w, h, dst_y, pitch_y, dst_u, pitch_u, dst_v, pitch_v);
+    return;
+  }
+#endif
+  AV_ConvertRGB24ToYUV420P_Scalar(src, src_pitch, w, h, dst_y, pitch_y, dst_u, pitch_u, dst_v, pitch_v);
+}
+
+static inline void AV_ConvertYUV420PToRGB24(const u8* src_y, usize pitch_y, const u8* src_u, usize pitch_u, const u8* src_v, usize pitch_v,
+                                            u32 w, u32 h, u8* dst, usize dst_pitch) {
+#ifdef FUN_X64
+  static const bool has_ssse3 = CPU_HasSSSE3();
+  if (has_ssse3) {
+    AV_ConvertYUV420PToRGB24_SSSE3(src_y, pitch_y, src_u, pitch_u, src_v, pitch_v, w, h, dst, dst_pitch);
+    return;
+  }
+#endif
+  AV_ConvertYUV420PToRGB24_Scalar(src_y, pitch_y, src_u, pitch_u, src_v, pitch_v, w, h, dst, dst_pitch);
+}
+
+//
+// Frame converter
+//
+// Converts whole frames between pixel formats, either with swscale on one
+// thread, with one swscale context per horizontal slice run on a JobPool, or
+// with the hand-written converters above, also sliced. Slices are converted
+// independently, so swscale may only be sliced where it never filters across
+// rows: same-size conversions that keep the vertical chroma resolution.
+// Resampling chroma between rows, as YUV420P to RGB24 does, would clamp at
+// every slice edge and leave seams, so those fall back to a single context.
+//
+
+enum : u8 {
+  AV_CONVERT_SWS = 0,
+  AV_CONVERT_SWS_SLICED,
+  AV_CONVERT_SIMD,
+  AV_CONVERT_COUNT,
+};
+
+const char* const AV_CONVERT_NAMES[AV_CONVERT_COUNT] = { "sws", "sliced", "simd" };
+
+constexpr u32 AV_MAX_SLICES = 64;
+
+struct AV_Converter {
+  u32 src_w;
+  u32 src_h;
+  AVPixelFormat src_fmt;
+  u32 dst_w;
+  u32 dst_h;
+  AVPixelFormat dst_fmt;
+  u8 mode;
+  JobPool* jobs;
+  u32 num_slices;
+  u32 slice_y[AV_MAX_SLICES + 1];
+  SwsContext* sws[AV_MAX_SLICES];
+  // Arguments of the running conversion
+  const u8* const* src;
+  const int* src_pitch;
+  u8* const* dst;
+  const int* dst_pitch;
+};
+
+static inline u8 AV_ParseConvertMode(const char* name) {
+  for (u8 i = 0; i < AV_CONVERT_COUNT; ++i) {
+    if (std::strcmp(name, AV_CONVERT_NAMES[i]) == 0) {
+      return i;
+    }
+  }
+  return AV_CONVERT_COUNT;
+}
+
+static inline bool AV_ConverterHasSIMD(AVPixelFormat src_fmt, AVPixelFormat dst_fmt) {
+  return (src_fmt == AV_PIX_FMT_RGB24 && dst_fmt == AV_PIX_FMT_YUV420P) ||
+         (src_fmt == AV_PIX_FMT_YUV420P && dst_fmt == AV_PIX_FMT_RGB24);
+}
+
+// Returns the mode actually used, which can be lower than requested
+static inline u8 AV_ConverterInit(AV_Converter* conv, u32 src_w, u32 src_h, AVPixelFormat src_fmt,
+                                  u32 dst_w, u32 dst_h, AVPixelFormat dst_fmt, u8 mode, JobPool* jobs, int sws_flags = SWS_BICUBIC) {
+  *conv = { };
+  conv->src_w = src_w;
+  conv->src_h = src_h;
+  conv->src_fmt = src_fmt;
+  conv->dst_w = dst_w;
+  conv->dst_h = dst_h;
+  conv->dst_fmt = dst_fmt;
+  conv->jobs = jobs;
+
+  if (src_w != dst_w || src_h != dst_h || !jobs) {
+    mode = AV_CONVERT_SWS;
+  }
+  if (mode == AV_CONVERT_SIMD && !AV_ConverterHasSIMD(src_fmt, dst_fmt)) {
+    mode = AV_CONVERT_SWS_SLICED;
+  }
+  const AVPixFmtDescriptor* src_desc = av_pix_fmt_desc_get(src_fmt);
+  const AVPixFmtDescriptor* dst_desc = av_pix_fmt_desc_get(dst_fmt);
+  if (mode == AV_CONVERT_SWS_SLICED && src_desc->log2_chroma_h != dst_desc->log2_chroma_h) {
+    mode = AV_CONVERT_SWS;
+  }
+  conv->mode = mode;
+
+  // Slice heights must keep chroma rows whole
+  const u32 align = 1u << Max(src_desc->log2_chroma_h, dst_desc->log2_chroma_h);
+  u32 num_slices = mode == AV_CONVERT_SWS ? 1 : Min(jobs->Concurrency() * 2, AV_MAX_SLICES);
+  num_slices = Max(Min(num_slices, src_h / align), 1u);
+  conv->num_slices = num_slices;
+  for (u32 i = 0; i <= num_slices; ++i) {
+    conv->slice_y[i] = (i == num_slices) ? src_h : (src_h * i / num_slices) & ~(align - 1);
+  }
+
+  if (mode != AV_CONVERT_SIMD) {
+    for (u32 i = 0; i < num_slices; ++i) {
+      const u32 slice_h = conv->slice_y[i + 1] - conv->slice_y[i];
+      conv->sws[i] = sws_getContext(src_w, mode == AV_CONVERT_SWS ? src_h : slice_h, src_fmt,
+                                    dst_w, mode == AV_CONVERT_SWS ? dst_h : slice_h, dst_fmt,
+                                    sws_flags, 0, 0, 0);
+      assert(conv->sws[i]);
+    }
+  }
+  return mode;
+}
+
+static inline void AV_ConverterFree(AV_Converter* conv) {
+  for (u32 i = 0; i < conv->num_slices; ++i) {
+    sws_freeContext(conv->sws[i]);
+  }
+  *conv = { };
+}
+
+// Plane pointers offset to the first row of a slice
+static inline void AV_SlicePlanes(AVPixelFormat fmt, const u8* const* data, const int* pitch, u32 y, const u8** out) {
+  const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(fmt);
+  const int num_planes = av_pix_fmt_count_planes(fmt);
+  for (int p = 0; p < 4; ++p) {
+    if (p < num_planes && data[p]) {
+      const bool chroma = p == 1 || p == 2;
+      out[p] = data[p] + (usize)(chroma ? (y >> desc->log2_chroma_h) : y) * pitch[p];
+    } else {
+      out[p] = 0;
+    }
+  }
+}
+
+static inline void AV_ConverterSliceJob(void* userdata, u32 slice) {
+  AV_Converter* conv = (AV_Converter*)userdata;
+  const u32 y0 = conv->slice_y[slice];
+  const u32 h = conv->slice_y[slice + 1] - y0;
+  const u8* src[4];
+  const u8* dst[4];
+  AV_SlicePlanes(conv->src_fmt, conv->src, conv->src_pitch, y0, src);
+  AV_SlicePlanes(conv->dst_fmt, conv->dst, conv->dst_pitch, y0, dst);
+
+  if (conv->mode == AV_CONVERT_SIMD) {
+    if (conv->src_fmt == AV_PIX_FMT_RGB24) {
+      AV_ConvertRGB24ToYUV420P(src[0], conv->src_pitch[0], conv->src_w, h,
+        (u8*)dst[0], conv->dst_pitch[0], (u8*)dst[1], conv->dst_pitch[1], (u8*)dst[2], conv->dst_pitch[2]);
+    } else {
+      AV_ConvertYUV420PToRGB24(src[0], conv->src_pitch[0], src[1], conv->src_pitch[1], src[2], conv->src_pitch[2],
+        conv->src_w, h, (u8*)dst[0], conv->dst_pitch[0]);
+    }
+  } else {
+    sws_scale(conv->sws[slice], src, conv->src_pitch, 0, h, (u8* const*)dst, conv->dst_pitch);
+  }
+}
+
+static inline void AV_ConverterRun(AV_Converter* conv, const u8* const* src, const int* src_pitch, u8* const* dst, const int* dst_pitch) {
+  if (conv->mode == AV_CONVERT_SWS) {
+    sws_scale(conv->sws[0], src, src_pitch, 0, conv->src_h, dst, dst_pitch);
+    return;
+  }
+  conv->src = src;
+  conv->src_pitch = src_pitch;
+  conv->dst = dst;
+  conv->dst_pitch = dst_pitch;
+  conv->jobs->Run(conv->num_slices, AV_ConverterSliceJob, conv);
+}
+
+//
+// Packet and frame pools
+//
+// Recycle AVPackets and AVFrames between the stages of an encode pipeline so
+// steady-state recording stays off the heap. Packet payloads come from
+// size-bucketed AVBufferPools through the encoder's get_encode_buffer
+// callback and go back to their bucket when the last reference is dropped,
+// on whichever thread that happens. Each pool counts the times it had to
+// allocate, so a flat counter over a run proves the pool is warm.
+//
+
+constexpr u32 AV_PACKET_BUCKETS = 13;
+constexpr usize AV_PACKET_MIN_BUCKET = 4096; // Largest bucket is 16 MiB
+
+struct AV_PacketPool {
+  SDL_Mutex* mtx;
+  AVPacket** free;
+  u32 num_free;
+  u32 capacity;
+  AVBufferPool* buckets[AV_PACKET_BUCKETS];
+  SDL_AtomicInt packets_allocated;
+  SDL_AtomicInt buffers_allocated;
+};
+
+static inline AVBufferRef* AV_PacketPoolAllocBuffer(void* opaque, size_t size) {
+  AV_PacketPool* pool = (AV_PacketPool*)opaque;
+  SDL_AddAtomicInt(&pool->buffers_allocated, 1);
+  return av_buffer_alloc(size);
+}
+
+// capacity bounds the packets in flight; count of them are allocated up front
+static inline void AV_PacketPoolInit(AV_PacketPool* pool, u32 capacity, u32 count) {
+  *pool = { };
+  pool->mtx = SDL_CreateMutex();
+  assert(pool->mtx);
+  pool->free = MemAlloc<AVPacket*>(capacity);
+  pool->capacity = capacity;
+  for (u32 i = 0; i < AV_PACKET_BUCKETS; ++i) {
+    pool->buckets[i] = av_buffer_pool_init2(AV_PACKET_MIN_BUCKET << i, pool, AV_PacketPoolAllocBuffer, 0);
+    assert(pool->buckets[i]);
+  }
+  for (u32 i = 0; i < Min(count, capacity); ++i) {
+    pool->free[pool->num_free] = av_packet_alloc();
+    assert(pool->free[pool->num_free]);
+    ++pool->num_free;
+  }
+}
+
+// Every packet must have been returned
+static inline void AV_PacketPoolFree(AV_PacketPool* pool) {
+  for (u32 i = 0; i < pool->num_free; ++i) {
+    av_packet_free(&pool->free[i]);
+  }
+  // Buckets are released once their last buffer is
+  for (u32 i = 0; i < AV_PACKET_BUCKETS; ++i) {
+    av_buffer_pool_uninit(&pool->buckets[i]);
+  }
+  MemFree(pool->free);
+  SDL_DestroyMutex(pool->mtx);
+  *pool = { };
+}
+
+static inline AVPacket* AV_PacketPoolGet(AV_PacketPool* pool) {
+  SDL_LockMutex(pool->mtx);
+  AVPacket* pkt = pool->num_free > 0 ? pool->free[--pool->num_free] : 0;
+  SDL_UnlockMutex(pool->mtx);
+  if (!pkt) {
+    SDL_AddAtomicInt(&pool->packets_allocated, 1);
+    pkt = av_packet_alloc();
+    assert(pkt);
+  }
+  return pkt;
+}
+
+// Drops the packet's payload reference and keeps the packet for reuse
+static inline void AV_PacketPoolPut(AV_PacketPool* pool, AVPacket* pkt) {
+  av_packet_unref(pkt);
+  SDL_LockMutex(pool->mtx);
+  if (pool->num_free < pool->capacity) {
+    pool->free[pool->num_free++] = pkt;
+    pkt = 0;
+  }
+  SDL_UnlockMutex(pool->mtx);
+  if (pkt) {
+    av_packet_free(&pkt);
+  }
+}
+
+static inline AVBufferRef* AV_PacketPoolGetBuffer(AV_PacketPool* pool, usize size) {
+  for (u32 i = 0; i < AV_PACKET_BUCKETS; ++i) {
+    if (size <= (AV_PACKET_MIN_BUCKET << i)) {
+      return av_buffer_pool_get(pool->buckets[i]);
+    }
+  }
+  return AV_PacketPoolAllocBuffer(pool, size);
+}
+
+// AVCodecContext::get_encode_buffer for encoders with AV_CODEC_CAP_DR1, with
+// the pool in AVCodecContext::opaque
+static inline int AV_PacketPoolGetEncodeBuffer(AVCodecContext* avcc, AVPacket* pkt, int flags) {
+  AV_PacketPool* pool = (AV_PacketPool*)avcc->opaque;
+  pkt->buf = AV_PacketPoolGetBuffer(pool, (usize)pkt->size + AV_INPUT_BUFFER_PADDING_SIZE);
+  if (!pkt->buf) {
+    return AVERROR(ENOMEM);
+  }
+  pkt->data = pkt->buf->data;
+  SDL_memset(pkt->data + pkt->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+  return 0;
+}
+
+static inline void AV_PacketPoolAttach(AV_PacketPool* pool, AVCodecContext* avcc) {
+  if (avcc->codec->capabilities & AV_CODEC_CAP_DR1) {
+    avcc->opaque = pool;
+    avcc->get_encode_buffer = AV_PacketPoolGetEncodeBuffer;
+  }
+}
+
+constexpr u32 AV_FRAME_POOL_MAX = 32;
+
+// Frames stay owned by the pool; a frame is free again once nothing else
+// holds a reference to its buffers. Used from a single thread.
+struct AV_FramePool {
+  AVFrame* frames[AV_FRAME_POOL_MAX];
+  u32 num_frames;
+  AVPixelFormat fmt;
+  u32 w;
+  u32 h;
+  u32 next;
+  u32 frames_allocated;
+};
+
+static inline AVFrame* AV_FramePoolAlloc(AV_FramePool* pool) {
+  assert(pool->num_frames < AV_FRAME_POOL_MAX);
+  AVFrame* frame = av_frame_alloc();
+  assert(frame);
+  frame->format = pool->fmt;
+  frame->width = pool->w;
+  frame->height = pool->h;
+  int avret = av_frame_get_buffer(frame, 0);
+  assert(avret >= 0);
+  pool->frames[pool->num_frames++] = frame;
+  ++pool->frames_allocated;
+  return frame;
+}
+
+static inline void AV_FramePoolInit(AV_FramePool* pool, AVPixelFormat fmt, u32 w, u32 h, u32 count) {
+  *pool = { };
+  pool->fmt = fmt;
+  pool->w = w;
+  pool->h = h;
+  for (u32 i = 0; i < count; ++i) {
+    AV_FramePoolAlloc(pool);
+  }
+}
+
+static inline void AV_FramePoolFree(AV_FramePool* pool) {
+  for (u32 i = 0; i < pool->num_frames; ++i) {
+    av_frame_free(&pool->frames[i]);
+  }
+  *pool = { };
+}
+
+// Returns a frame whose buffers nobody else references, growing the pool
+// only when every frame is still in flight. Frames are handed out round
+// robin so the one just returned is the last to be reused.
+static inline AVFrame* AV_FramePoolGetWritable(AV_FramePool* pool) {
+  for (u32 i = 0; i < pool->num_frames; ++i) {
+    AVFrame* frame = pool->frames[(pool->next + i) % pool->num_frames];
+    if (av_frame_is_writable(frame)) {
+      pool->next = (pool->next + i + 1) % pool->num_frames;
+      return frame;
+    }
+  }
+  return AV_FramePoolAlloc(pool);
+}
+
+//
+// Decoder frame buffers
+//
+// AVCodecContext::get_buffer2 backed by one AVBufferPool per frame layout, so
+// decoded frames reuse their buffers once playback is warm and every new
+// buffer is counted. Decoders without AV_CODEC_CAP_DR1 keep their default.
+//
+
+struct AV_DecodeBufferPool {
+  SDL_Mutex* mtx;
+  AVBufferPool* pool;
+  AVPixelFormat fmt;
+  int w;
+  int h;
+  int linesize[4];
+  usize offset[4];
+  SDL_AtomicInt buffers_allocated;
+};
+
+static inline AVBufferRef* AV_DecodeBufferPoolAlloc(void* opaque, size_t size) {
+  AV_DecodeBufferPool* pool = (AV_DecodeBufferPool*)opaque;
+  SDL_AddAtomicInt(&pool->buffers_allocated, 1);
+  return av_buffer_alloc(size);
+}
+
+// Lay out planes for an aligned w x h frame the way libavcodec's default
+// allocator does: widen rows until every linesize meets the decoder's
+// alignment, then pad the end for SIMD overreads
+static inline void AV_DecodeBufferPoolReset(AV_DecodeBufferPool* pool, AVPixelFormat fmt, int w, int h, const int* linesize_align) {
+  av_buffer_pool_uninit(&pool->pool);
+  pool->fmt = fmt;
+  pool->w = w;
+  pool->h = h;
+
+  int linesize[4] = { };
+  for (int unaligned = 1; unaligned; ) {
+    int avret = av_image_fill_linesizes(linesize, fmt, w);
+    assert(avret >= 0);
+    w += w & ~(w - 1);
+    unaligned = 0;
+    for (int p = 0; p < 4; ++p) {
+      unaligned |= linesize[p] % linesize_align[p];
+    }
+  }
+
+  ptrdiff_t linesize_ptr[4] = { };
+  for (int p = 0; p < 4; ++p) {
+    pool->linesize[p] = linesize[p];
+    linesize_ptr[p] = linesize[p];
+  }
+  size_t plane_size[4] = { };
+  int avret = av_image_fill_plane_sizes(plane_size, fmt, h, linesize_ptr);
+  assert(avret >= 0);
+  usize total = 0;
+  for (int p = 0; p < 4; ++p) {
+    pool->offset[p] = total;
+    total += plane_size[p];
+  }
+  pool->pool = av_buffer_pool_init2(total + 16 + 64 - 1, pool, AV_DecodeBufferPoolAlloc, 0);
+  assert(pool->pool);
+}
+
+static inline int AV_DecodeBufferPoolGetBuffer(AVCodecContext* avcc, AVFrame* frame, int flags) {
+  AV_DecodeBufferPool* pool = (AV_DecodeBufferPool*)avcc->opaque;
+  const AVPixelFormat fmt = (AVPixelFormat)frame->format;
+  const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(fmt);
+  if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL))) {
+    return avcodec_default_get_buffer2(avcc, frame, flags);
+  }
+
+  int w = frame->width;
+  int h = frame->height;
+  int linesize_align[AV_NUM_DATA_POINTERS] = { };
+  avcodec_align_dimensions2(avcc, &w, &h, linesize_align);
+
+  // Frame threads can call in concurrently
+  SDL_LockMutex(pool->mtx);
+  if (!pool->pool || pool->fmt != fmt || pool->w != w || pool->h != h) {
+    AV_DecodeBufferPoolReset(pool, fmt, w, h, linesize_align);
+  }
+  frame->buf[0] = av_buffer_pool_get(pool->pool);
+  for (int p = 0; p < 4 && frame->buf[0]; ++p) {
+    frame->data[p] = pool->linesize[p] ? frame->buf[0]->data + pool->offset[p] : 0;
+    frame->linesize[p] = pool->linesize[p];
+  }
+  SDL_UnlockMutex(pool->mtx);
+
+  if (!frame->buf[0]) {
+    return AVERROR(ENOMEM);
+  }
+  frame->extended_data = frame->data;
+  return 0;
+}
+
+// Call before avcodec_open2
+static inline void AV_DecodeBufferPoolAttach(AV_DecodeBufferPool* pool, AVCodecContext* avcc) {
+  *pool = { };
+  pool->mtx = SDL_CreateMutex();
+  assert(pool->mtx);
+  if (avcc->codec->capabilities & AV_CODEC_CAP_DR1) {
+    avcc->opaque = pool;
+    avcc->get_buffer2 = AV_DecodeBufferPoolGetBuffer;
+  }
+}
+
+// Call after the decoder is freed; the pool itself lives until the last
+// frame referencing it is unreferenced
+static inline void AV_DecodeBufferPoolFree(AV_DecodeBufferPool* pool) {
+  av_buffer_pool_uninit(&pool->pool);
+  SDL_DestroyMutex(pool->mtx);
+  pool->mtx = 0;
+}
+
+//
+// File input
+//
+// Custom AVIOContexts for local files. mmap maps the whole file and copies
+// out of the page cache with sequential and readahead hints, so demuxing
+// resident data makes no syscalls. pread reads large blocks straight into
+// FFmpeg's buffer, a few syscalls per MiB instead of FFmpeg's default 32 KiB
+// reads. Both need POSIX; elsewhere, for files that are not regular, and
+// when setup fails, input falls back to FFmpeg's own file protocol.
+//
+
+enum : u8 {
+  AV_INPUT_DEFAULT = 0,
+  AV_INPUT_MMAP,
+  AV_INPUT_PREAD,
+  AV_INPUT_COUNT,
+};
+
+const char* const AV_INPUT_NAMES[AV_INPUT_COUNT] = { "default", "mmap", "pread" };
+
+constexpr int AV_INPUT_BLOCK = 1 << 20;
+constexpr i64 AV_INPUT_READAHEAD = 16 << 20;
+
+struct AV_FileInput {
+  u8 mode;
+  int fd;
+  u8* map;
+  i64 size;
+  i64 pos;
+  // mmap: end of the range last hinted with MADV_WILLNEED
+  i64 advised;
+  AVIOContext* avio;
+  // Read callbacks, which for pread are also syscalls, and bytes read
+  u64 reads;
+  u64 bytes;
+};
+
+static inline u8 AV_ParseInputMode(const char* name) {
+  for (u8 i = 0; i < AV_INPUT_COUNT; ++i) {
+    if (std::strcmp(name, AV_INPUT_NAMES[i]) == 0) {
+      return i;
+    }
+  }
+  return AV_INPUT_COUNT;
+}
+
+static inline int AV_FileInputRead(void* opaque, u8* buf, int size) {
+  AV_FileInput* in = (AV_FileInput*)opaque;
+  i64 n = Min((i64)size, in->size - in->pos);
+  if (n <= 0) {
+    return AVERROR_EOF;
+  }
+  ++in->reads;
+#ifdef FUN_POSIX
+  if (in->map) {
+    // Ask for the next window while half of the current one is still ahead
+    if (in->pos + n > in->advised - AV_INPUT_READAHEAD / 2) {
+      const i64 page = (i64)sysconf(_SC_PAGESIZE);
+      const i64 start = in->pos & ~(page - 1);
+      const i64 len = Min(AV_INPUT_READAHEAD, in->size - start);
+      madvise(in->map + start, (size_t)len, MADV_WILLNEED);
+      in->advised = start + len;
+    }
+    std::memcpy(buf, in->map + in->pos, (size_t)n);
+  } else {
+    const ssize_t got = pread(in->fd, buf, (size_t)n, (off_t)in->pos);
+    if (got <= 0) {
+      return got == 0 ? AVERROR_EOF : AVERROR(errno);
+    }
+    n = got;
+  }
+#endif
+  in->pos += n;
+  in->bytes += n;
+  return (int)n;
+}
+
+static inline i64 AV_FileInputSeek(void* opaque, i64 offset, int whence) {
+  AV_FileInput* in = (AV_FileInput*)opaque;
+  i64 pos = 0;
+  switch (whence & ~AVSEEK_FORCE) {
+  case AVSEEK_SIZE: return in->size;
+  case SEEK_SET: pos = offset; break;
+  case SEEK_CUR: pos = in->pos + offset; break;
+  case SEEK_END: pos = in->size + offset; break;
+  default: return AVERROR(EINVAL);
+  }
+  if (pos < 0) {
+    return AVERROR(EINVAL);
+  }
+  // Readahead restarts from the new position
+  in->pos = pos;
+  in->advised = pos;
+  return pos;
+}
+
+// Call after avformat_close_input
+static inline void AV_FileInputClose(AV_FileInput* in) {
+  if (in->avio) {
+    av_freep(&in->avio->buffer);
+    avio_context_free(&in->avio);
+  }
+#ifdef FUN_POSIX
+  if (in->map) {
+    munmap(in->map, (size_t)in->size);
+  }
+  // fd is only ours once a custom mode is set, a zeroed input holds none
+  if (in->mode != AV_INPUT_DEFAULT) {
+    close(in->fd);
+  }
+#endif
+  *in = { };
+  in->fd = -1;
+}
+
+// Opens path for demuxing through the given input mode. Returns what
+// avformat_open_input does; in->mode is the mode actually used.
+static inline int AV_FileInputOpen(AV_FileInput* in, AVFormatContext** avfc, const char* path, u8 mode) {
+  *in = { };
+  in->fd = -1;
+#ifdef FUN_POSIX
+  struct stat st = { };
+  if (mode != AV_INPUT_DEFAULT) {
+    in->fd = open(path, O_RDONLY | O_CLOEXEC);
+  }
+  if (in->fd >= 0 && fstat(in->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    in->size = st.st_size;
+    if (mode == AV_INPUT_MMAP) {
+      void* map = mmap(0, (size_t)in->size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+      if (map != MAP_FAILED) {
+        in->map = (u8*)map;
+        madvise(map, (size_t)in->size, MADV_SEQUENTIAL);
+      } else {
+        mode = AV_INPUT_PREAD;
+      }
+    }
+#ifdef FUN_LINUX
+    if (mode == AV_INPUT_PREAD) {
+      posix_fadvise(in->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+#endif
+    in->mode = mode;
+  } else if (in->fd >= 0) {
+    close(in->fd);
+    in->fd = -1;
+  }
+#endif
+  if (in->mode == AV_INPUT_DEFAULT) {
+    return avformat_open_input(avfc, path, 0, 0);
+  }
+
+  u8* buffer = (u8*)av_malloc(AV_INPUT_BLOCK);
+  assert(buffer);
+  in->avio = avio_alloc_context(buffer, AV_INPUT_BLOCK, 0, in, AV_FileInputRead, 0, AV_FileInputSeek);
+  assert(in->avio);
+  *avfc = avformat_alloc_context();
+  assert(*avfc);
+  (*avfc)->pb = in->avio;
+  // Frees *avfc on failure but leaves the custom context to us
+  const int ret = avformat_open_input(avfc, path, 0, 0);
+  if (ret < 0) {
+    AV_FileInputClose(in);
+  }
+  return ret;
+}
+
+#endif // _COMMON_AV_HH_
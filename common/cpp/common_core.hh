@@ -19,6 +19,24 @@
 # define FUN_POSIX
 #endif
 
+//
+// Architecture detection
+//
+
+#if defined(__x86_64__) || defined(_M_X64)
+# define FUN_X64
+#elif defined(__aarch64__) || defined(_M_ARM64)
+# define FUN_ARM64
+#endif
+
+// Compile a single function for extra instruction sets, e.g.
+// FUN_TARGET("avx2,fma"). Callers must check CPU support at runtime.
+#if defined(_MSC_VER)
+# define FUN_TARGET(features)
+#else
+# define FUN_TARGET(features) __attribute__((target(features)))
+#endif
+
 //
 // Other headers
 //
@@ -111,6 +129,26 @@ static inline f32 RemapClamp(f32 val, f32 min1, f32 max1, f32 min2, f32 max2) {
   return Clamp(Remap(val, min1, max1, min2, max2), min2, max2);
 }
 
+//
+// CPU features
+//
+
+static inline bool CPU_HasSSSE3() {
+#if defined(FUN_X64) && !defined(_MSC_VER)
+  return __builtin_cpu_supports("ssse3");
+#else
+  return false;
+#endif
+}
+
+static inline bool CPU_HasAVX2() {
+#if defined(FUN_X64) && !defined(_MSC_VER)
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+  return false;
+#endif
+}
+
 //
 // Memory allocation
 //
@@ -0,0 +1,139 @@
+#ifndef _COMMON_THREAD_HH_
+#define _COMMON_THREAD_HH_
+
+#include "common_core.hh"
+
+#include <SDL3/SDL.h>
+
+//
+// Job pool
+//
+// Fixed set of worker threads that run parallel-for style batches. The
+// calling thread takes part in each batch and Run() returns once every job
+// has finished.
+//
+
+using JobFn = void(*)(void* userdata, u32 job);
+
+class JobPool {
+private:
+  SDL_Thread** threads = 0;
+  u32 num_threads = 0;
+  SDL_Mutex* mtx = 0;
+  SDL_Condition* cond_work = 0;
+  SDL_Condition* cond_done = 0;
+  u32 generation = 0;
+  // Workers done with the current generation
+  u32 finished = 0;
+  bool quit = false;
+  JobFn fn = 0;
+  void* userdata = 0;
+  u32 num_jobs = 0;
+  SDL_AtomicInt next_job = { };
+public:
+  // 0 workers picks one less than the number of logical cores
+  void Init(u32 workers = 0) {
+    if (workers == 0) {
+      workers = (u32)Max(SDL_GetNumLogicalCPUCores() - 1, 0);
+    }
+    mtx = SDL_CreateMutex();
+    cond_work = SDL_CreateCondition();
+    cond_done = SDL_CreateCondition();
+    assert(mtx && cond_work && cond_done);
+    threads = MemAllocZ<SDL_Thread*>(Max(workers, 1u));
+    num_threads = workers;
+    for (u32 i = 0; i < num_threads; ++i) {
+      threads[i] = SDL_CreateThread(WorkerMain, "fun_job", this);
+      assert(threads[i]);
+    }
+  }
+
+  void Shutdown() {
+    if (!mtx) {
+      return;
+    }
+    SDL_LockMutex(mtx);
+    quit = true;
+    SDL_BroadcastCondition(cond_work);
+    SDL_UnlockMutex(mtx);
+    for (u32 i = 0; i < num_threads; ++i) {
+      SDL_WaitThread(threads[i], 0);
+    }
+    MemFree(threads);
+    SDL_DestroyCondition(cond_done);
+    SDL_DestroyCondition(cond_work);
+    SDL_DestroyMutex(mtx);
+    *this = JobPool();
+  }
+
+  // Number of threads taking part in a batch, including the caller
+  u32 Concurrency() const {
+    return num_threads + 1;
+  }
+
+  void Run(u32 count, JobFn job_fn, void* job_userdata) {
+    if (num_threads == 0 || count <= 1) {
+      for (u32 i = 0; i < count; ++i) {
+        job_fn(job_userdata, i);
+      }
+      return;
+    }
+
+    SDL_LockMutex(mtx);
+    fn = job_fn;
+    userdata = job_userdata;
+    num_jobs = count;
+    SDL_SetAtomicInt(&next_job, 0);
+    finished = 0;
+    ++generation;
+    SDL_BroadcastCondition(cond_work);
+    SDL_UnlockMutex(mtx);
+
+    RunJobs(job_fn, job_userdata, count);
+
+    // Every worker must be done with this generation, not just the jobs.
+    // A worker that only woke after the jobs drained would otherwise copy
+    // this batch's fn and then claim indices from the next one.
+    SDL_LockMutex(mtx);
+    while (finished < num_threads) {
+      SDL_WaitCondition(cond_done, mtx);
+    }
+    SDL_UnlockMutex(mtx);
+  }
+private:
+  void RunJobs(JobFn job_fn, void* job_userdata, u32 count) {
+    for (u32 job = (u32)SDL_AddAtomicInt(&next_job, 1); job < count; job = (u32)SDL_AddAtomicInt(&next_job, 1)) {
+      job_fn(job_userdata, job);
+    }
+  }
+
+  static int SDLCALL WorkerMain(void* ptr) {
+    JobPool* pool = (JobPool*)ptr;
+    u32 seen = 0;
+    SDL_LockMutex(pool->mtx);
+    while (true) {
+      while (pool->generation == seen && !pool->quit) {
+        SDL_WaitCondition(pool->cond_work, pool->mtx);
+      }
+      if (pool->quit) {
+        break;
+      }
+      seen = pool->generation;
+      JobFn job_fn = pool->fn;
+      void* job_userdata = pool->userdata;
+      u32 count = pool->num_jobs;
+      SDL_UnlockMutex(pool->mtx);
+
+      pool->RunJobs(job_fn, job_userdata, count);
+
+      SDL_LockMutex(pool->mtx);
+      if (++pool->finished == pool->num_threads) {
+        SDL_SignalCondition(pool->cond_done);
+      }
+    }
+    SDL_UnlockMutex(pool->mtx);
+    return 0;
+  }
+};
+
+#endif // _COMMON_THREAD_HH_
@@ -13,6 +13,8 @@ using Color = Color_RGBA24;
 // only render visible ascii
 const usize FR_FIRST_CHAR = (usize)' ';
 const usize FR_LAST_CHAR  = (usize)'~';
+const usize FR_ATLAS_W = 1024;
+const usize FR_ATLAS_H = 1024;
 
 struct FontGlyphInfo {
   Vec2 advance;
@@ -26,11 +28,18 @@ struct FontAtlas {
   u16 height;
   SDL_Texture* texture;
   FontGlyphInfo glyphs[FR_LAST_CHAR - FR_FIRST_CHAR + 1];
+  // glyph quads queued this frame, 4 vertices each
+  SDL_Vertex* vertices;
+  usize num_quads;
+  usize max_quads;
 };
 
 struct FontRenderer {
   FT_Face face;
   FontAtlas* atlas;
+  // two triangles per quad, shared by all atlases
+  int* indices;
+  usize max_quads;
 };
 
 enum {
@@ -88,8 +97,8 @@ FontAtlas* FT_GetAtlas(FontRenderer* fr, u16 height) {
     SDL_Log("Failed to set FreeType face size");
   }
 
-  const usize atlas_w = 1024;
-  const usize atlas_h = 1024;
+  const usize atlas_w = FR_ATLAS_W;
+  const usize atlas_h = FR_ATLAS_H;
   const usize atlas_area = atlas_w * atlas_h;
   u32* atlas_pixels = MemAllocZ<u32>(atlas_area); // RGBA
   usize atlas_pitch = atlas_w * 4;
@@ -146,38 +155,80 @@ FontAtlas* FT_GetAtlas(FontRenderer* fr, u16 height) {
   return atlas;
 }
 
+// Queues text into its atlas's batch, drawn by FT_Flush. Colour goes in the
+// vertices, so differently coloured text still shares one draw call.
 void FT_Draw(FontRenderer* fr, u16 height, Color color, Vec2 pos, const char* text) {
   FontAtlas* atlas = FT_GetAtlas(fr, height);
 
-#if 0
-  SDL_FRect dst_rect = {
-    .x = 0, .y = 0,
-    .w = 512, .h = 512,
-  };
-  SDL_RenderTexture(g.r, atlas->texture, 0, &dst_rect);
-#endif
-
-  SDL_SetTextureColorMod(atlas->texture, color.r, color.g, color.b);
+  const usize len = SDL_strlen(text);
+  if (atlas->num_quads + len > atlas->max_quads) {
+    atlas->max_quads = Max(atlas->max_quads * 2, atlas->num_quads + len);
+    SDL_Vertex* grown = MemAlloc<SDL_Vertex>(4 * atlas->max_quads);
+    if (atlas->num_quads > 0) {
+      SDL_memcpy(grown, atlas->vertices, sizeof(SDL_Vertex) * 4 * atlas->num_quads);
+    }
+    MemFree(atlas->vertices);
+    atlas->vertices = grown;
+  }
 
+  const SDL_FColor fcolor = { color.r / 255.0f, color.g / 255.0f, color.b / 255.0f, 1.0f };
+  const Vec2 inv_atlas_dim = Vec2(1.0f / FR_ATLAS_W, 1.0f / FR_ATLAS_H);
   for (; *text; ++text) {
     const FontGlyphInfo* gi = &atlas->glyphs[(usize)*text - FR_FIRST_CHAR];
-    SDL_FRect src_rect = {
-      .x = gi->tex_tl.x,
-      .y = gi->tex_tl.y,
-      .w = gi->tex_br.x - gi->tex_tl.x,
-      .h = gi->tex_br.y - gi->tex_tl.y,
-    };
-    SDL_FRect dst_rect = {
-      .x = pos.x + gi->bearing.x,
-      .y = pos.y - gi->bearing.y,
-      .w = src_rect.w,
-      .h = src_rect.h,
-    };
-    SDL_RenderTexture(g.r, atlas->texture, &src_rect, &dst_rect);
+    const Vec2 tl = Vec2(pos.x + gi->bearing.x, pos.y - gi->bearing.y);
+    const Vec2 br = Vec2(tl.x + gi->tex_br.x - gi->tex_tl.x, tl.y + gi->tex_br.y - gi->tex_tl.y);
+    const Vec2 uv_tl = Vec2(gi->tex_tl.x * inv_atlas_dim.x, gi->tex_tl.y * inv_atlas_dim.y);
+    const Vec2 uv_br = Vec2(gi->tex_br.x * inv_atlas_dim.x, gi->tex_br.y * inv_atlas_dim.y);
+    SDL_Vertex* v = &atlas->vertices[atlas->num_quads++ * 4];
+    v[0] = { { tl.x, tl.y }, fcolor, { uv_tl.x, uv_tl.y } };
+    v[1] = { { br.x, tl.y }, fcolor, { uv_br.x, uv_tl.y } };
+    v[2] = { { br.x, br.y }, fcolor, { uv_br.x, uv_br.y } };
+    v[3] = { { tl.x, br.y }, fcolor, { uv_tl.x, uv_br.y } };
     pos += gi->advance;
   }
 }
 
+// Draws everything queued since the last flush, one call per atlas. Flush
+// before drawing anything else that should end up on top of the text.
+void FT_Flush(FontRenderer* fr) {
+  for (FontAtlas* atlas = fr->atlas; atlas; atlas = atlas->next) {
+    if (atlas->num_quads == 0) {
+      continue;
+    }
+    if (atlas->num_quads > fr->max_quads) {
+      fr->max_quads = Max(fr->max_quads * 2, atlas->num_quads);
+      MemFree(fr->indices);
+      fr->indices = MemAlloc<int>(6 * fr->max_quads);
+      for (usize i = 0; i < fr->max_quads; ++i) {
+        const int base = (int)(i * 4);
+        int* idx = &fr->indices[i * 6];
+        idx[0] = base + 0; idx[1] = base + 1; idx[2] = base + 2;
+        idx[3] = base + 0; idx[4] = base + 2; idx[5] = base + 3;
+      }
+    }
+    SDL_RenderGeometry(g.r, atlas->texture, atlas->vertices, (int)(atlas->num_quads * 4), fr->indices, (int)(atlas->num_quads * 6));
+    atlas->num_quads = 0;
+  }
+}
+
+void FR_Free(FontRenderer* fr) {
+  for (FontAtlas* atlas = fr->atlas; atlas;) {
+    FontAtlas* next = atlas->next;
+    SDL_DestroyTexture(atlas->texture);
+    MemFree(atlas->vertices);
+    MemFree(atlas);
+    atlas = next;
+  }
+  fr->atlas = 0;
+  MemFree(fr->indices);
+  fr->indices = 0;
+  fr->max_quads = 0;
+  if (fr->face) {
+    FT_Done_Face(fr->face);
+    fr->face = 0;
+  }
+}
+
 struct TextMetrics {
   Vec2 tl_rel;
   Vec2 dim;
@@ -225,6 +276,7 @@ SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[]) {
 void TestRender(const char* text) {
   Vec2 pos = Vec2(15.0f, 15.0f + 32.0f);
   FT_Draw(&g.f_mono, 32, Color::White(), pos, text);
+  FT_Flush(&g.f_mono);
   TextMetrics m = FT_MeasureText(&g.f_mono, 32, text);
 
   Uint8 old_r, old_g, old_b, old_a;
@@ -425,6 +477,7 @@ void RenderGame() {
       m3.dim.x,
       2,
     };
+    FT_Flush(&g.f_mono);
     SDL_SetRenderDrawColor(g.r, 0x7F, 0x7F, 0x7F, 0xFF);
     SDL_RenderFillRect(g.r, &cursor);
 
@@ -465,6 +518,7 @@ SDL_AppResult SDL_AppIterate(void* appstate) {
   SDL_SetRenderDrawColor(g.r, 0x00, 0x00, 0x00, 0xFF);
   SDL_RenderClear(g.r);
   RenderGame();
+  FT_Flush(&g.f_mono);
   SDL_RenderPresent(g.r);
   return SDL_APP_CONTINUE;
 }
@@ -529,5 +583,6 @@ SDL_AppResult SDL_AppEvent(void* appstate, SDL_Event* event) {
 }
 
 void SDLCALL SDL_AppQuit(void* appstate, SDL_AppResult result) {
+  FR_Free(&g.f_mono);
   SDL_Quit();
 }